@@ -0,0 +1,748 @@
+// Benchmark.cpp - Performance regression suite implementation
+
+#include "Benchmark.h"
+#include "CppShell.h"
+#include "Environment.h"
+#include "Executor.h"
+#include "Completion.h"
+#include "Glob.h"
+#include "LexScan.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "ProcessSpawner.h"
+#include "ShellConfig.h"
+#include "ShellStats.h"
+#include "StartupBenchmark.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    struct Case {
+        std::string name;
+        size_t bytes;             // Input handled per op, for throughput (0 = none)
+        std::function<void()> op;
+        bool once;                // Too slow to calibrate: a single op, cold
+    };
+
+    struct Result {
+        std::string name;
+        std::uint64_t iterations = 0;
+        double nsPerOp = 0;
+        double allocsPerOp = 0;
+        double mbPerSecond = 0;
+    };
+
+    // Keeps results alive so the optimizer cannot drop the work
+    volatile size_t g_sink = 0;
+
+    // Corpus
+
+    std::string realisticLine() {
+        return "git log --oneline --author=\"$USER\" | grep -v 'Merge branch' | head -20 "
+            "> /tmp/recent.txt && echo done || echo \"failed: see log\"";
+    }
+
+    std::string realisticScript(size_t minimum) {
+        const char* const lines[] = {
+            ": configure --prefix=/usr/local --enable-shared",
+            ": build \"$target\" --jobs 8 && : install || : report 'build failed'",
+            ": test -f config.h && : echo 'configured'",
+            ": make -C src all CFLAGS=\"-O2 -g\" LDFLAGS=-Wl,--as-needed",
+            ": tar czf release.tar.gz bin lib share ; : sha256sum release.tar.gz",
+        };
+        std::string script;
+        for (size_t i = 0; script.size() < minimum; ++i) {
+            script += lines[i % 5];
+            script += '\n';
+        }
+        return script;
+    }
+
+    std::string longPipeline(size_t stages) {
+        std::string line = "cat input.txt";
+        for (size_t i = 0; i < stages; ++i) {
+            line += " | filter" + std::to_string(i) + " --level " + std::to_string(i % 7);
+        }
+        return line;
+    }
+
+    std::string andChain(size_t links) {
+        std::string line = "true";
+        for (size_t i = 0; i < links; ++i) {
+            line += " && step" + std::to_string(i);
+        }
+        return line;
+    }
+
+    std::string heavyQuoting(size_t words) {
+        std::string line = "printf";
+        for (size_t i = 0; i < words; ++i) {
+            line += " \"a \\\"quoted\\\" $word\" 'single quoted text' escaped\\ space\\\\n";
+        }
+        return line;
+    }
+
+    // Multi-line scripts of at least minimum bytes, each dominated by one
+    // kind of input the lexer's scanners deal with
+    std::string repeatLines(const char* line, size_t minimum) {
+        std::string text;
+        while (text.size() < minimum) {
+            text += line;
+        }
+        return text;
+    }
+
+    std::string wordHeavy(size_t minimum) {
+        return repeatLines("cp --preserve=timestamps /usr/local/share/project/data/records-2024.csv "
+            "/var/backups/project/records-2024.csv.bak\n", minimum);
+    }
+
+    std::string quoteHeavy(size_t minimum) {
+        return repeatLines("echo \"deployment of the release candidate finished without errors\" "
+            "'see the attached report for the full list of changed services'\n", minimum);
+    }
+
+    std::string operatorHeavy(size_t minimum) {
+        return repeatLines("a|b&&c||d;e>f<g>>h|i&&j;k||l\n", minimum);
+    }
+
+    std::string hugeArguments(size_t count) {
+        std::string line = "echo";
+        for (size_t i = 0; i < count; ++i) {
+            line += " argument" + std::to_string(i);
+        }
+        return line;
+    }
+
+    // Run one case: calibrate, then measure until the minimum time is spent
+    Result measure(const Case& benchmark, double minTimeMs) {
+        using Clock = std::chrono::steady_clock;
+        std::uint64_t iterations = 1;
+        if (!benchmark.once) {
+            benchmark.op(); // Warm up caches and lazily built state
+
+            while (true) {
+                auto start = Clock::now();
+                for (std::uint64_t i = 0; i < iterations; ++i) {
+                    benchmark.op();
+                }
+                double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                if (elapsed >= minTimeMs / 10 || iterations >= (1u << 30)) {
+                    double scale = elapsed > 0 ? minTimeMs / elapsed : 10;
+                    iterations = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(
+                        static_cast<double>(iterations) * scale));
+                    break;
+                }
+                iterations *= 10;
+            }
+        }
+
+        std::uint64_t allocations = stats::allocations();
+        auto start = Clock::now();
+        for (std::uint64_t i = 0; i < iterations; ++i) {
+            benchmark.op();
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        allocations = stats::allocations() - allocations;
+
+        Result result;
+        result.name = benchmark.name;
+        result.iterations = iterations;
+        result.nsPerOp = ns / static_cast<double>(iterations);
+        result.allocsPerOp = static_cast<double>(allocations) / static_cast<double>(iterations);
+        if (benchmark.bytes > 0) {
+            result.mbPerSecond = static_cast<double>(benchmark.bytes) / result.nsPerOp * 1e9 / (1024 * 1024);
+        }
+        return result;
+    }
+
+    // ns/op of each case in a file written by --json
+    bool readBaseline(const std::string& path, std::map<std::string, double>& baseline) {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        std::string json = text.str();
+
+        const std::string nameKey = "\"name\": \"";
+        const std::string timeKey = "\"ns_per_op\": ";
+        for (size_t pos = json.find(nameKey); pos != std::string::npos; pos = json.find(nameKey, pos)) {
+            pos += nameKey.size();
+            size_t end = json.find('"', pos);
+            size_t time = json.find(timeKey, end);
+            if (end == std::string::npos || time == std::string::npos) {
+                break;
+            }
+            baseline[json.substr(pos, end - pos)] = std::strtod(json.c_str() + time + timeKey.size(), nullptr);
+        }
+        return true;
+    }
+
+    // Parse a line once into an arena that outlives the benchmark
+    Command parseOnce(const std::string& line, CommandArena& arena) {
+        Parser parser(line);
+        return parser.parse(arena);
+    }
+
+    // Command trees as they were stored before the arena: a heap object per
+    // node, linked by shared_ptr and destroyed through a virtual destructor
+    struct SharedNode {
+        virtual ~SharedNode() = default;
+    };
+
+    struct SharedSimpleNode : SharedNode {
+        explicit SharedSimpleNode(const SimpleCommand& command) : command(command) {}
+        SimpleCommand command;
+    };
+
+    struct SharedListNode : SharedNode {
+        SharedListNode(CommandType type, std::shared_ptr<SharedNode> left, std::shared_ptr<SharedNode> right)
+            : type(type), left(std::move(left)), right(std::move(right)) {}
+        CommandType type;
+        std::shared_ptr<SharedNode> left;
+        std::shared_ptr<SharedNode> right;
+    };
+
+    // Copy a tree into the old layout, lists as left-nested binary nodes
+    std::shared_ptr<SharedNode> buildShared(const Command& command) {
+        if (command.getType() == CommandType::SIMPLE) {
+            return std::make_shared<SharedSimpleNode>(command.getCommand());
+        }
+        std::shared_ptr<SharedNode> node = buildShared(command.getChild(0));
+        for (size_t i = 1; i < command.getChildCount(); ++i) {
+            node = std::make_shared<SharedListNode>(command.getType(), std::move(node),
+                buildShared(command.getChild(i)));
+        }
+        return node;
+    }
+
+    // Copy a tree into an arena, children before their parent and
+    // collected on the arena's operand stack, as the parser adds them
+    NodeIndex buildArena(const Command& command, CommandArena& arena) {
+        if (command.getType() == CommandType::SIMPLE) {
+            return arena.addSimple(command.getCommand());
+        }
+        std::vector<NodeIndex>& operands = arena.operandStack();
+        size_t base = operands.size();
+        for (size_t i = 0; i < command.getChildCount(); ++i) {
+            NodeIndex child = buildArena(command.getChild(i), arena);
+            operands.push_back(child);
+        }
+        NodeIndex index = arena.addList(command.getType(), operands.data() + base, operands.size() - base);
+        operands.resize(base);
+        return index;
+    }
+}
+
+namespace bench {
+
+    int run(const std::string& shell, int argc, char* argv[]) {
+        bool json = false;
+        std::string filter;
+        std::string comparePath;
+        double minTimeMs = config::BENCHMARK_MIN_TIME_MS;
+        for (int i = 0; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--json") {
+                json = true;
+            }
+            else if (arg == "--compare" && i + 1 < argc) {
+                comparePath = argv[++i];
+            }
+            else if (arg == "--min-time" && i + 1 < argc) {
+                minTimeMs = std::atof(argv[++i]);
+            }
+            else if (arg.size() > 1 && arg[0] == '-') {
+                std::cerr << config::SHELL_NAME << ": --benchmark: " << arg << ": invalid option" << std::endl;
+                std::cerr << "usage: cppshell --benchmark [--json] [--compare file] [--min-time ms] [filter]" << std::endl;
+                return 2;
+            }
+            else {
+                filter = arg;
+            }
+        }
+
+        std::map<std::string, double> baseline;
+        if (!comparePath.empty() && !readBaseline(comparePath, baseline)) {
+            std::cerr << config::SHELL_NAME << ": --benchmark: cannot read " << comparePath << std::endl;
+            return 2;
+        }
+
+        // Front-end cases, one per corpus input
+        const std::vector<std::pair<std::string, std::string>> corpus = {
+            { "realistic", realisticLine() },
+            { "long_pipeline", longPipeline(1000) },
+            { "and_chain", andChain(5000) },
+            { "heavy_quoting", heavyQuoting(2000) },
+            { "huge_arguments", hugeArguments(100000) },
+        };
+        const std::string script = realisticScript(config::SCRIPT_CACHE_MIN_SIZE * 4);
+
+        std::vector<Case> cases;
+        std::vector<std::unique_ptr<CommandArena>> arenas;
+        for (const auto& input : corpus) {
+            const std::string& text = input.second;
+            cases.push_back({ "lex/" + input.first, text.size(), [&text] {
+                Lexer lexer(text);
+                g_sink = g_sink + lexer.tokenize().size();
+            }, false });
+
+            arenas.push_back(std::make_unique<CommandArena>());
+            CommandArena* arena = arenas.back().get();
+            cases.push_back({ "parse/" + input.first, text.size(), [&text, arena] {
+                arena->clear();
+                Parser parser(text);
+                g_sink = g_sink + parser.parse(*arena).getIndex();
+            }, false });
+
+            arenas.push_back(std::make_unique<CommandArena>());
+            Command command = parseOnce(text, *arenas.back());
+            cases.push_back({ "tostring/" + input.first, text.size(), [command] {
+                g_sink = g_sink + command.toString().size();
+            }, false });
+        }
+
+        // Lexing throughput over multi-megabyte scripts, tokens dropped as
+        // they come so only the lexer is measured
+        const std::vector<std::pair<std::string, std::string>> lexScripts = {
+            { "words_4mb", wordHeavy(4 * 1024 * 1024) },
+            { "quotes_4mb", quoteHeavy(4 * 1024 * 1024) },
+            { "operators_4mb", operatorHeavy(4 * 1024 * 1024) },
+        };
+        for (const auto& input : lexScripts) {
+            const std::string& text = input.second;
+            cases.push_back({ "lex/" + input.first, text.size(), [&text] {
+                Lexer lexer(text);
+                while (lexer.nextToken().getType() != TokenType::END_OF_INPUT) {
+                    g_sink = g_sink + 1;
+                }
+            }, false });
+        }
+
+        // The word scanner on its own, against the character-class table
+        // loop it replaced
+        const std::string& scanText = lexScripts[0].second;
+        cases.push_back({ "scan/word_end", scanText.size(), [&scanText] {
+            size_t words = 0;
+            for (size_t pos = 0; pos < scanText.size(); ++pos, ++words) {
+                pos += lexscan::findWordEnd(scanText.data() + pos, scanText.size() - pos);
+            }
+            g_sink = g_sink + words;
+        }, false });
+        cases.push_back({ "scan/word_end_table", scanText.size(), [&scanText] {
+            size_t words = 0;
+            for (size_t pos = 0; pos < scanText.size(); ++pos, ++words) {
+                while (pos < scanText.size() && !lexscan::hasClass(scanText[pos],
+                    lexscan::CLASS_SPACE | lexscan::CLASS_OPERATOR | lexscan::CLASS_ESCAPE | lexscan::CLASS_QUOTE)) {
+                    ++pos;
+                }
+            }
+            g_sink = g_sink + words;
+        }, false });
+
+        arenas.push_back(std::make_unique<CommandArena>());
+        CommandArena* scriptArena = arenas.back().get();
+        cases.push_back({ "parse/script", script.size(), [&script, scriptArena] {
+            Parser parser(script);
+            Command command;
+            while (true) {
+                scriptArena->clear();
+                if (!parser.parseNext(*scriptArena, command)) {
+                    break;
+                }
+            }
+        }, false });
+
+        // Building and freeing the script's trees one top-level command at
+        // a time, as script mode does, in the arena and in the shared_ptr
+        // layout it replaced
+        CommandArena referenceArena;
+        std::vector<Command> scriptTrees;
+        {
+            Parser parser(script);
+            Command command;
+            while (parser.parseNext(referenceArena, command)) {
+                scriptTrees.push_back(command);
+            }
+        }
+        CommandArena treeArena;
+        cases.push_back({ "tree/arena", script.size(), [&scriptTrees, &treeArena] {
+            for (const Command& tree : scriptTrees) {
+                treeArena.clear();
+                g_sink = g_sink + buildArena(tree, treeArena);
+            }
+        }, false });
+        cases.push_back({ "tree/shared_ptr", script.size(), [&scriptTrees] {
+            for (const Command& tree : scriptTrees) {
+                std::shared_ptr<SharedNode> root = buildShared(tree);
+                g_sink = g_sink + static_cast<size_t>(root.use_count());
+            }
+        }, false });
+
+        // envp construction over a few hundred variables. They sit in an
+        // overlay so the benchmark's own process environment stays as is.
+        Environment processEnvironment;
+        Environment variables(&processEnvironment);
+        for (int i = 0; i < 300; ++i) {
+            variables.assign("BENCH_VARIABLE_" + std::to_string(i) + "=/opt/bench/" + std::to_string(i), true);
+        }
+        cases.push_back({ "env/envp_cached", 0, [&variables] {
+            g_sink = g_sink + reinterpret_cast<size_t>(variables.envp());
+        }, false });
+        cases.push_back({ "env/envp_rebuild", 0, [&variables] {
+            variables.assign("BENCH_CHANGED=1", true);
+            g_sink = g_sink + reinterpret_cast<size_t>(variables.envp());
+        }, false });
+        cases.push_back({ "env/envp_overlay", 0, [&variables] {
+            Environment overlay(&variables);
+            overlay.assign("FOO=1", true);
+            g_sink = g_sink + reinterpret_cast<size_t>(overlay.envp());
+        }, false });
+
+        // Pathname expansion over a 100k-entry directory and a tree. The
+        // files are only created once a glob case runs.
+        std::string globDir;
+        auto makeGlobTree = [&globDir] {
+            if (!globDir.empty()) {
+                return;
+            }
+            char dir[] = "/tmp/cppshell-glob-XXXXXX";
+            if (mkdtemp(dir) == nullptr) {
+                return;
+            }
+            globDir = dir;
+            for (int i = 0; i < 100000; ++i) {
+                std::string path = globDir + "/file" + std::to_string(i) + (i % 2 ? ".log" : ".txt");
+                close(open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+            }
+            std::string tree = globDir + "/tree";
+            mkdir(tree.c_str(), 0755);
+            for (int d = 0; d < 100; ++d) {
+                std::string sub = tree + "/dir" + std::to_string(d);
+                mkdir(sub.c_str(), 0755);
+                for (int f = 0; f < 100; ++f) {
+                    std::string path = sub + "/obj" + std::to_string(f) + ".o";
+                    close(open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+                }
+            }
+        };
+        GlobExpander globber;
+        GlobExpander cachingGlobber;
+        cachingGlobber.setCaching(true);
+        std::vector<std::string> globMatches;
+        auto globCase = [&](GlobExpander& expander, const std::string& pattern) {
+            makeGlobTree();
+            globMatches.clear();
+            expander.expand(globDir + pattern, globMatches);
+            g_sink = g_sink + globMatches.size();
+        };
+        cases.push_back({ "glob/wide_100k", 0, [&] { globCase(globber, "/*.log"); }, false });
+        cases.push_back({ "glob/wide_100k_cached", 0, [&] { globCase(cachingGlobber, "/*.log"); }, false });
+        cases.push_back({ "glob/literal_prefix", 0, [&] { globCase(globber, "/tree/dir4?/obj1.o"); }, false });
+        cases.push_back({ "glob/globstar", 0, [&] { globCase(globber, "/**/obj9?.o"); }, false });
+
+        // Completion against a PATH directory of 5,000 executables: each
+        // call is what one Tab press costs, refresh included
+        std::string binDir;
+        auto makeBinDir = [&binDir] {
+            if (!binDir.empty()) {
+                return;
+            }
+            char dir[] = "/tmp/cppshell-bin-XXXXXX";
+            if (mkdtemp(dir) == nullptr) {
+                return;
+            }
+            binDir = dir;
+            for (int i = 0; i < 5000; ++i) {
+                std::string path = binDir + "/prog" + std::to_string(i);
+                close(open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0755));
+            }
+        };
+        CompletionIndex completion;
+        std::vector<CompletionIndex::Match> completions;
+        cases.push_back({ "complete/command_prefix", 0, [&] {
+            makeBinDir();
+            completions.clear();
+            completion.refresh({ binDir }, 1);
+            completion.commands("prog12", completions);
+            g_sink = g_sink + completions.size();
+        }, false });
+        cases.push_back({ "complete/file_prefix", 0, [&] {
+            makeBinDir();
+            completions.clear();
+            completion.files(binDir + "/prog12", false, completions);
+            g_sink = g_sink + completions.size();
+        }, false });
+
+        // Executor cases. Background jobs announce themselves on std::cout,
+        // which is silenced while the cases run.
+        Executor executor;
+        CommandArena execArena;
+        auto executeLine = [&executor, &execArena](const std::string& line) {
+            execArena.clear();
+            Parser parser(line);
+            g_sink = g_sink + static_cast<size_t>(executor.execute(parser.parse(execArena)));
+        };
+        cases.push_back({ "exec/builtin", 0, [&] { executeLine("true"); }, false });
+        cases.push_back({ "exec/spawn", 0, [&] { executeLine("/bin/true"); }, false });
+        cases.push_back({ "exec/spawn_assign", 0, [&] { executeLine("FOO=1 /bin/true"); }, false });
+
+        // The launch itself, without parsing or PATH lookup: the spawner's
+        // posix_spawn against the fork+exec it replaced, both starting
+        // /bin/true with the same environment. 1e9 / ns/op is launches/s.
+        SimpleCommand trueCommand("/bin/true");
+        auto reap = [](pid_t pid) {
+            int status = 0;
+            if (pid > 0) {
+                waitpid(pid, &status, 0);
+            }
+            g_sink = g_sink + static_cast<size_t>(status);
+        };
+        cases.push_back({ "launch/posix_spawn", 0, [&] {
+            reap(ProcessSpawner::spawn("/bin/true", trueCommand, IoFds(), processEnvironment.envp()).pid);
+        }, false });
+        cases.push_back({ "launch/fork_exec", 0, [&] {
+            char* const* envp = processEnvironment.envp();
+            pid_t pid = fork();
+            if (pid == 0) {
+                char* const argv[] = { const_cast<char*>("/bin/true"), nullptr };
+                execve("/bin/true", argv, envp);
+                _exit(127);
+            }
+            reap(pid);
+        }, false });
+        cases.push_back({ "exec/pipeline", 0, [&] { executeLine("/bin/echo x | /bin/cat | /bin/cat > /dev/null"); }, false });
+        std::string builtinChain = "true";
+        for (int i = 0; i < 100; ++i) {
+            builtinChain += " && true";
+        }
+        cases.push_back({ "exec/and_chain", 0, [&] { executeLine(builtinChain); }, false });
+        cases.push_back({ "exec/substitute_builtin", 0, [&] { executeLine("true $(echo x) $(pwd)"); }, false });
+        cases.push_back({ "exec/substitute_external", 0, [&] { executeLine("true $(/bin/echo x)"); }, false });
+        std::string hereDocument = "/bin/cat > /dev/null <<END\n";
+        while (hereDocument.size() < 1024 * 1024) {
+            hereDocument += "a line of a large here-document body\n";
+        }
+        hereDocument += "END";
+        cases.push_back({ "exec/heredoc_1mb", hereDocument.size(), [&] { executeLine(hereDocument); }, false });
+        cases.push_back({ "exec/parallel", 0, [&] {
+            executeLine("parallel -j 8 /bin/true ::: 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16");
+        }, false });
+        cases.push_back({ "jobs/10k", 0, [&] {
+            for (int i = 0; i < 10000; ++i) {
+                executeLine("/bin/true &");
+            }
+            executeLine("wait");
+        }, true });
+        cases.push_back({ "jobs/capture_100", 0, [&] {
+            executor.options().jobOutput = true;
+            for (int i = 0; i < 100; ++i) {
+                executeLine("seq 1 20000 &");
+            }
+            executeLine("wait");
+            for (int i = 0; i < 100; ++i) {
+                executeLine("joboutput clear %" + std::to_string(i + 1));
+            }
+            executor.options().jobOutput = false;
+        }, true });
+
+        // Scripts end to end: parsed with the cache off, parsed and stored
+        // (cold), and replayed from the cache (warm)
+        char cacheDir[] = "/tmp/cppshell-bench-XXXXXX";
+        std::string scriptPath;
+        if (mkdtemp(cacheDir) != nullptr) {
+            setenv("CPPSHELL_CACHE_DIR", cacheDir, 1);
+            scriptPath = std::string(cacheDir) + "/script.sh";
+            std::ofstream(scriptPath) << script;
+        }
+        // Only the cache entries go, without starting a process that would
+        // count against the cold case; the scripts beside them stay
+        auto clearCache = [&cacheDir] {
+            DIR* dir = opendir(cacheDir);
+            if (dir == nullptr) {
+                return;
+            }
+            while (struct dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ast") == 0) {
+                    unlink((std::string(cacheDir) + "/" + name).c_str());
+                }
+            }
+            closedir(dir);
+        };
+        if (!scriptPath.empty()) {
+            cases.push_back({ "script/uncached", script.size(), [&] {
+                setenv("CPPSHELL_NO_CACHE", "1", 1);
+                CppShell runner;
+                g_sink = g_sink + static_cast<size_t>(runner.runScript(scriptPath));
+                unsetenv("CPPSHELL_NO_CACHE");
+            }, false });
+            cases.push_back({ "script/cold", script.size(), [&] {
+                clearCache();
+                CppShell runner;
+                g_sink = g_sink + static_cast<size_t>(runner.runScript(scriptPath));
+            }, false });
+            cases.push_back({ "script/warm", script.size(), [&] {
+                CppShell runner;
+                g_sink = g_sink + static_cast<size_t>(runner.runScript(scriptPath));
+            }, false });
+        }
+
+        // An append-heavy logging loop, unrolled since the shell has no
+        // loops: 1000 appends to one file, with and without kept descriptors
+        std::string logScript;
+        std::string uncachedLogScript;
+        if (!scriptPath.empty()) {
+            std::string log = std::string(cacheDir) + "/app.log";
+            std::string body = ": > " + log + "\n";
+            for (int i = 0; i < 1000; ++i) {
+                body += "echo request " + std::to_string(i) + " handled status=200 >> " + log + "\n";
+            }
+            logScript = std::string(cacheDir) + "/log.sh";
+            uncachedLogScript = std::string(cacheDir) + "/log-uncached.sh";
+            std::ofstream(logScript) << body;
+            std::ofstream(uncachedLogScript) << "shopt redirectcache off\n" << body;
+        }
+        if (!logScript.empty()) {
+            cases.push_back({ "redirect/append_1000", 0, [&] {
+                CppShell runner;
+                g_sink = g_sink + static_cast<size_t>(runner.runScript(logScript));
+            }, false });
+            cases.push_back({ "redirect/append_1000_uncached", 0, [&] {
+                CppShell runner;
+                g_sink = g_sink + static_cast<size_t>(runner.runScript(uncachedLogScript));
+            }, false });
+        }
+
+        cases.push_back({ "startup/true", 0, [&shell] {
+            startup::Sample sample;
+            startup::measure(shell, "true", false, sample);
+        }, false });
+
+        // Run
+        std::vector<Result> results;
+        std::streambuf* coutBuffer = std::cout.rdbuf();
+        if (!json) {
+            char header[160];
+            std::snprintf(header, sizeof(header), "%-26s %10s %14s %12s %10s", "case", "iterations",
+                "ns/op", "allocs/op", "MB/s");
+            std::cout << header << std::endl;
+        }
+        for (const auto& benchmark : cases) {
+            if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            std::cout.rdbuf(nullptr);
+            Result result = measure(benchmark, minTimeMs);
+            std::cout.rdbuf(coutBuffer);
+            std::cout.clear();
+            results.push_back(result);
+
+            if (!json) {
+                char line[160];
+                std::snprintf(line, sizeof(line), "%-26s %10llu %14.1f %12.1f", result.name.c_str(),
+                    static_cast<unsigned long long>(result.iterations), result.nsPerOp, result.allocsPerOp);
+                std::cout << line;
+                if (result.mbPerSecond > 0) {
+                    std::snprintf(line, sizeof(line), " %10.1f", result.mbPerSecond);
+                    std::cout << line;
+                }
+                std::cout << std::endl;
+            }
+        }
+
+        // An entry larger than its script costs more to read back than the
+        // script itself, so the cold case also checks what it stored
+        int status = 0;
+        bool coldRan = false;
+        for (const auto& result : results) {
+            coldRan = coldRan || result.name == "script/cold";
+        }
+        if (coldRan) {
+            clearCache();
+            {
+                CppShell runner;
+                g_sink = g_sink + static_cast<size_t>(runner.runScript(scriptPath));
+            }
+            size_t entryBytes = 0;
+            if (DIR* dir = opendir(cacheDir)) {
+                while (struct dirent* entry = readdir(dir)) {
+                    std::string name = entry->d_name;
+                    struct stat info;
+                    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ast") == 0 &&
+                        stat((std::string(cacheDir) + "/" + name).c_str(), &info) == 0) {
+                        entryBytes += static_cast<size_t>(info.st_size);
+                    }
+                }
+                closedir(dir);
+            }
+            if (entryBytes > script.size()) {
+                char line[160];
+                std::snprintf(line, sizeof(line), "size: script/cold cache entry %zu bytes > script %zu bytes",
+                    entryBytes, script.size());
+                std::cerr << line << std::endl;
+                status = 1;
+            }
+        }
+
+        if (!scriptPath.empty()) {
+            g_sink = g_sink + static_cast<size_t>(std::system((std::string("rm -rf ") + cacheDir).c_str()));
+        }
+        if (!globDir.empty()) {
+            g_sink = g_sink + static_cast<size_t>(std::system(("rm -rf " + globDir).c_str()));
+        }
+        if (!binDir.empty()) {
+            g_sink = g_sink + static_cast<size_t>(std::system(("rm -rf " + binDir).c_str()));
+        }
+
+        if (json) {
+            std::cout << "{\n  \"shell\": \"" << config::SHELL_NAME << "\",\n  \"version\": \""
+                << config::VERSION << "\",\n  \"results\": [\n";
+            for (size_t i = 0; i < results.size(); ++i) {
+                const Result& result = results[i];
+                char line[320];
+                std::snprintf(line, sizeof(line),
+                    "    { \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, "
+                    "\"allocs_per_op\": %.2f, \"mb_per_s\": %.1f }%s\n",
+                    result.name.c_str(), static_cast<unsigned long long>(result.iterations),
+                    result.nsPerOp, result.allocsPerOp, result.mbPerSecond,
+                    i + 1 < results.size() ? "," : "");
+                std::cout << line;
+            }
+            std::cout << "  ]\n}" << std::endl;
+        }
+
+        // Regressions against the baseline go to stderr so JSON stays clean
+        for (const auto& result : results) {
+            auto found = baseline.find(result.name);
+            if (found == baseline.end() || found->second <= 0) {
+                continue;
+            }
+            double change = result.nsPerOp / found->second - 1;
+            if (change > config::BENCHMARK_REGRESSION) {
+                char line[160];
+                std::snprintf(line, sizeof(line), "regression: %s %.1f ns/op -> %.1f ns/op (+%.0f%%)",
+                    result.name.c_str(), found->second, result.nsPerOp, change * 100);
+                std::cerr << line << std::endl;
+                status = 1;
+            }
+        }
+        return status;
+    }
+}
@@ -0,0 +1,26 @@
+// Benchmark.h - Performance regression suite
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+
+// Benchmarks of the lexer, parser, Command::toString and the executor over a
+// corpus of realistic and adversarial inputs (long pipelines, deep && chains,
+// heavy quoting, huge argument lists), plus end-to-end cases for script
+// caching, background jobs and startup.
+//
+//   cppshell --benchmark [--json] [--compare file] [--min-time ms] [filter]
+//
+// Each case runs at least --min-time (config::BENCHMARK_MIN_TIME_MS) after
+// calibration and reports ns/op, heap allocations/op and, where a case has
+// an input, MB/s. Only cases whose name contains filter are run. --json
+// prints the results as JSON; --compare reads such a file and fails with
+// status 1 when a case got slower than config::BENCHMARK_REGRESSION allows.
+namespace bench {
+
+    // Implementation of --benchmark; args are the ones after it
+    int run(const std::string& shell, int argc, char* argv[]);
+}
+
+#endif // BENCHMARK_H
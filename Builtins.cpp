@@ -0,0 +1,662 @@
+// Builtins.cpp - Commands the shell runs in-process
+
+#include "Builtins.h"
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+    struct BuiltinSpec {
+        std::string_view name;
+        BuiltinId id;
+        std::string_view summary; // Empty for aliases left out of `help`
+    };
+
+    constexpr BuiltinSpec BUILTINS[] = {
+        { "help", BuiltinId::HELP, "Display this help message" },
+        { "echo", BuiltinId::ECHO, "Write arguments to standard output" },
+        { "printf", BuiltinId::PRINTF, "Format and print arguments" },
+        { "pwd", BuiltinId::PWD, "Print the current directory" },
+        { "true", BuiltinId::TRUE, "Do nothing, successfully" },
+        { "false", BuiltinId::FALSE, "Do nothing, unsuccessfully" },
+        { ":", BuiltinId::COLON, "" },
+        { "test", BuiltinId::TEST, "Evaluate a conditional expression (also [ ... ])" },
+        { "[", BuiltinId::BRACKET, "" },
+        { "hash", BuiltinId::HASH, "Show or reset remembered command locations" },
+        { "shopt", BuiltinId::SHOPT, "Show or change shell options (e.g. shopt pipesize 1m)" },
+        { "shellstats", BuiltinId::SHELLSTATS, "Show where the shell spends time and memory" },
+        { "history", BuiltinId::HISTORY, "List history, or search it with history -s text" },
+        { "parallel", BuiltinId::PARALLEL, "Run a command for each argument on parallel job slots" },
+        { "jobs", BuiltinId::JOBS, "List background jobs" },
+        { "wait", BuiltinId::WAIT, "Wait for background jobs to finish" },
+        { "joboutput", BuiltinId::JOBOUTPUT, "Show captured background job output (shopt joboutput on)" },
+        { "export", BuiltinId::EXPORT, "Export variables to the programs the shell starts" },
+        { "unset", BuiltinId::UNSET, "Remove shell variables" },
+        { "compgen", BuiltinId::COMPGEN, "List completions: compgen [-c] [-f] [-d] [prefix]" },
+        { "exit", BuiltinId::EXIT, "Exit the shell" },
+        { "quit", BuiltinId::EXIT, "" }
+    };
+
+    constexpr size_t BUILTIN_COUNT = sizeof(BUILTINS) / sizeof(BUILTINS[0]);
+
+    // Perfect hash: a seed is searched for at compile time under which every
+    // name lands in its own slot of a small power-of-two table
+    constexpr size_t TABLE_SIZE = 32;
+    static_assert(BUILTIN_COUNT < TABLE_SIZE, "builtin table is too small");
+
+    constexpr std::uint32_t hashName(std::string_view name, std::uint32_t seed) {
+        std::uint32_t h = 2166136261u ^ seed;
+        for (char c : name) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    constexpr bool isPerfect(std::uint32_t seed) {
+        bool used[TABLE_SIZE] = {};
+        for (const auto& builtin : BUILTINS) {
+            size_t slot = hashName(builtin.name, seed) & (TABLE_SIZE - 1);
+            if (used[slot]) {
+                return false;
+            }
+            used[slot] = true;
+        }
+        return true;
+    }
+
+    constexpr std::uint32_t findSeed() {
+        std::uint32_t seed = 0;
+        while (!isPerfect(seed)) {
+            ++seed;
+        }
+        return seed;
+    }
+
+    constexpr std::uint32_t SEED = findSeed();
+
+    // Slot -> index into BUILTINS plus one, or zero when empty
+    struct Table {
+        std::uint8_t slots[TABLE_SIZE];
+    };
+
+    constexpr Table buildTable() {
+        Table table{};
+        for (size_t i = 0; i < BUILTIN_COUNT; ++i) {
+            table.slots[hashName(BUILTINS[i].name, SEED) & (TABLE_SIZE - 1)] = static_cast<std::uint8_t>(i + 1);
+        }
+        return table;
+    }
+
+    constexpr Table TABLE = buildTable();
+
+    // Decode the escape sequence starting at text[i] (a backslash) into out
+    // and return the index of its last character. echo spells octal escapes
+    // \0NNN, printf \NNN. Sets stop on \c.
+    size_t decodeEscape(const std::string& text, size_t i, std::string& out, bool echoOctal, bool& stop) {
+        if (i + 1 >= text.size()) {
+            out += '\\';
+            return i;
+        }
+
+        char c = text[++i];
+        switch (c) {
+        case '\\': out += '\\'; return i;
+        case 'a': out += '\a'; return i;
+        case 'b': out += '\b'; return i;
+        case 'e': out += '\x1B'; return i;
+        case 'f': out += '\f'; return i;
+        case 'n': out += '\n'; return i;
+        case 'r': out += '\r'; return i;
+        case 't': out += '\t'; return i;
+        case 'v': out += '\v'; return i;
+        case 'c': stop = true; return i;
+        case 'x': {
+            int value = 0;
+            size_t digits = 0;
+            while (digits < 2 && i + 1 < text.size() && std::isxdigit(static_cast<unsigned char>(text[i + 1]))) {
+                char h = text[++i];
+                value = value * 16 + (std::isdigit(static_cast<unsigned char>(h)) ? h - '0' : (std::tolower(h) - 'a' + 10));
+                ++digits;
+            }
+            if (digits == 0) {
+                out += "\\x";
+            }
+            else {
+                out += static_cast<char>(value);
+            }
+            return i;
+        }
+        default:
+            break;
+        }
+
+        if (c >= '0' && c <= '7' && (c == '0' || !echoOctal)) {
+            int value = echoOctal ? 0 : c - '0';
+            size_t digits = echoOctal ? 0 : 1;
+            while (digits < 3 && i + 1 < text.size() && text[i + 1] >= '0' && text[i + 1] <= '7') {
+                value = value * 8 + (text[++i] - '0');
+                ++digits;
+            }
+            out += static_cast<char>(value & 0xFF);
+            return i;
+        }
+
+        out += '\\';
+        out += c;
+        return i;
+    }
+
+    // Append text with its escapes decoded; false if \c cut it short
+    bool appendEscaped(std::string& out, const std::string& text, bool echoOctal) {
+        bool stop = false;
+        for (size_t i = 0; i < text.size() && !stop; ++i) {
+            if (text[i] == '\\') {
+                i = decodeEscape(text, i, out, echoOctal, stop);
+            }
+            else {
+                out += text[i];
+            }
+        }
+        return !stop;
+    }
+
+    int echo(const std::vector<std::string>& args, std::string& out) {
+        bool newline = true;
+        bool escapes = false;
+
+        // Leading words made only of n, e and E letters are options
+        size_t first = 0;
+        for (; first < args.size(); ++first) {
+            const std::string& arg = args[first];
+            if (arg.size() < 2 || arg[0] != '-' || arg.find_first_not_of("neE", 1) != std::string::npos) {
+                break;
+            }
+            for (size_t i = 1; i < arg.size(); ++i) {
+                if (arg[i] == 'n') {
+                    newline = false;
+                }
+                else {
+                    escapes = arg[i] == 'e';
+                }
+            }
+        }
+
+        for (size_t i = first; i < args.size(); ++i) {
+            if (i > first) {
+                out += ' ';
+            }
+            if (!escapes) {
+                out += args[i];
+            }
+            else if (!appendEscaped(out, args[i], true)) {
+                return 0;
+            }
+        }
+
+        if (newline) {
+            out += '\n';
+        }
+        return 0;
+    }
+
+    template <typename T>
+    void appendFormatted(std::string& out, const std::string& spec, T value) {
+        int length = std::snprintf(nullptr, 0, spec.c_str(), value);
+        if (length <= 0) {
+            return;
+        }
+        size_t start = out.size();
+        out.resize(start + static_cast<size_t>(length) + 1);
+        std::snprintf(&out[start], static_cast<size_t>(length) + 1, spec.c_str(), value);
+        out.resize(start + static_cast<size_t>(length));
+    }
+
+    // Numeric printf argument; 'c or "c gives the character's code
+    bool parseNumber(const std::string& text, long long& value) {
+        if (text.empty()) {
+            value = 0;
+            return true;
+        }
+        if (text[0] == '\'' || text[0] == '"') {
+            value = text.size() > 1 ? static_cast<unsigned char>(text[1]) : 0;
+            return true;
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        value = std::strtoll(text.c_str(), &end, 0);
+        return end != text.c_str() && *end == '\0' && errno == 0;
+    }
+
+    int printfBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+        if (args.empty()) {
+            err += "printf: usage: printf format [arguments]\n";
+            return 2;
+        }
+
+        const std::string& format = args[0];
+        size_t next = 1;
+        int status = 0;
+
+        auto takeArg = [&]() -> std::string {
+            return next < args.size() ? args[next++] : std::string();
+        };
+
+        // The format is reused until every argument has been consumed
+        do {
+            size_t before = next;
+            bool stop = false;
+
+            for (size_t i = 0; i < format.size() && !stop; ++i) {
+                char c = format[i];
+                if (c == '\\') {
+                    i = decodeEscape(format, i, out, false, stop);
+                    continue;
+                }
+                if (c != '%') {
+                    out += c;
+                    continue;
+                }
+                if (i + 1 < format.size() && format[i + 1] == '%') {
+                    out += '%';
+                    ++i;
+                    continue;
+                }
+
+                // %[flags][width][.precision]conversion
+                std::string spec = "%";
+                ++i;
+                while (i < format.size() && std::strchr("-+ #0", format[i]) != nullptr) {
+                    spec += format[i++];
+                }
+                for (int part = 0; part < 2; ++part) {
+                    if (part == 1) {
+                        if (i >= format.size() || format[i] != '.') {
+                            break;
+                        }
+                        spec += format[i++];
+                    }
+                    if (i < format.size() && format[i] == '*') {
+                        long long value = 0;
+                        parseNumber(takeArg(), value);
+                        spec += std::to_string(value);
+                        ++i;
+                    }
+                    while (i < format.size() && std::isdigit(static_cast<unsigned char>(format[i]))) {
+                        spec += format[i++];
+                    }
+                }
+
+                if (i >= format.size()) {
+                    err += "printf: " + spec + ": missing format character\n";
+                    return 1;
+                }
+
+                char conversion = format[i];
+                switch (conversion) {
+                case 's':
+                    appendFormatted(out, spec + "s", takeArg().c_str());
+                    break;
+
+                case 'b': {
+                    std::string expanded;
+                    stop = !appendEscaped(expanded, takeArg(), true);
+                    appendFormatted(out, spec + "s", expanded.c_str());
+                    break;
+                }
+
+                case 'c': {
+                    std::string arg = takeArg();
+                    appendFormatted(out, spec + "c", arg.empty() ? 0 : static_cast<int>(arg[0]));
+                    break;
+                }
+
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X': {
+                    std::string arg = takeArg();
+                    long long value = 0;
+                    if (!parseNumber(arg, value)) {
+                        err += "printf: " + arg + ": invalid number\n";
+                        status = 1;
+                    }
+                    appendFormatted(out, spec + "ll" + conversion, value);
+                    break;
+                }
+
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'F':
+                case 'g':
+                case 'G': {
+                    std::string arg = takeArg();
+                    char* end = nullptr;
+                    double value = std::strtod(arg.c_str(), &end);
+                    if (!arg.empty() && (end == arg.c_str() || *end != '\0')) {
+                        err += "printf: " + arg + ": invalid number\n";
+                        status = 1;
+                    }
+                    appendFormatted(out, spec + conversion, value);
+                    break;
+                }
+
+                default:
+                    err += std::string("printf: %") + conversion + ": invalid format character\n";
+                    return 1;
+                }
+            }
+
+            if (stop || next == before) {
+                break;
+            }
+        } while (next < args.size());
+
+        return status;
+    }
+
+    int pwd(std::string& out, std::string& err) {
+        std::string buffer(PATH_MAX, '\0');
+        while (getcwd(&buffer[0], buffer.size()) == nullptr) {
+            if (errno != ERANGE) {
+                err += std::string("pwd: ") + std::strerror(errno) + "\n";
+                return 1;
+            }
+            buffer.resize(buffer.size() * 2);
+        }
+        out += buffer.c_str();
+        out += '\n';
+        return 0;
+    }
+
+    // Evaluator for test and [, by recursive descent:
+    //   expr    := and ( -o and )*
+    //   and     := not ( -a not )*
+    //   not     := ! not | primary
+    //   primary := ( expr ) | arg binop arg | unop arg | arg
+    class TestExpression {
+    public:
+        TestExpression(const std::vector<std::string>& args, size_t end, std::string& err)
+            : m_args(args), m_end(end), m_pos(0), m_err(err), m_failed(false) {}
+
+        // Exit status: 0 true, 1 false, 2 error
+        int evaluate() {
+            if (m_end == 0) {
+                return 1;
+            }
+            bool result = parseOr();
+            if (!m_failed && m_pos != m_end) {
+                fail(m_args[m_pos] + ": unexpected argument");
+            }
+            return m_failed ? 2 : (result ? 0 : 1);
+        }
+
+    private:
+        static bool isBinary(const std::string& op) {
+            return op == "=" || op == "==" || op == "!=" || op == "<" || op == ">" ||
+                op == "-eq" || op == "-ne" || op == "-lt" || op == "-le" ||
+                op == "-gt" || op == "-ge" || op == "-nt" || op == "-ot";
+        }
+
+        static bool isUnary(const std::string& op) {
+            return op.size() == 2 && op[0] == '-' && std::strchr("bcdefghLnprsStwxz", op[1]) != nullptr;
+        }
+
+        void fail(const std::string& message) {
+            if (!m_failed) {
+                m_err += "test: " + message + "\n";
+                m_failed = true;
+            }
+        }
+
+        size_t remaining() const { return m_end - m_pos; }
+
+        bool parseOr() {
+            bool result = parseAnd();
+            while (!m_failed && remaining() > 0 && m_args[m_pos] == "-o") {
+                ++m_pos;
+                bool right = parseAnd();
+                result = result || right;
+            }
+            return result;
+        }
+
+        bool parseAnd() {
+            bool result = parseNot();
+            while (!m_failed && remaining() > 0 && m_args[m_pos] == "-a") {
+                ++m_pos;
+                bool right = parseNot();
+                result = result && right;
+            }
+            return result;
+        }
+
+        bool parseNot() {
+            if (remaining() > 1 && m_args[m_pos] == "!") {
+                ++m_pos;
+                return !parseNot();
+            }
+            return parsePrimary();
+        }
+
+        bool parsePrimary() {
+            if (remaining() == 0) {
+                fail("argument expected");
+                return false;
+            }
+
+            const std::string& arg = m_args[m_pos];
+
+            // A binary operator is tried first so `test -f = -f` compares strings
+            if (remaining() >= 3 && isBinary(m_args[m_pos + 1])) {
+                m_pos += 3;
+                return binary(m_args[m_pos - 2], arg, m_args[m_pos - 1]);
+            }
+
+            if (remaining() > 1 && arg == "(") {
+                ++m_pos;
+                bool result = parseOr();
+                if (remaining() == 0 || m_args[m_pos] != ")") {
+                    fail("`)' expected");
+                    return false;
+                }
+                ++m_pos;
+                return result;
+            }
+
+            if (remaining() >= 2 && isUnary(arg)) {
+                m_pos += 2;
+                return unary(arg[1], m_args[m_pos - 1]);
+            }
+
+            ++m_pos;
+            return !arg.empty();
+        }
+
+        bool integer(const std::string& text, long long& value) {
+            char* end = nullptr;
+            errno = 0;
+            value = std::strtoll(text.c_str(), &end, 10);
+            while (end != nullptr && (*end == ' ' || *end == '\t')) {
+                ++end;
+            }
+            if (text.empty() || end == text.c_str() || *end != '\0' || errno != 0) {
+                fail(text + ": integer expression expected");
+                return false;
+            }
+            return true;
+        }
+
+        bool binary(const std::string& op, const std::string& left, const std::string& right) {
+            if (op == "=" || op == "==") {
+                return left == right;
+            }
+            if (op == "!=") {
+                return left != right;
+            }
+            if (op == "<") {
+                return left < right;
+            }
+            if (op == ">") {
+                return left > right;
+            }
+
+            if (op == "-nt" || op == "-ot") {
+                struct stat a;
+                struct stat b;
+                bool haveA = stat(left.c_str(), &a) == 0;
+                bool haveB = stat(right.c_str(), &b) == 0;
+                if (op == "-ot") {
+                    std::swap(a, b);
+                    std::swap(haveA, haveB);
+                }
+                if (!haveA) {
+                    return false;
+                }
+                if (!haveB) {
+                    return true;
+                }
+                return a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec > b.st_mtim.tv_sec
+                    : a.st_mtim.tv_nsec > b.st_mtim.tv_nsec;
+            }
+
+            long long a = 0;
+            long long b = 0;
+            if (!integer(left, a) || !integer(right, b)) {
+                return false;
+            }
+            if (op == "-eq") return a == b;
+            if (op == "-ne") return a != b;
+            if (op == "-lt") return a < b;
+            if (op == "-le") return a <= b;
+            if (op == "-gt") return a > b;
+            return a >= b;
+        }
+
+        bool unary(char op, const std::string& operand) {
+            switch (op) {
+            case 'z':
+                return operand.empty();
+            case 'n':
+                return !operand.empty();
+            case 't': {
+                long long fd = 0;
+                return integer(operand, fd) && isatty(static_cast<int>(fd)) == 1;
+            }
+            case 'r':
+                return access(operand.c_str(), R_OK) == 0;
+            case 'w':
+                return access(operand.c_str(), W_OK) == 0;
+            case 'x':
+                return access(operand.c_str(), X_OK) == 0;
+            default:
+                break;
+            }
+
+            struct stat st;
+            if (op == 'h' || op == 'L') {
+                return lstat(operand.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+            }
+            if (stat(operand.c_str(), &st) != 0) {
+                return false;
+            }
+
+            switch (op) {
+            case 'e': return true;
+            case 'f': return S_ISREG(st.st_mode);
+            case 'd': return S_ISDIR(st.st_mode);
+            case 'b': return S_ISBLK(st.st_mode);
+            case 'c': return S_ISCHR(st.st_mode);
+            case 'p': return S_ISFIFO(st.st_mode);
+            case 'S': return S_ISSOCK(st.st_mode);
+            case 's': return st.st_size > 0;
+            case 'g': return (st.st_mode & S_ISGID) != 0;
+            default: return false;
+            }
+        }
+
+        const std::vector<std::string>& m_args;
+        size_t m_end;
+        size_t m_pos;
+        std::string& m_err;
+        bool m_failed;
+    };
+
+    int help(std::string& out) {
+        out += "Available commands:\n";
+        for (const auto& builtin : BUILTINS) {
+            if (!builtin.summary.empty()) {
+                out += "  ";
+                out += builtin.name;
+                out += " - ";
+                out += builtin.summary;
+                out += "\n";
+            }
+        }
+        return 0;
+    }
+}
+
+namespace builtins {
+
+    BuiltinId find(std::string_view name) {
+        std::uint8_t slot = TABLE.slots[hashName(name, SEED) & (TABLE_SIZE - 1)];
+        if (slot == 0 || BUILTINS[slot - 1].name != name) {
+            return BuiltinId::NONE;
+        }
+        return BUILTINS[slot - 1].id;
+    }
+
+    void names(std::vector<std::string_view>& out) {
+        for (const auto& builtin : BUILTINS) {
+            out.push_back(builtin.name);
+        }
+    }
+
+    int run(BuiltinId id, const std::vector<std::string>& args, std::string& out, std::string& err) {
+        switch (id) {
+        case BuiltinId::ECHO:
+            return echo(args, out);
+
+        case BuiltinId::PRINTF:
+            return printfBuiltin(args, out, err);
+
+        case BuiltinId::PWD:
+            return pwd(out, err);
+
+        case BuiltinId::TRUE:
+        case BuiltinId::COLON:
+            return 0;
+
+        case BuiltinId::FALSE:
+            return 1;
+
+        case BuiltinId::TEST:
+            return TestExpression(args, args.size(), err).evaluate();
+
+        case BuiltinId::BRACKET:
+            if (args.empty() || args.back() != "]") {
+                err += "[: missing `]'\n";
+                return 2;
+            }
+            return TestExpression(args, args.size() - 1, err).evaluate();
+
+        case BuiltinId::HELP:
+            return help(out);
+
+        default:
+            return 1;
+        }
+    }
+}
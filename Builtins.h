@@ -0,0 +1,57 @@
+// Builtins.h - Commands the shell runs in-process
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Every builtin the shell knows about
+enum class BuiltinId : std::uint8_t {
+    NONE,
+    ECHO,
+    PRINTF,
+    PWD,
+    TRUE,
+    FALSE,
+    COLON,
+    TEST,
+    BRACKET,
+    HELP,
+    EXIT,
+    HASH,
+    SHOPT,
+    SHELLSTATS,
+    HISTORY,
+    PARALLEL,
+    JOBS,
+    WAIT,
+    JOBOUTPUT,
+    EXPORT,
+    UNSET,
+    COMPGEN
+};
+
+// Registry of builtins.
+//
+// Names are looked up through a perfect hash computed at compile time, so
+// recognising a builtin costs one hash and one string compare. Builtins
+// write into out/err buffers rather than to descriptors, which lets the
+// executor run them on the shell's own thread or as in-process pipeline
+// stages alike.
+namespace builtins {
+
+    // Builtin with the given name, or NONE
+    BuiltinId find(std::string_view name);
+
+    // Append the name of every builtin, aliases included
+    void names(std::vector<std::string_view>& out);
+
+    // Run a builtin that needs no shell state (echo, printf, pwd, true,
+    // false, :, test, [ and help). The executor handles the rest.
+    int run(BuiltinId id, const std::vector<std::string>& args, std::string& out, std::string& err);
+}
+
+#endif // BUILTINS_H
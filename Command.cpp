@@ -1,7 +1,60 @@
 // Command.cpp - Command implementation
 
 #include "Command.h"
+#include "LexScan.h"
+#include "ShellStats.h"
+#include <cctype>
 #include <sstream>
+#include <string_view>
+
+namespace {
+    // Writes text as one word the lexer reads back unchanged: as-is when
+    // nothing in it is special, otherwise single-quoted, with each ' closing
+    // the quotes, escaped, and reopening them
+    void appendShellWord(std::ostringstream& oss, std::string_view text) {
+        bool plain = !text.empty();
+        for (char c : text) {
+            if (!std::isalnum(static_cast<unsigned char>(c)) &&
+                std::string_view("_-+=.,:/@%^").find(c) == std::string_view::npos) {
+                plain = false;
+                break;
+            }
+        }
+        if (plain) {
+            oss << text;
+            return;
+        }
+
+        oss << '\'';
+        for (char c : text) {
+            if (c == '\'') {
+                oss << "'\\''";
+            }
+            else {
+                oss << c;
+            }
+        }
+        oss << '\'';
+    }
+
+    // Writes a pathname pattern so that the lexer reads back the same
+    // pattern: its escapes are kept and every other character the lexer
+    // would act on is escaped too, which the matcher takes literally
+    void appendShellPattern(std::ostringstream& oss, std::string_view pattern) {
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            char c = pattern[i];
+            if (c == '\\' && i + 1 < pattern.size()) {
+                oss << c << pattern[++i];
+                continue;
+            }
+            if (lexscan::hasClass(c, lexscan::CLASS_SPACE | lexscan::CLASS_OPERATOR |
+                    lexscan::CLASS_ESCAPE | lexscan::CLASS_QUOTE) || c == '$' || c == '#') {
+                oss << '\\';
+            }
+            oss << c;
+        }
+    }
+}
 
 std::vector<const char*> SimpleCommand::getArgv() const {
     std::vector<const char*> argv;
@@ -22,25 +75,155 @@ std::vector<const char*> SimpleCommand::getArgv() const {
 
 std::string SimpleCommand::toString() const {
     std::ostringstream oss;
-    oss << m_name;
 
-    for (const auto& arg : m_arguments) {
-        oss << " " << arg;
+    // Every word is shown so that it reads back as the same word. One with
+    // a substitution is kept as written, quotes and all; a pattern keeps
+    // its escapes; any other is quoted where it has to be.
+    auto word = [&oss](std::string_view text, std::uint8_t flags) {
+        if (flags & WORD_SUBSTITUTION) {
+            oss << text;
+        }
+        else if (flags & WORD_GLOB) {
+            appendShellPattern(oss, text);
+        }
+        else {
+            appendShellWord(oss, text);
+        }
+    };
+
+    const char* separator = "";
+    for (size_t i = 0; i < m_assignments.size(); ++i) {
+        // The name stays unquoted so that it is still an assignment
+        std::string_view assignment = m_assignments[i];
+        size_t equals = assignment.find('=') + 1;
+        oss << separator << assignment.substr(0, equals);
+        if (equals < assignment.size() || getAssignmentFlags(i) != 0) {
+            word(assignment.substr(equals), getAssignmentFlags(i));
+        }
+        separator = " ";
+    }
+    if (!m_name.empty()) {
+        oss << separator;
+        word(m_name, m_nameFlags);
+    }
+
+    for (size_t i = 0; i < m_arguments.size(); ++i) {
+        oss << " ";
+        word(m_arguments[i], getArgumentFlags(i));
     }
 
     for (const auto& redir : m_redirections) {
         switch (redir.type) {
         case RedirectType::INPUT:
-            oss << " < " << redir.target;
+            oss << " < ";
+            appendShellWord(oss, redir.target);
             break;
         case RedirectType::OUTPUT:
-            oss << " > " << redir.target;
+            oss << " > ";
+            appendShellWord(oss, redir.target);
             break;
         case RedirectType::APPEND:
-            oss << " >> " << redir.target;
+            oss << " >> ";
+            appendShellWord(oss, redir.target);
+            break;
+        case RedirectType::HEREDOC: {
+            // Shown as the here-string that feeds the same text
+            std::string_view body = redir.target;
+            if (!body.empty() && body.back() == '\n') {
+                body.remove_suffix(1);
+            }
+            oss << " <<< ";
+            appendShellWord(oss, body);
+            break;
+        }
+        case RedirectType::HERESTRING:
+            oss << " <<< ";
+            appendShellWord(oss, redir.target);
             break;
         }
     }
 
     return oss.str();
-}
\ No newline at end of file
+}
+
+CommandType Command::getType() const {
+    return m_arena->m_nodes[m_index].type;
+}
+
+bool Command::isBackground() const {
+    return m_arena->m_nodes[m_index].background;
+}
+
+const SimpleCommand& Command::getCommand() const {
+    return m_arena->m_simpleCommands[m_arena->m_nodes[m_index].first];
+}
+
+size_t Command::getChildCount() const {
+    return m_arena->m_nodes[m_index].count;
+}
+
+Command Command::getChild(size_t i) const {
+    return Command(m_arena, m_arena->m_children[m_arena->m_nodes[m_index].first + i]);
+}
+
+std::string Command::toString() const {
+    std::string out;
+    appendTo(out);
+    return out;
+}
+
+void Command::appendTo(std::string& out) const {
+    const char* separator = "";
+
+    switch (getType()) {
+    case CommandType::SIMPLE:
+        out += getCommand().toString();
+        return;
+    case CommandType::PIPELINE:
+        separator = " | ";
+        break;
+    case CommandType::SEQUENCE:
+        separator = "; ";
+        break;
+    case CommandType::LOGICAL_AND:
+        separator = " && ";
+        break;
+    case CommandType::LOGICAL_OR:
+        separator = " || ";
+        break;
+    }
+
+    // Children are never of their parent's type, so recursion only goes as
+    // deep as the grammar nests node types, whatever the number of children
+    size_t count = getChildCount();
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            out += separator;
+        }
+        getChild(i).appendTo(out);
+    }
+}
+
+NodeIndex CommandArena::addSimple(SimpleCommand command) {
+    stats::Scope scope(stats::Subsystem::AST);
+
+    // Reuse a slot left over from an earlier parse when there is one
+    if (m_simpleCount < m_simpleCommands.size()) {
+        m_simpleCommands[m_simpleCount] = std::move(command);
+    }
+    else {
+        m_simpleCommands.push_back(std::move(command));
+    }
+
+    m_nodes.push_back(Node{ CommandType::SIMPLE, false,
+        static_cast<NodeIndex>(m_simpleCount++), 0 });
+    return static_cast<NodeIndex>(m_nodes.size() - 1);
+}
+
+NodeIndex CommandArena::addList(CommandType type, const NodeIndex* children, size_t count) {
+    stats::Scope scope(stats::Subsystem::AST);
+    auto first = static_cast<NodeIndex>(m_children.size());
+    m_children.insert(m_children.end(), children, children + count);
+    m_nodes.push_back(Node{ type, false, first, static_cast<NodeIndex>(count) });
+    return static_cast<NodeIndex>(m_nodes.size() - 1);
+}
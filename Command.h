@@ -4,19 +4,19 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
+#include "Token.h"
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
-#include <memory>
-#include <unordered_map>
-
-// Forward declarations
-class Command;
 
 // Redirection type
 enum class RedirectType {
     INPUT,          // <
     OUTPUT,         // >
-    APPEND          // >>
+    APPEND,         // >>
+    HEREDOC,        // << and <<-, the target being the body
+    HERESTRING      // <<<, the target being the word, fed with a newline
 };
 
 // Redirection structure
@@ -31,12 +31,16 @@ struct Redirection {
 // Simple command (a single command with its arguments)
 class SimpleCommand {
 public:
-    SimpleCommand(const std::string& name = "")
-        : m_name(name) {}
-
-    // Add an argument to the command
-    void addArgument(const std::string& arg) {
-        m_arguments.push_back(arg);
+    SimpleCommand(const std::string& name = "", std::uint8_t nameFlags = 0)
+        : m_name(name), m_nameFlags(nameFlags) {}
+
+    // Add an argument to the command with its WordFlag bits
+    void addArgument(std::string arg, std::uint8_t flags = 0) {
+        m_arguments.push_back(std::move(arg));
+        if (flags != 0) {
+            m_argumentFlags.resize(m_arguments.size(), 0);
+            m_argumentFlags.back() = flags;
+        }
     }
 
     // Add a redirection
@@ -44,10 +48,38 @@ public:
         m_redirections.emplace_back(type, target);
     }
 
+    // Add a NAME=value assignment that precedes the command, with the
+    // WordFlag bits of its word
+    void addAssignment(const std::string& assignment, std::uint8_t flags = 0) {
+        m_assignments.push_back(assignment);
+        if (flags != 0) {
+            m_assignmentFlags.resize(m_assignments.size(), 0);
+            m_assignmentFlags.back() = flags;
+        }
+    }
+
     // Getters
     const std::string& getName() const { return m_name; }
     const std::vector<std::string>& getArguments() const { return m_arguments; }
     const std::vector<Redirection>& getRedirections() const { return m_redirections; }
+    const std::vector<std::string>& getAssignments() const { return m_assignments; }
+
+    // WordFlag bits of the name, an argument or an assignment. Flags are
+    // only stored once some word has any, so plain commands carry no extra
+    // vectors.
+    std::uint8_t getNameFlags() const { return m_nameFlags; }
+    std::uint8_t getArgumentFlags(size_t i) const {
+        return i < m_argumentFlags.size() ? m_argumentFlags[i] : 0;
+    }
+    std::uint8_t getAssignmentFlags(size_t i) const {
+        return i < m_assignmentFlags.size() ? m_assignmentFlags[i] : 0;
+    }
+    bool hasWordFlags() const {
+        return m_nameFlags != 0 || !m_argumentFlags.empty() || !m_assignmentFlags.empty();
+    }
+
+    // Whether this only assigns variables (FOO=1 with no command name)
+    bool isAssignmentOnly() const { return m_name.empty() && !m_assignments.empty(); }
 
     // Generate argv array for exec functions
     std::vector<const char*> getArgv() const;
@@ -57,12 +89,16 @@ public:
 
 private:
     std::string m_name;
+    std::uint8_t m_nameFlags;
     std::vector<std::string> m_arguments;
+    std::vector<std::uint8_t> m_argumentFlags;
     std::vector<Redirection> m_redirections;
+    std::vector<std::string> m_assignments;
+    std::vector<std::uint8_t> m_assignmentFlags;
 };
 
 // Command type enum
-enum class CommandType {
+enum class CommandType : std::uint8_t {
     SIMPLE,         // A single command
     PIPELINE,       // Commands connected by pipes
     SEQUENCE,       // Commands separated by ;
@@ -70,109 +106,107 @@ enum class CommandType {
     LOGICAL_OR      // Commands separated by ||
 };
 
-// Base Command class
+// Position of a node inside its CommandArena
+using NodeIndex = std::uint32_t;
+const NodeIndex INVALID_NODE = 0xFFFFFFFFu;
+
+class CommandArena;
+
+// Handle to a node of a parsed command tree.
+//
+// Nodes live in a CommandArena and refer to their children by index, so a
+// handle is just the arena and an index; it is cheap to copy and is only
+// valid until the arena is cleared.
 class Command {
 public:
-    virtual ~Command() = default;
+    Command() : m_arena(nullptr), m_index(INVALID_NODE) {}
+    Command(const CommandArena* arena, NodeIndex index)
+        : m_arena(arena), m_index(index) {}
 
-    // Get the type of this command
-    virtual CommandType getType() const = 0;
+    bool isValid() const { return m_arena != nullptr && m_index != INVALID_NODE; }
+    NodeIndex getIndex() const { return m_index; }
 
-    // Convert to string for debugging
-    virtual std::string toString() const = 0;
+    // Get the type of this command
+    CommandType getType() const;
 
     // Background execution flag
-    bool isBackground() const { return m_background; }
-    void setBackground(bool background) { m_background = background; }
-
-private:
-    bool m_background = false;
-};
-
-// Concrete command types
-class SimpleCommandNode : public Command {
-public:
-    explicit SimpleCommandNode(SimpleCommand cmd)
-        : m_command(std::move(cmd)) {}
+    bool isBackground() const;
 
-    CommandType getType() const override { return CommandType::SIMPLE; }
-    const SimpleCommand& getCommand() const { return m_command; }
-    std::string toString() const override { return m_command.toString(); }
+    // SIMPLE nodes: the command itself
+    const SimpleCommand& getCommand() const;
 
-private:
-    SimpleCommand m_command;
-};
-
-class PipelineNode : public Command {
-public:
-    PipelineNode(std::shared_ptr<Command> left, std::shared_ptr<Command> right)
-        : m_left(std::move(left)), m_right(std::move(right)) {}
-
-    CommandType getType() const override { return CommandType::PIPELINE; }
-    const std::shared_ptr<Command>& getLeft() const { return m_left; }
-    const std::shared_ptr<Command>& getRight() const { return m_right; }
+    // PIPELINE, SEQUENCE, LOGICAL_AND and LOGICAL_OR nodes: the operands,
+    // in order (two or more)
+    size_t getChildCount() const;
+    Command getChild(size_t i) const;
 
-    std::string toString() const override {
-        return m_left->toString() + " | " + m_right->toString();
-    }
+    // Convert to string for debugging
+    std::string toString() const;
 
 private:
-    std::shared_ptr<Command> m_left;
-    std::shared_ptr<Command> m_right;
-};
+    // Append the textual form of this node to out
+    void appendTo(std::string& out) const;
 
-class SequenceNode : public Command {
-public:
-    SequenceNode(std::shared_ptr<Command> left, std::shared_ptr<Command> right)
-        : m_left(std::move(left)), m_right(std::move(right)) {}
-
-    CommandType getType() const override { return CommandType::SEQUENCE; }
-    const std::shared_ptr<Command>& getLeft() const { return m_left; }
-    const std::shared_ptr<Command>& getRight() const { return m_right; }
-
-    std::string toString() const override {
-        return m_left->toString() + "; " + m_right->toString();
-    }
-
-private:
-    std::shared_ptr<Command> m_left;
-    std::shared_ptr<Command> m_right;
+    const CommandArena* m_arena;
+    NodeIndex m_index;
 };
 
-class LogicalAndNode : public Command {
+// Owns every node of a parsed command tree.
+//
+// Nodes are stored contiguously and children are addressed by 32-bit
+// indices rather than by shared_ptr, so building a tree costs no per-node
+// allocation or reference counting. Pipelines, sequences and && / || chains
+// are n-ary: one node whose children sit side by side in a shared child
+// array, so a 10,000-stage pipeline is one node with 10,000 children rather
+// than a 10,000-deep tree. clear() releases the whole tree in O(1): node
+// storage keeps its capacity and SimpleCommand slots are recycled by the
+// next parse.
+class CommandArena {
 public:
-    LogicalAndNode(std::shared_ptr<Command> left, std::shared_ptr<Command> right)
-        : m_left(std::move(left)), m_right(std::move(right)) {}
+    CommandArena() : m_simpleCount(0) {}
 
-    CommandType getType() const override { return CommandType::LOGICAL_AND; }
-    const std::shared_ptr<Command>& getLeft() const { return m_left; }
-    const std::shared_ptr<Command>& getRight() const { return m_right; }
+    // Add nodes; the returned index is valid until clear()
+    NodeIndex addSimple(SimpleCommand command);
+    NodeIndex addList(CommandType type, const NodeIndex* children, size_t count);
 
-    std::string toString() const override {
-        return m_left->toString() + " && " + m_right->toString();
+    // Set the background flag of a node
+    void setBackground(NodeIndex index, bool background) {
+        m_nodes[index].background = background;
     }
 
-private:
-    std::shared_ptr<Command> m_left;
-    std::shared_ptr<Command> m_right;
-};
+    // Get a handle to a node
+    Command get(NodeIndex index) const { return Command(this, index); }
 
-class LogicalOrNode : public Command {
-public:
-    LogicalOrNode(std::shared_ptr<Command> left, std::shared_ptr<Command> right)
-        : m_left(std::move(left)), m_right(std::move(right)) {}
+    // Number of nodes in the arena
+    size_t size() const { return m_nodes.size(); }
 
-    CommandType getType() const override { return CommandType::LOGICAL_OR; }
-    const std::shared_ptr<Command>& getLeft() const { return m_left; }
-    const std::shared_ptr<Command>& getRight() const { return m_right; }
+    // Scratch stack a parser collects list operands on; it lives here so
+    // its capacity carries over from one parse to the next
+    std::vector<NodeIndex>& operandStack() { return m_operands; }
 
-    std::string toString() const override {
-        return m_left->toString() + " || " + m_right->toString();
+    // Drop every node at once
+    void clear() {
+        m_nodes.clear();
+        m_children.clear();
+        m_operands.clear();
+        m_simpleCount = 0;
     }
 
 private:
-    std::shared_ptr<Command> m_left;
-    std::shared_ptr<Command> m_right;
+    friend class Command;
+
+    struct Node {
+        CommandType type;
+        bool background;
+        NodeIndex first;    // SIMPLE: index into m_simpleCommands, else into m_children
+        NodeIndex count;    // Number of children
+    };
+
+    std::vector<Node> m_nodes;
+    std::vector<NodeIndex> m_children;
+    std::vector<NodeIndex> m_operands;
+    std::vector<SimpleCommand> m_simpleCommands;
+    size_t m_simpleCount;
 };
 
-#endif // COMMAND_H
\ No newline at end of file
+#endif // COMMAND_H
@@ -0,0 +1,323 @@
+// CommandHash.cpp - Cache of resolved command paths implementation
+
+#include "CommandHash.h"
+#include "ShellConfig.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+CommandHash::CommandHash()
+    : m_pathUnset(false), m_pathLoaded(false), m_watching(false), m_notifying(false), m_generation(0),
+      m_mtimeChecks(0), m_inotifyFd(-1) {}
+
+CommandHash::~CommandHash() {
+    removeWatches();
+}
+
+const std::string* CommandHash::lookup(const std::string& name) {
+    Entry* entry = resolve(name);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    ++entry->hits;
+    return &entry->path;
+}
+
+void CommandHash::revalidate(bool interactive) {
+    if (!m_pathLoaded) {
+        return;
+    }
+
+    // getenv is a plain memory lookup, so PATH changes cost nothing to detect
+    const char* pathValue = std::getenv("PATH");
+    if ((pathValue == nullptr) != m_pathUnset ||
+        (pathValue != nullptr && m_pathValue != pathValue)) {
+        loadPath(pathValue);
+        return;
+    }
+
+    // Watches go in only when a second command line comes along, which
+    // one-shot `-c` shells never see. Nothing watched the directories
+    // before that, so what the first line resolved is forgotten.
+    if (!m_watching) {
+        m_entries.clear();
+        ++m_generation;
+        installWatches(interactive);
+        return;
+    }
+
+    // A prompt after a pasted block, which runs as a script, moves the
+    // mtime watch over to inotify, and so does a script once its mtime
+    // checks have cost more than an inotify instance would
+    if (!m_notifying && (interactive || ++m_mtimeChecks >= config::HASH_MTIME_CHECKS)) {
+        if (directoriesChanged()) {
+            clear();
+            ++m_generation;
+        }
+        installWatches(true);
+        return;
+    }
+
+    if (!drainEvents() && directoriesChanged()) {
+        clear();
+        ++m_generation;
+    }
+}
+
+const std::vector<std::string>& CommandHash::directories() {
+    if (!m_pathLoaded) {
+        loadPath(std::getenv("PATH"));
+    }
+    return m_dirs;
+}
+
+void CommandHash::remove(const std::string& name) {
+    m_entries.erase(name);
+}
+
+void CommandHash::clear() {
+    m_entries.clear();
+}
+
+int CommandHash::builtin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    // hash: list remembered commands
+    if (args.empty()) {
+        if (m_entries.empty()) {
+            out += "hash: hash table empty\n";
+            return 0;
+        }
+
+        std::vector<const std::pair<const std::string, Entry>*> sorted;
+        for (const auto& entry : m_entries) {
+            sorted.push_back(&entry);
+        }
+        std::sort(sorted.begin(), sorted.end(),
+            [](const auto* a, const auto* b) { return a->first < b->first; });
+
+        out += "hits\tcommand\n";
+        for (const auto* entry : sorted) {
+            out += std::to_string(entry->second.hits) + "\t" + entry->second.path + "\n";
+        }
+        return 0;
+    }
+
+    // hash -r: forget everything
+    if (args[0] == "-r") {
+        clear();
+        return 0;
+    }
+
+    int status = 0;
+
+    // hash -d name...: forget the named commands
+    if (args[0] == "-d") {
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (m_entries.erase(args[i]) == 0) {
+                err += "hash: " + args[i] + ": not found\n";
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+    // hash -t name...: print the remembered paths
+    if (args[0] == "-t") {
+        for (size_t i = 1; i < args.size(); ++i) {
+            auto it = m_entries.find(args[i]);
+            if (it == m_entries.end()) {
+                err += "hash: " + args[i] + ": not found\n";
+                status = 1;
+            }
+            else {
+                out += (args.size() > 2 ? args[i] + "\t" : std::string()) + it->second.path + "\n";
+            }
+        }
+        return status;
+    }
+
+    // hash name...: resolve and remember without counting a hit
+    for (const auto& name : args) {
+        if (resolve(name) == nullptr) {
+            err += "hash: " + name + ": not found\n";
+            status = 1;
+        }
+    }
+    return status;
+}
+
+CommandHash::Entry* CommandHash::resolve(const std::string& name) {
+    if (!m_pathLoaded) {
+        loadPath(std::getenv("PATH"));
+    }
+
+    auto it = m_entries.find(name);
+    if (it == m_entries.end()) {
+        std::string path;
+        if (name.find('/') != std::string::npos) {
+            path = name;
+        }
+        else if (!search(m_dirs, name, path)) {
+            return nullptr;
+        }
+        it = m_entries.emplace(name, Entry{ path, 0 }).first;
+    }
+    return &it->second;
+}
+
+bool CommandHash::searchPath(const char* pathValue, const std::string& name, std::string& path) {
+    if (name.find('/') != std::string::npos) {
+        path = name;
+        return true;
+    }
+    return search(splitPath(pathValue), name, path);
+}
+
+bool CommandHash::search(const std::vector<std::string>& dirs, const std::string& name, std::string& path) {
+    for (const auto& dir : dirs) {
+        std::string candidate = dir.empty() ? name : dir + "/" + name;
+
+        struct stat st;
+        if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            access(candidate.c_str(), X_OK) == 0) {
+            path = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandHash::loadPath(const char* pathValue) {
+    m_entries.clear();
+    m_pathValue = pathValue ? pathValue : std::string();
+    m_pathUnset = (pathValue == nullptr);
+    m_pathLoaded = true;
+    ++m_generation;
+    m_dirs = splitPath(pathValue);
+    removeWatches();
+}
+
+std::vector<std::string> CommandHash::splitPath(const char* pathValue) {
+    if (pathValue == nullptr) {
+        return config::DEFAULT_PATH;
+    }
+
+    // An empty PATH element means the current directory
+    std::vector<std::string> dirs;
+    std::string_view value = pathValue;
+    size_t start = 0;
+    while (true) {
+        size_t end = value.find(':', start);
+        std::string_view dir = value.substr(start, end - start);
+        dirs.push_back(dir == "." ? std::string() : std::string(dir));
+        if (end == std::string_view::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return dirs;
+}
+
+void CommandHash::installWatches(bool notify) {
+    removeWatches();
+    m_watching = true;
+    m_notifying = notify;
+
+#ifdef __linux__
+    m_inotifyFd = notify ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+    if (m_inotifyFd >= 0) {
+        const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        for (const auto& dir : m_dirs) {
+            inotify_add_watch(m_inotifyFd, dir.empty() ? "." : dir.c_str(), mask);
+        }
+        return;
+    }
+#endif
+
+    // No inotify, or not worth one: remember directory mtimes instead
+    for (const auto& dir : m_dirs) {
+        struct stat st;
+        struct timespec mtime = {};
+        if (stat(dir.empty() ? "." : dir.c_str(), &st) == 0) {
+            mtime = st.st_mtim;
+        }
+        m_mtimes.push_back(mtime);
+    }
+}
+
+void CommandHash::removeWatches() {
+    m_watching = false;
+    if (m_inotifyFd >= 0) {
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+    }
+    m_mtimes.clear();
+}
+
+bool CommandHash::drainEvents() {
+#ifdef __linux__
+    if (m_inotifyFd < 0) {
+        return false;
+    }
+
+    alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+    bool rewatch = false;
+
+    while (true) {
+        ssize_t len = read(m_inotifyFd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            break;
+        }
+        changed = true;
+
+        for (char* p = buffer; p < buffer + len;) {
+            auto* event = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_Q_OVERFLOW | IN_IGNORED)) {
+                rewatch = true;
+            }
+            else if (event->len > 0) {
+                // Only entries for the changed name can have gone stale
+                m_entries.erase(event->name);
+            }
+        }
+    }
+
+    if (rewatch) {
+        m_entries.clear();
+        installWatches(true);
+    }
+    if (changed) {
+        ++m_generation;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool CommandHash::directoriesChanged() {
+    bool changed = false;
+    for (size_t i = 0; i < m_dirs.size() && i < m_mtimes.size(); ++i) {
+        struct stat st;
+        struct timespec mtime = {};
+        if (stat(m_dirs[i].empty() ? "." : m_dirs[i].c_str(), &st) == 0) {
+            mtime = st.st_mtim;
+        }
+        if (mtime.tv_sec != m_mtimes[i].tv_sec || mtime.tv_nsec != m_mtimes[i].tv_nsec) {
+            m_mtimes[i] = mtime;
+            changed = true;
+        }
+    }
+    return changed;
+}
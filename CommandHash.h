@@ -0,0 +1,97 @@
+// CommandHash.h - Cache of resolved command paths
+
+#ifndef COMMAND_HASH_H
+#define COMMAND_HASH_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+
+// Remembers where each command was found on PATH, like bash's hash table.
+//
+// Lookups are answered from memory. Staleness is handled by revalidate(),
+// which runs once per command line: it compares PATH against the value the
+// table was built from and drains an inotify watch on the PATH directories.
+// Only names that actually changed are evicted. Where inotify is
+// unavailable, directory mtimes are compared instead. Watching starts on the
+// second command line, and interactive shells get inotify straight away.
+// Setting up and closing an inotify instance costs a short script more than
+// it saves, so scripts and `-c` strings compare mtimes for their first
+// config::HASH_MTIME_CHECKS command lines and move to inotify after that.
+class CommandHash {
+public:
+    CommandHash();
+    ~CommandHash();
+
+    CommandHash(const CommandHash&) = delete;
+    CommandHash& operator=(const CommandHash&) = delete;
+
+    // Resolve a command name to an executable path. Names containing a
+    // slash are returned unchanged. Returns nullptr if nothing matches.
+    const std::string* lookup(const std::string& name);
+
+    // Resolve a name against a PATH other than the process's, as a command
+    // given PATH=... or run where PATH was changed in an overlay sees it.
+    // Nothing is remembered. A null pathValue means PATH is unset.
+    static bool searchPath(const char* pathValue, const std::string& name, std::string& path);
+
+    // Evict stale entries; call once before executing each command line,
+    // saying whether it was typed at an interactive prompt
+    void revalidate(bool interactive);
+
+    // Forget one command, or all of them
+    void remove(const std::string& name);
+    void clear();
+
+    // Implementation of the `hash` builtin
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+    // Bumped whenever PATH or the contents of a PATH directory change
+    unsigned long generation() const { return m_generation; }
+
+    // PATH directories in search order, reading PATH if no lookup has yet
+    const std::vector<std::string>& directories();
+
+private:
+    struct Entry {
+        std::string path;
+        unsigned long hits = 0;
+    };
+
+    // Find or create the entry for a name without counting a hit
+    Entry* resolve(const std::string& name);
+
+    // Search PATH directories for an executable
+    static bool search(const std::vector<std::string>& dirs, const std::string& name, std::string& path);
+
+    // Directories of a PATH value, the default ones when it is unset
+    static std::vector<std::string> splitPath(const char* pathValue);
+
+    // Split PATH into directories and (re)install the change watches,
+    // with inotify or by remembering directory mtimes
+    void loadPath(const char* pathValue);
+    void installWatches(bool notify);
+    void removeWatches();
+
+    // Handle pending inotify events; returns false if watching is unavailable
+    bool drainEvents();
+
+    // mtime based fallback when inotify is not available
+    bool directoriesChanged();
+
+    std::unordered_map<std::string, Entry> m_entries;
+    std::vector<std::string> m_dirs;
+    std::string m_pathValue;
+    bool m_pathUnset;
+    bool m_pathLoaded;
+    bool m_watching;
+    bool m_notifying; // Watching was set up with inotify requested
+    unsigned long m_generation;
+    size_t m_mtimeChecks; // Lines a script has compared mtimes for
+
+    int m_inotifyFd;
+    std::vector<struct timespec> m_mtimes;
+};
+
+#endif // COMMAND_HASH_H
@@ -0,0 +1,316 @@
+// Completion.cpp - Command and filename completion implementation
+
+#include "Completion.h"
+#include "Builtins.h"
+#include "ShellConfig.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void FrontCodedNames::assign(const std::vector<std::pair<std::string_view, std::uint8_t>>& names) {
+    m_data.clear();
+    m_blocks.clear();
+    m_size = 0;
+
+    std::string_view previous;
+    for (const auto& item : names) {
+        std::string_view name = item.first.substr(0, 255);
+        size_t shared = 0;
+        if (m_size % BLOCK_SIZE == 0) {
+            m_blocks.push_back(static_cast<std::uint32_t>(m_data.size()));
+        }
+        else {
+            size_t limit = std::min(previous.size(), name.size());
+            while (shared < limit && previous[shared] == name[shared]) {
+                ++shared;
+            }
+        }
+
+        m_data.push_back(static_cast<char>(item.second));
+        m_data.push_back(static_cast<char>(shared));
+        m_data.push_back(static_cast<char>(name.size() - shared));
+        m_data.insert(m_data.end(), name.begin() + static_cast<std::ptrdiff_t>(shared), name.end());
+        previous = name;
+        ++m_size;
+    }
+    m_data.shrink_to_fit();
+    m_blocks.shrink_to_fit();
+}
+
+std::string_view FrontCodedNames::head(size_t block) const {
+    size_t pos = m_blocks[block];
+    return std::string_view(m_data.data() + pos + 3, static_cast<unsigned char>(m_data[pos + 2]));
+}
+
+CompletionIndex::CompletionIndex() : m_generation(0), m_loaded(false) {}
+
+void CompletionIndex::refresh(const std::vector<std::string>& directories, unsigned long generation) {
+    bool changed = false;
+
+    // A new generation may be a new PATH: keep what was read of the
+    // directories still on it
+    if (!m_loaded || generation != m_generation) {
+        std::vector<SearchDirectory> previous = std::move(m_directories);
+        m_directories.clear();
+        for (const auto& path : directories) {
+            auto found = std::find_if(previous.begin(), previous.end(),
+                [&path](const SearchDirectory& directory) { return directory.path == path; });
+            if (found != previous.end()) {
+                m_directories.push_back(std::move(*found));
+                previous.erase(found);
+            }
+            else {
+                SearchDirectory directory;
+                directory.path = path;
+                m_directories.push_back(std::move(directory));
+                changed = true;
+            }
+        }
+        changed = changed || !previous.empty() || !m_loaded;
+        m_generation = generation;
+        m_loaded = true;
+    }
+
+    for (auto& directory : m_directories) {
+        Stamp stamp = stampOf(directory.path.empty() ? "." : directory.path);
+        if (sameStamp(stamp, directory.stamp)) {
+            continue;
+        }
+        directory.stamp = stamp;
+        scan(directory);
+        changed = true;
+    }
+
+    if (changed) {
+        rebuildCommands();
+    }
+}
+
+void CompletionIndex::commands(std::string_view prefix, std::vector<Match>& out) const {
+    m_commands.forEachWithPrefix(prefix, [&out](std::string_view name, std::uint8_t) {
+        out.push_back({ std::string(name), false });
+    });
+}
+
+void CompletionIndex::files(std::string_view word, bool directoriesOnly, std::vector<Match>& out) {
+    size_t slash = word.rfind('/');
+    std::string_view lead = slash == std::string_view::npos ? std::string_view() : word.substr(0, slash + 1);
+    std::string_view prefix = word.substr(lead.size());
+
+    // The directory is looked in as ~ expands, but offered as typed
+    std::string directory(lead.empty() ? std::string_view(".") : lead);
+    if (directory.compare(0, 2, "~/") == 0) {
+        const char* home = std::getenv("HOME");
+        if (home != nullptr) {
+            directory.replace(0, 1, home);
+        }
+    }
+
+    const Listing* listing = list(directory);
+    if (listing == nullptr) {
+        return;
+    }
+
+    bool hidden = !prefix.empty() && prefix[0] == '.';
+    listing->names.forEachWithPrefix(prefix, [&](std::string_view name, std::uint8_t tags) {
+        bool isDirectory = (tags & TAG_DIRECTORY) != 0;
+        if ((name[0] == '.' && !hidden) || (directoriesOnly && !isDirectory)) {
+            return;
+        }
+        std::string text;
+        text.reserve(lead.size() + name.size());
+        text.append(lead);
+        text.append(name);
+        out.push_back({ std::move(text), isDirectory });
+    });
+}
+
+int CompletionIndex::builtin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    bool wantCommands = false;
+    bool wantFiles = false;
+    bool wantDirectories = false;
+
+    size_t pos = 0;
+    for (; pos < args.size() && args[pos].size() > 1 && args[pos][0] == '-'; ++pos) {
+        if (args[pos] == "--") {
+            ++pos;
+            break;
+        }
+        for (size_t i = 1; i < args[pos].size(); ++i) {
+            switch (args[pos][i]) {
+            case 'c': wantCommands = true; break;
+            case 'f': wantFiles = true; break;
+            case 'd': wantDirectories = true; break;
+            default:
+                err += "compgen: -" + std::string(1, args[pos][i]) + ": invalid option\n";
+                err += "compgen: usage: compgen [-c] [-f] [-d] [prefix]\n";
+                return 2;
+            }
+        }
+    }
+    if (args.size() - pos > 1) {
+        err += "compgen: usage: compgen [-c] [-f] [-d] [prefix]\n";
+        return 2;
+    }
+
+    std::string_view prefix = pos < args.size() ? std::string_view(args[pos]) : std::string_view();
+    if (!wantFiles && !wantDirectories) {
+        wantCommands = true;
+    }
+
+    std::vector<Match> matches;
+    if (wantCommands) {
+        commands(prefix, matches);
+    }
+    if (wantFiles || wantDirectories) {
+        files(prefix, !wantFiles, matches);
+    }
+
+    for (const auto& match : matches) {
+        out += match.text;
+        out += '\n';
+    }
+    return matches.empty() ? 1 : 0;
+}
+
+CompletionIndex::Stamp CompletionIndex::stampOf(const std::string& path) {
+    Stamp stamp;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        stamp.device = st.st_dev;
+        stamp.inode = st.st_ino;
+        stamp.modified = st.st_mtim;
+        stamp.present = true;
+    }
+    return stamp;
+}
+
+bool CompletionIndex::sameStamp(const Stamp& a, const Stamp& b) {
+    return a.present == b.present && a.device == b.device && a.inode == b.inode &&
+        a.modified.tv_sec == b.modified.tv_sec && a.modified.tv_nsec == b.modified.tv_nsec;
+}
+
+void CompletionIndex::scan(SearchDirectory& directory) {
+    directory.names.clear();
+    directory.offsets.clear();
+
+    DIR* dir = opendir(directory.path.empty() ? "." : directory.path.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    // Regular files need only an access check; links and entries of
+    // unknown type are stat'ed to leave out directories
+    int fd = dirfd(dir);
+    while (struct dirent* entry = readdir(dir)) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        if (entry->d_type != DT_REG) {
+            struct stat st;
+            if (fstatat(fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+        }
+        if (faccessat(fd, name, X_OK, 0) != 0) {
+            continue;
+        }
+
+        directory.offsets.push_back(static_cast<std::uint32_t>(directory.names.size()));
+        directory.names.insert(directory.names.end(), name, name + std::strlen(name) + 1);
+    }
+    closedir(dir);
+
+    const char* names = directory.names.data();
+    std::sort(directory.offsets.begin(), directory.offsets.end(),
+        [names](std::uint32_t a, std::uint32_t b) { return std::strcmp(names + a, names + b) < 0; });
+}
+
+void CompletionIndex::rebuildCommands() {
+    std::vector<std::string_view> builtinNames;
+    builtins::names(builtinNames);
+
+    std::vector<std::pair<std::string_view, std::uint8_t>> names;
+    size_t total = builtinNames.size();
+    for (const auto& directory : m_directories) {
+        total += directory.offsets.size();
+    }
+    names.reserve(total);
+
+    for (std::string_view name : builtinNames) {
+        names.emplace_back(name, 0);
+    }
+    for (const auto& directory : m_directories) {
+        for (std::uint32_t offset : directory.offsets) {
+            names.emplace_back(std::string_view(directory.names.data() + offset), 0);
+        }
+    }
+
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    m_commands.assign(names);
+}
+
+const CompletionIndex::Listing* CompletionIndex::list(const std::string& directory) {
+    Stamp stamp = stampOf(directory);
+    if (!stamp.present) {
+        return nullptr;
+    }
+
+    auto found = m_listings.find(directory);
+    if (found != m_listings.end() && sameStamp(found->second->stamp, stamp)) {
+        return found->second.get();
+    }
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return nullptr;
+    }
+
+    std::vector<char> block;
+    std::vector<std::pair<std::uint32_t, std::uint8_t>> entries;
+    int fd = dirfd(dir);
+    while (struct dirent* entry = readdir(dir)) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        bool isDirectory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isDirectory = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        entries.emplace_back(static_cast<std::uint32_t>(block.size()), isDirectory ? TAG_DIRECTORY : 0);
+        block.insert(block.end(), name, name + std::strlen(name) + 1);
+    }
+    closedir(dir);
+
+    std::vector<std::pair<std::string_view, std::uint8_t>> names;
+    names.reserve(entries.size());
+    for (const auto& entry : entries) {
+        names.emplace_back(std::string_view(block.data() + entry.first), entry.second);
+    }
+    std::sort(names.begin(), names.end());
+
+    // A shell that wanders through many directories starts over rather
+    // than tracking which listing was used last
+    if (found == m_listings.end() && m_listings.size() >= config::COMPLETION_CACHED_DIRECTORIES) {
+        m_listings.clear();
+    }
+
+    std::unique_ptr<Listing>& listing = m_listings[directory];
+    listing = std::make_unique<Listing>();
+    listing->stamp = stamp;
+    listing->names.assign(names);
+    return listing.get();
+}
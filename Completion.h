@@ -0,0 +1,180 @@
+// Completion.h - Command and filename completion
+
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A sorted set of names stored front-coded: each name keeps only the bytes
+// that differ from the one before it, and every BLOCK_SIZE-th name is
+// stored whole so a prefix search can binary-search those heads and then
+// decode a single run forward. Each name carries one byte of tags.
+class FrontCodedNames {
+public:
+    FrontCodedNames() : m_size(0) {}
+
+    // Replace the contents with names, which must be sorted and unique
+    void assign(const std::vector<std::pair<std::string_view, std::uint8_t>>& names);
+
+    size_t size() const { return m_size; }
+
+    // Bytes the encoded names take
+    size_t bytes() const { return m_data.size() + m_blocks.size() * sizeof(std::uint32_t); }
+
+    // Call visit(name, tags) for each name starting with prefix, in order
+    template <typename Visit>
+    void forEachWithPrefix(std::string_view prefix, Visit visit) const;
+
+private:
+    static const size_t BLOCK_SIZE = 16;
+
+    // Name at the head of a block
+    std::string_view head(size_t block) const;
+
+    // Per name: tags, bytes shared with the previous name (0 at a block
+    // head), length of the rest, then the rest. NAME_MAX keeps both
+    // lengths within a byte.
+    std::vector<char> m_data;
+    std::vector<std::uint32_t> m_blocks;    // Offset of each block's head
+    size_t m_size;
+};
+
+template <typename Visit>
+void FrontCodedNames::forEachWithPrefix(std::string_view prefix, Visit visit) const {
+    if (m_blocks.empty()) {
+        return;
+    }
+
+    // Last block whose head sorts before the prefix; the first match is in
+    // it or at the start of the next
+    size_t low = 0;
+    size_t high = m_blocks.size();
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (head(middle) < prefix) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    std::string name;
+    size_t pos = m_blocks[low];
+    while (pos < m_data.size()) {
+        std::uint8_t tags = static_cast<std::uint8_t>(m_data[pos]);
+        size_t shared = static_cast<unsigned char>(m_data[pos + 1]);
+        size_t length = static_cast<unsigned char>(m_data[pos + 2]);
+        name.resize(shared);
+        name.append(m_data.data() + pos + 3, length);
+        pos += 3 + length;
+
+        if (name.compare(0, prefix.size(), prefix) == 0) {
+            visit(std::string_view(name), tags);
+        }
+        else if (std::string_view(name) > prefix) {
+            return;
+        }
+    }
+}
+
+// Completion candidates for the line editor and the `compgen` builtin.
+//
+// Command names come from one front-coded index over every executable on
+// PATH plus the builtins, so completing a prefix is a binary search and a
+// short forward scan however many programs there are. The index is kept per
+// PATH directory: a refresh restats the directories, which costs a few
+// microseconds, and rescans only those whose modification time changed. A
+// new CommandHash generation means PATH itself may have changed and the
+// directory list is taken again.
+//
+// Filenames are completed from listings of the directory being completed
+// in, kept front-coded as well and reread only when the directory's
+// modification time changes, so a repeated Tab costs one stat.
+class CompletionIndex {
+public:
+    struct Match {
+        std::string text;
+        bool directory;     // A directory, to be completed with a '/'
+    };
+
+    CompletionIndex();
+
+    CompletionIndex(const CompletionIndex&) = delete;
+    CompletionIndex& operator=(const CompletionIndex&) = delete;
+
+    // Bring the command index up to date with the PATH directories of the
+    // given CommandHash generation
+    void refresh(const std::vector<std::string>& directories, unsigned long generation);
+
+    // Builtins and PATH executables starting with prefix, in order
+    void commands(std::string_view prefix, std::vector<Match>& out) const;
+
+    // Paths that complete word, which may name a directory to look in
+    // ("src/ma"). Names starting with '.' are only offered when the word's
+    // last component starts with one.
+    void files(std::string_view word, bool directoriesOnly, std::vector<Match>& out);
+
+    // Number of command names indexed
+    size_t commandCount() const { return m_commands.size(); }
+
+    // Implementation of the `compgen` builtin:
+    //   compgen [-c] [-f] [-d] [prefix]
+    // -c commands, -f files, -d directories; commands when none is given
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+private:
+    // Tag bits of an indexed name
+    static const std::uint8_t TAG_DIRECTORY = 1 << 0;
+
+    // When a directory was read, to tell whether it changed since
+    struct Stamp {
+        dev_t device = 0;
+        ino_t inode = 0;
+        struct timespec modified = {};
+        bool present = false;
+    };
+
+    // Executables found in one PATH directory, sorted
+    struct SearchDirectory {
+        std::string path;
+        Stamp stamp;
+        std::vector<char> names;            // NUL-separated
+        std::vector<std::uint32_t> offsets; // Into names, in name order
+    };
+
+    // A directory listed for filename completion
+    struct Listing {
+        Stamp stamp;
+        FrontCodedNames names;
+    };
+
+    static Stamp stampOf(const std::string& path);
+    static bool sameStamp(const Stamp& a, const Stamp& b);
+
+    // Read the executables of a PATH directory
+    static void scan(SearchDirectory& directory);
+
+    // Rebuild the merged command index from the per-directory lists
+    void rebuildCommands();
+
+    // Listing of a directory for filename completion, reread if it changed;
+    // nullptr if it cannot be read
+    const Listing* list(const std::string& directory);
+
+    std::vector<SearchDirectory> m_directories;
+    unsigned long m_generation;
+    bool m_loaded;
+    FrontCodedNames m_commands;
+    std::unordered_map<std::string, std::unique_ptr<Listing>> m_listings;
+};
+
+#endif // COMPLETION_H
@@ -1,14 +1,84 @@
 // Update CppShell.cpp to use the parser
 
 #include "CppShell.h"
+#include "MappedFile.h"
+#include "ScriptCache.h"
+#include "ShellStats.h"
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <filesystem>
+#include <cstring>
+#include <cerrno>
 #include <signal.h>
 
 // ... (existing code)
 
+namespace {
+
+    // Whether text ends inside a here-document still waiting for its
+    // delimiter line
+    bool hereDocumentOpen(const std::string& text) {
+        if (text.find("<<") == std::string::npos) {
+            return false;
+        }
+        Lexer lexer(text);
+        while (lexer.nextToken().getType() != TokenType::END_OF_INPUT) {
+        }
+        return lexer.hereDocumentOpen();
+    }
+
+    // Mark a script running on the executor until the end of a scope
+    class ScriptScope {
+    public:
+        explicit ScriptScope(Executor& executor) : m_executor(executor) {
+            m_executor.beginScript();
+        }
+        ~ScriptScope() {
+            m_executor.endScript();
+        }
+
+        ScriptScope(const ScriptScope&) = delete;
+        ScriptScope& operator=(const ScriptScope&) = delete;
+
+    private:
+        Executor& m_executor;
+    };
+}
+
+std::string CppShell::readLine() {
+    std::string line;
+    std::string more;
+    if (m_editor.isInteractive()) {
+        if (!m_editor.readLine(m_prompt, line)) {
+            m_running = false;
+        }
+
+        // A here-document continues on the lines that follow
+        while (m_running && hereDocumentOpen(line) && m_editor.readLine("> ", more)) {
+            line += '\n';
+            line += more;
+        }
+        return line;
+    }
+
+    if (!std::getline(std::cin, line)) {
+        m_running = false;
+    }
+    while (m_running && hereDocumentOpen(line) && std::getline(std::cin, more)) {
+        line += '\n';
+        line += more;
+    }
+    return line;
+}
+
+void CppShell::displayPrompt() {
+    // The line editor draws the prompt as part of each frame
+    if (!m_editor.isInteractive()) {
+        std::cout << m_prompt << std::flush;
+    }
+}
+
 bool CppShell::processCommand(const std::string& commandLine) {
     try {
         return parseAndExecuteCommand(commandLine);
@@ -24,40 +94,227 @@ bool CppShell::processCommand(const std::string& commandLine) {
 }
 
 bool CppShell::parseAndExecuteCommand(const std::string& commandLine) {
-    // Basic built-in commands for now
-    if (commandLine == "exit" || commandLine == "quit") {
-        m_running = false;
-        return true;
-    }
-    else if (commandLine == "help") {
-        std::cout << "Available commands:" << std::endl;
-        std::cout << "  help - Display this help message" << std::endl;
-        std::cout << "  exit - Exit the shell" << std::endl;
-        return true;
-    }
+    // Builtins, exit and help included, are dispatched by the executor
 
-    // Parse the command
+    // Parse the command; the previous command's tree is released in one go
+    m_arena.clear();
     Parser parser(commandLine);
-    std::shared_ptr<Command> command;
+    Command command;
+
+    // A pasted block spans several lines, run one command at a time as a
+    // script's are
+    if (commandLine.find('\n') != std::string::npos) {
+        ScriptScope scope(m_executor);
+        bool ok = true;
+        while (m_running) {
+            m_arena.clear();
+            try {
+                stats::Timing timing(stats::Timer::PARSE);
+                if (!parser.parseNext(m_arena, command)) {
+                    break;
+                }
+            }
+            catch (const ParseError& e) {
+                std::cerr << e.what() << std::endl;
+                return false;
+            }
+            ok = executeCommand(command);
+        }
+        return ok;
+    }
 
     try {
-        command = parser.parse();
+        stats::Timing timing(stats::Timer::PARSE);
+        command = parser.parse(m_arena);
     }
     catch (const ParseError& e) {
         std::cerr << e.what() << std::endl;
         return false;
     }
 
-    // Print the parsed command (for debugging)
-    std::cout << "Parsed command: " << command->toString() << std::endl;
+    return executeCommand(command);
+}
+
+bool CppShell::executeCommand(const Command& command) {
+    stats::Scope scope(stats::Subsystem::EXECUTOR);
+    stats::Timing timing(stats::Timer::EXECUTE);
+    m_lastStatus = m_executor.execute(command);
+    if (m_executor.exitRequested()) {
+        m_running = false;
+    }
+    return m_lastStatus == 0;
+}
+
+int CppShell::runScript(const std::string& path) {
+    // The script is mapped rather than read, and parsed and executed one
+    // top-level command at a time, so memory use does not grow with its size
+    MappedFile script;
+    if (!script.open(path)) {
+        std::cerr << config::SHELL_NAME << ": " << path << ": "
+            << std::strerror(errno) << std::endl;
+        return 127;
+    }
+
+    Command command;
+    m_running = true;
+    ScriptScope scope(m_executor);
+
+    // A cached compiled form lets the script run without lexing or parsing
+    ScriptCache cache;
+    size_t replayed = 0;
+    if (cache.load(script)) {
+        script.close();
+        while (m_running) {
+            m_arena.clear();
+            bool more;
+            {
+                stats::Scope scope(stats::Subsystem::SCRIPT_CACHE);
+                stats::Timing timing(stats::Timer::PARSE);
+                more = cache.next(m_arena, command);
+            }
+            if (!more) {
+                break;
+            }
+            executeCommand(command);
+            ++replayed;
+        }
+        if (!m_running || !cache.isCorrupt()) {
+            return m_lastStatus;
+        }
+
+        // A damaged entry is dropped and the script parsed from source
+        // instead, skipping the commands the entry already ran
+        if (!script.open(path)) {
+            std::cerr << config::SHELL_NAME << ": " << path << ": "
+                << std::strerror(errno) << std::endl;
+            return 127;
+        }
+    }
+
+    cache.beginStore();
+    Parser parser(script.view());
+
+    while (m_running) {
+        // Each command's tree is released before the next one is parsed
+        m_arena.clear();
+
+        try {
+            stats::Timing timing(stats::Timer::PARSE);
+            if (!parser.parseNext(m_arena, command)) {
+                break;
+            }
+        }
+        catch (const ParseError& e) {
+            std::cerr << path << ": line " << parser.line() << ": " << e.what() << std::endl;
+            return 2;
+        }
+
+        {
+            stats::Scope scope(stats::Subsystem::SCRIPT_CACHE);
+            cache.store(m_arena, command);
+        }
+
+        if (replayed > 0) {
+            --replayed;
+            script.release(parser.position());
+            continue;
+        }
+
+        executeCommand(command);
+        if (!m_running) {
+            completeScriptCache(parser, cache);
+            return m_lastStatus;
+        }
+        script.release(parser.position());
+    }
+
+    cache.commitStore();
+    return m_lastStatus;
+}
+
+int CppShell::runCommand(const std::string& text) {
+    // Top-level commands run one at a time, as in a script, so `exit`
+    // stops the rest. Strings are too short and varied to be worth caching.
+    Command command;
+    Parser parser(text);
+    m_running = true;
+    ScriptScope scope(m_executor);
+
+    while (m_running) {
+        m_arena.clear();
+
+        try {
+            stats::Timing timing(stats::Timer::PARSE);
+            if (!parser.parseNext(m_arena, command)) {
+                break;
+            }
+        }
+        catch (const ParseError& e) {
+            std::cerr << config::SHELL_NAME << ": -c: line " << parser.line() << ": "
+                << e.what() << std::endl;
+            return 2;
+        }
+
+        executeCommand(command);
+    }
+
+    return m_lastStatus;
+}
 
-    // In Component 2, we just parse the command but don't execute it yet
-    // This will be implemented in Component 3
-    std::cout << "Command execution not implemented yet." << std::endl;
+void CppShell::completeScriptCache(Parser& parser, ScriptCache& cache) {
+    if (!cache.isStoring()) {
+        return;
+    }
+
+    // The cache entry describes the whole file, so the rest of the script is
+    // parsed (but not run). Text after exit that does not parse, such as an
+    // embedded payload, just means the script is not cached.
+    Command command;
+    try {
+        while (true) {
+            m_arena.clear();
+            if (!parser.parseNext(m_arena, command)) {
+                break;
+            }
+            cache.store(m_arena, command);
+        }
+    }
+    catch (const ParseError&) {
+        cache.abandonStore();
+        return;
+    }
+
+    cache.commitStore();
+}
+
+void CppShell::addToHistory(const std::string& command) {
+    m_history.append(command);
+}
+
+bool CppShell::loadHistory() {
+    if (m_historyFile.empty()) {
+        const char* home = std::getenv("HOME");
+        if (home == nullptr || *home == '\0') {
+            return false;
+        }
+        m_historyFile = std::string(home) + "/" + config::HISTORY_FILE;
+    }
+
+    // The log is mapped, not read, so this costs the same for any history size
+    if (!m_history.open(m_historyFile)) {
+        std::cerr << config::SHELL_NAME << ": " << m_historyFile << ": "
+            << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_executor.setHistory(&m_history);
     return true;
 }
 
-bool CppShell::executeCommand(const std::shared_ptr<Command>& command) {
-    // This will be implemented in Component 3
+bool CppShell::saveHistory() {
+    // Entries are appended as they are added; only the last few can still
+    // be waiting for the writer thread
+    m_executor.setHistory(nullptr);
+    m_history.close();
     return true;
-}
\ No newline at end of file
+}
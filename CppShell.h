@@ -5,9 +5,12 @@
 
 #include "ShellConfig.h"
 #include "Parser.h"
+#include "Executor.h"
+#include "ScriptCache.h"
+#include "HistoryStore.h"
+#include "LineEditor.h"
 #include <string>
 #include <vector>
-#include <deque>
 
 class CppShell {
 public:
@@ -20,6 +23,13 @@ public:
     // Run the shell's main event loop
     int run();
 
+    // Run a script file non-interactively and return its exit status
+    int runScript(const std::string& path);
+
+    // Run a command string (`-c`) and return its exit status. Needs no
+    // initialize(): history, prompt and line editing are never set up.
+    int runCommand(const std::string& text);
+
     // Clean up resources
     void shutdown();
 
@@ -37,22 +47,32 @@ private:
     bool parseAndExecuteCommand(const std::string& commandLine);
 
     // Execute a parsed command
-    bool executeCommand(const std::shared_ptr<Command>& command);
+    bool executeCommand(const Command& command);
+
+    // Parse the rest of a script that exited early into its cache entry
+    void completeScriptCache(Parser& parser, ScriptCache& cache);
 
     // Add a command to history
     void addToHistory(const std::string& command);
 
-    // Load command history from file
+    // Open the history log
     bool loadHistory();
 
-    // Save command history to file
+    // Finish writing pending history entries
     bool saveHistory();
 
     // Member variables
     std::string m_prompt;
     bool m_running;
-    std::deque<std::string> m_history;
+    HistoryStore m_history;
     std::string m_historyFile;
+    CommandArena m_arena;
+    Executor m_executor;
+    int m_lastStatus = 0;
+
+    // Line editing for interactive use, completing through the executor
+    LineEditor m_editor{ m_history, [this](std::string_view word, bool commandPosition,
+        std::vector<CompletionIndex::Match>& out) { m_executor.complete(word, commandPosition, out); } };
 };
 
 #endif // CPP_SHELL_H
\ No newline at end of file
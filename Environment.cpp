@@ -0,0 +1,342 @@
+// Environment.cpp - Shell variable store implementation
+
+#include "Environment.h"
+#include "ShellStats.h"
+#include <cstdlib>
+#include <cstring>
+
+extern char** environ;
+
+namespace {
+
+    // Value quoted the way `export -p` prints it
+    std::string quoteValue(const std::string& value) {
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\' || c == '$' || c == '`') {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+}
+
+Environment::Environment() : m_parent(nullptr), m_generation(1), m_cacheGeneration(0) {
+    for (char** entry = environ; entry != nullptr && *entry != nullptr; ++entry) {
+        const char* equals = std::strchr(*entry, '=');
+        if (equals == nullptr) {
+            continue;
+        }
+        Variable& variable = m_variables[std::string(*entry, static_cast<size_t>(equals - *entry))];
+        variable.value = equals + 1;
+        variable.exported = true;
+    }
+}
+
+Environment::Environment(const Environment* parent)
+    : m_parent(parent), m_generation(1), m_cacheGeneration(0) {}
+
+const std::string* Environment::get(const std::string& name) const {
+    const Variable* variable = find(name);
+    return variable != nullptr && variable->isSet ? &variable->value : nullptr;
+}
+
+void Environment::set(const std::string& name, std::string value) {
+    Variable& variable = entry(name);
+    variable.value = std::move(value);
+    variable.isSet = true;
+    changed(name, &variable);
+}
+
+void Environment::setExported(const std::string& name, bool exported) {
+    Variable& variable = entry(name);
+    variable.exported = exported;
+    changed(name, &variable);
+}
+
+void Environment::unset(const std::string& name) {
+    // The shell's own table simply forgets it; an overlay has to hide
+    // what its parent has
+    if (m_parent == nullptr) {
+        if (m_variables.erase(name) > 0) {
+            changed(name, nullptr);
+        }
+        return;
+    }
+
+    Variable& variable = entry(name);
+    variable.value.clear();
+    variable.isSet = false;
+    variable.exported = false;
+    changed(name, &variable);
+}
+
+void Environment::assign(std::string_view word, bool exported) {
+    size_t equals = word.find('=');
+    std::string name(word.substr(0, equals));
+    Variable& variable = entry(name);
+    variable.value.assign(word.substr(equals + 1));
+    variable.isSet = true;
+    variable.exported = variable.exported || exported;
+    changed(name, &variable);
+}
+
+char* const* Environment::envp() const {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    std::uint64_t current = generation();
+    if (m_cacheGeneration != current) {
+        rebuild();
+        m_cacheGeneration = current;
+    }
+    return m_envp.data();
+}
+
+std::uint64_t Environment::generation() const {
+    return m_generation + (m_parent != nullptr ? m_parent->generation() : 0);
+}
+
+bool Environment::isName(std::string_view word) {
+    if (word.empty() || (word[0] >= '0' && word[0] <= '9')) {
+        return false;
+    }
+    for (char c : word) {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Environment::isAssignment(std::string_view word) {
+    size_t equals = word.find('=');
+    return equals != std::string_view::npos && isName(word.substr(0, equals));
+}
+
+int Environment::exportBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    bool unexport = false;
+    size_t pos = 0;
+    for (; pos < args.size() && args[pos].size() > 1 && args[pos][0] == '-'; ++pos) {
+        if (args[pos] == "--") {
+            ++pos;
+            break;
+        }
+        if (args[pos] == "-n") {
+            unexport = true;
+        }
+        else if (args[pos] != "-p") {
+            err += "export: " + args[pos] + ": invalid option\n";
+            err += "export: usage: export [-n] [name[=value] ...] or export -p\n";
+            return 2;
+        }
+    }
+
+    if (pos == args.size()) {
+        std::map<std::string, const Variable*> variables;
+        collect(variables);
+        for (const auto& item : variables) {
+            if (!item.second->exported) {
+                continue;
+            }
+            out += "export " + item.first;
+            if (item.second->isSet) {
+                out += "=" + quoteValue(item.second->value);
+            }
+            out += "\n";
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (; pos < args.size(); ++pos) {
+        const std::string& arg = args[pos];
+        size_t equals = arg.find('=');
+        std::string name = arg.substr(0, equals);
+        if (!isName(name)) {
+            err += "export: `" + arg + "': not a valid identifier\n";
+            status = 1;
+            continue;
+        }
+        if (equals != std::string::npos) {
+            set(name, arg.substr(equals + 1));
+        }
+        setExported(name, !unexport);
+    }
+    return status;
+}
+
+int Environment::unsetBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    (void)out;
+
+    int status = 0;
+    size_t pos = 0;
+    for (; pos < args.size() && args[pos].size() > 1 && args[pos][0] == '-'; ++pos) {
+        if (args[pos] == "--") {
+            ++pos;
+            break;
+        }
+        if (args[pos] != "-v") {
+            err += "unset: " + args[pos] + ": invalid option\n";
+            err += "unset: usage: unset [-v] name ...\n";
+            return 2;
+        }
+    }
+
+    for (; pos < args.size(); ++pos) {
+        if (!isName(args[pos])) {
+            err += "unset: `" + args[pos] + "': not a valid identifier\n";
+            status = 1;
+            continue;
+        }
+        unset(args[pos]);
+    }
+    return status;
+}
+
+const Environment::Variable* Environment::find(const std::string& name) const {
+    for (const Environment* env = this; env != nullptr; env = env->m_parent) {
+        auto found = env->m_variables.find(name);
+        if (found != env->m_variables.end()) {
+            return &found->second;
+        }
+    }
+    return nullptr;
+}
+
+Environment::Variable& Environment::entry(const std::string& name) {
+    auto found = m_variables.find(name);
+    if (found != m_variables.end()) {
+        return found->second;
+    }
+
+    // An overlay's entry starts as a copy of what it shadows
+    Variable variable;
+    const Variable* inherited = m_parent != nullptr ? m_parent->find(name) : nullptr;
+    if (inherited != nullptr) {
+        variable.value = inherited->value;
+        variable.exported = inherited->exported;
+        variable.isSet = inherited->isSet;
+    }
+    else {
+        variable.isSet = false;
+    }
+    return m_variables.emplace(name, std::move(variable)).first->second;
+}
+
+size_t Environment::slotOf(const std::string& name) const {
+    auto found = m_variables.find(name);
+    if (found != m_variables.end()) {
+        return found->second.slot;
+    }
+    if (m_parent == nullptr) {
+        return NO_SLOT;
+    }
+
+    size_t slot = m_parent->slotOf(name);
+    return slot == NO_SLOT || m_remap.empty() ? slot : m_remap[slot];
+}
+
+void Environment::changed(const std::string& name, const Variable* variable) {
+    ++m_generation;
+    if (m_parent != nullptr) {
+        return;
+    }
+
+    if (variable != nullptr && variable->isSet && variable->exported) {
+        setenv(name.c_str(), variable->value.c_str(), 1);
+    }
+    else {
+        unsetenv(name.c_str());
+    }
+}
+
+void Environment::rebuild() const {
+    stats::count(stats::Counter::ENV_BUILDS);
+    m_envp.clear();
+    m_remap.clear();
+
+    // An overlay starts from its parent's array as it stands
+    size_t inherited = 0;
+    if (m_parent != nullptr) {
+        char* const* base = m_parent->envp();
+        while (base[inherited] != nullptr) {
+            ++inherited;
+        }
+        m_envp.reserve(inherited + m_variables.size() + 1);
+        m_envp.assign(base, base + inherited);
+    }
+
+    // Sized up front so the pointers taken into it stay put
+    size_t bytes = 0;
+    for (const auto& item : m_variables) {
+        if (item.second.isSet && item.second.exported) {
+            bytes += item.first.size() + item.second.value.size() + 2;
+        }
+    }
+    m_block.resize(bytes);
+
+    size_t offset = 0;
+    bool dropped = false;
+    for (const auto& item : m_variables) {
+        const Variable& variable = item.second;
+        size_t slot = m_parent != nullptr ? m_parent->slotOf(item.first) : NO_SLOT;
+
+        if (!variable.isSet || !variable.exported) {
+            if (slot != NO_SLOT) {
+                m_envp[slot] = nullptr;
+                dropped = true;
+            }
+            variable.slot = NO_SLOT;
+            continue;
+        }
+
+        char* text = m_block.data() + offset;
+        std::memcpy(text, item.first.data(), item.first.size());
+        offset += item.first.size();
+        m_block[offset++] = '=';
+        std::memcpy(m_block.data() + offset, variable.value.data(), variable.value.size());
+        offset += variable.value.size();
+        m_block[offset++] = '\0';
+
+        if (slot != NO_SLOT) {
+            m_envp[slot] = text;
+            variable.slot = slot;
+        }
+        else {
+            variable.slot = m_envp.size();
+            m_envp.push_back(text);
+        }
+    }
+
+    // Close the gaps left by dropped entries, remembering where everything
+    // moved so overlays of this one can still find their parent's slots
+    if (dropped) {
+        std::vector<size_t> remap(m_envp.size(), NO_SLOT);
+        size_t kept = 0;
+        for (size_t i = 0; i < m_envp.size(); ++i) {
+            if (m_envp[i] != nullptr) {
+                remap[i] = kept;
+                m_envp[kept++] = m_envp[i];
+            }
+        }
+        m_envp.resize(kept);
+        for (const auto& item : m_variables) {
+            if (item.second.slot != NO_SLOT) {
+                item.second.slot = remap[item.second.slot];
+            }
+        }
+        remap.resize(inherited);
+        m_remap = std::move(remap);
+    }
+
+    m_envp.push_back(nullptr);
+}
+
+void Environment::collect(std::map<std::string, const Variable*>& into) const {
+    if (m_parent != nullptr) {
+        m_parent->collect(into);
+    }
+    for (const auto& item : m_variables) {
+        into[item.first] = &item.second;
+    }
+}
@@ -0,0 +1,121 @@
+// Environment.h - Shell variables and the environment of started programs
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Shell variables and the envp block programs are started with.
+//
+// Variables live in one flat hash map, each with an exported flag. The envp
+// handed to posix_spawn is built from the exported ones into one contiguous
+// block and kept until a variable changes; a generation counter tells when
+// that happens, so a script launching thousands of programs builds it once.
+//
+// Subshells and per-command assignments (FOO=1 cmd) do not copy the table.
+// They get an overlay: an Environment that holds only the names it changes
+// and defers everything else to its parent. An overlay's envp is a copy of
+// its parent's pointer array with its own entries patched in at the slots
+// the parent gave those names, so it costs one pointer copy per variable
+// and no string building. A parent must outlive its overlays and must not
+// change while they are in use.
+class Environment {
+public:
+    // The shell's own environment, seeded from the process's
+    Environment();
+
+    // Overlay on parent
+    explicit Environment(const Environment* parent);
+
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+
+    // Value of a variable, or nullptr when it is unset
+    const std::string* get(const std::string& name) const;
+
+    // Set a variable; it keeps its exported flag
+    void set(const std::string& name, std::string value);
+
+    // Set or clear a variable's exported flag. An unset variable that is
+    // exported is passed on once it gets a value.
+    void setExported(const std::string& name, bool exported);
+
+    // Remove a variable
+    void unset(const std::string& name);
+
+    // Apply a NAME=value word, optionally exporting the variable too
+    void assign(std::string_view word, bool exported);
+
+    // Exported variables as a null-terminated array of NAME=value strings.
+    // It stays valid until this environment or one it overlays changes.
+    // Safe to call from several threads at once.
+    char* const* envp() const;
+
+    // Number of changes made to this environment and those it overlays
+    std::uint64_t generation() const;
+
+    // Whether word is a valid variable name
+    static bool isName(std::string_view word);
+
+    // Whether word has the form NAME=value
+    static bool isAssignment(std::string_view word);
+
+    // Implementation of the `export` builtin:
+    //   export [-p]            list exported variables
+    //   export [-n] name[=value]...
+    //                          export (or with -n stop exporting) variables
+    int exportBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+    // Implementation of the `unset` builtin: unset [-v] name...
+    int unsetBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+private:
+    static const size_t NO_SLOT = ~size_t(0);
+
+    struct Variable {
+        std::string value;
+        bool exported = false;
+        bool isSet = true;              // False when unset here, hiding any parent's
+        mutable size_t slot = NO_SLOT;  // Position in this environment's envp
+    };
+
+    // Nearest definition of name in this environment or those it overlays
+    const Variable* find(const std::string& name) const;
+
+    // This environment's own entry for name, inheriting what its parent has
+    Variable& entry(const std::string& name);
+
+    // Position of name in this environment's envp, whose cache must be current
+    size_t slotOf(const std::string& name) const;
+
+    // Record a change to name. The shell's own environment is mirrored
+    // into the process's so getenv (PATH lookups, cache paths) follows it.
+    void changed(const std::string& name, const Variable* variable);
+
+    // Build the envp cache; called with the cache mutex held
+    void rebuild() const;
+
+    // Every visible variable, by name
+    void collect(std::map<std::string, const Variable*>& into) const;
+
+    const Environment* m_parent;
+    std::unordered_map<std::string, Variable> m_variables;
+    std::uint64_t m_generation;
+
+    // envp cache: own NAME=value strings, the pointer array, and for
+    // overlays that dropped inherited entries, parent slot -> own slot
+    mutable std::mutex m_cacheMutex;
+    mutable std::uint64_t m_cacheGeneration;
+    mutable std::vector<char> m_block;
+    mutable std::vector<char*> m_envp;
+    mutable std::vector<size_t> m_remap;
+};
+
+#endif // ENVIRONMENT_H
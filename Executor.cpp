@@ -0,0 +1,1169 @@
+// Executor.cpp - Command execution engine implementation
+
+#include "Executor.h"
+#include "HereDoc.h"
+#include "LexScan.h"
+#include "Parallel.h"
+#include "Parser.h"
+#include "PipeIO.h"
+#include "ShellConfig.h"
+#include "ShellStats.h"
+#include "Trace.h"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+namespace {
+
+    // Set on threads running `parallel` jobs
+    thread_local bool t_inJob = false;
+
+    // Set on threads running the commands of a $(...)
+    thread_local bool t_inSubstitution = false;
+
+    // Overlay in effect on this thread, if any
+    thread_local Environment* t_environment = nullptr;
+
+    // Make an overlay the thread's environment until the end of a scope
+    class EnvironmentScope {
+    public:
+        explicit EnvironmentScope(Environment& environment) : m_previous(t_environment) {
+            t_environment = &environment;
+        }
+        ~EnvironmentScope() {
+            t_environment = m_previous;
+        }
+
+        EnvironmentScope(const EnvironmentScope&) = delete;
+        EnvironmentScope& operator=(const EnvironmentScope&) = delete;
+
+    private:
+        Environment* m_previous;
+    };
+
+    // Builtin a command runs as. A bare assignment, or a command whose
+    // words all expanded to nothing, is a no-op `:` wherever it cannot
+    // change the shell: pipeline stages and background jobs.
+    BuiltinId builtinFor(const SimpleCommand& command) {
+        return command.getName().empty() ? BuiltinId::COLON : builtins::find(command.getName());
+    }
+
+    // Open a redirection's target in the shell, close-on-exec, reporting
+    // why when it cannot be opened
+    int openRedirection(const Redirection& redir) {
+        bool document = redir.type == RedirectType::HEREDOC || redir.type == RedirectType::HERESTRING;
+        int flags = O_CLOEXEC;
+        switch (redir.type) {
+        case RedirectType::INPUT:
+            flags |= O_RDONLY;
+            break;
+        case RedirectType::OUTPUT:
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case RedirectType::APPEND:
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        case RedirectType::HEREDOC:
+        case RedirectType::HERESTRING:
+            break;
+        }
+
+        int fd = document ? heredoc::open(redir.target, redir.type == RedirectType::HERESTRING)
+            : open(redir.target.c_str(), flags, 0666);
+        if (fd < 0) {
+            std::cerr << config::SHELL_NAME << ": " << (document ? "here-document" : redir.target) << ": "
+                << std::strerror(errno) << std::endl;
+        }
+        return fd;
+    }
+
+    // Builtins that change the shell beyond its variables: its options,
+    // command hash, history and jobs
+    bool changesShell(BuiltinId id) {
+        switch (id) {
+        case BuiltinId::HASH:
+        case BuiltinId::SHOPT:
+        case BuiltinId::HISTORY:
+        case BuiltinId::PARALLEL:
+        case BuiltinId::WAIT:
+        case BuiltinId::JOBOUTPUT:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Builtins on state the shell keeps without a lock: its jobs, job
+    // output, options and history. `parallel` jobs may not run them.
+    bool usesShellState(BuiltinId id) {
+        switch (id) {
+        case BuiltinId::JOBS:
+        case BuiltinId::WAIT:
+        case BuiltinId::JOBOUTPUT:
+        case BuiltinId::SHOPT:
+        case BuiltinId::HISTORY:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // A reader that goes away must surface as EPIPE on helper threads rather
+    // than as a SIGPIPE that would take down the whole shell
+    void blockSigpipe() {
+        sigset_t pipeMask;
+        sigemptyset(&pipeMask);
+        sigaddset(&pipeMask, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeMask, nullptr);
+    }
+}
+
+int Executor::execute(const Command& command) {
+    reapBackground();
+    m_commandHash.revalidate(m_scriptDepth == 0);
+
+    // Cached listings last for one command line
+    m_glob.setCaching(m_options.globCache);
+    m_glob.clearCache();
+
+    int status = 0;
+    if (command.isBackground()) {
+        executeBackground(command);
+    }
+    else {
+        status = executeNode(command, IoFds());
+    }
+
+    // Outside a script, kept redirections last for the command line
+    if (m_scriptDepth == 0) {
+        m_redirects.clear();
+    }
+    return status;
+}
+
+void Executor::endScript() {
+    if (--m_scriptDepth == 0) {
+        m_redirects.clear();
+    }
+}
+
+void Executor::complete(std::string_view word, bool commandPosition,
+    std::vector<CompletionIndex::Match>& out) {
+    std::lock_guard<std::mutex> lock(m_hashMutex);
+
+    // A word with a slash names a path even in command position
+    if (commandPosition && word.find('/') == std::string_view::npos) {
+        m_completion.refresh(m_commandHash.directories(), m_commandHash.generation());
+        m_completion.commands(word, out);
+    }
+    else {
+        m_completion.files(word, false, out);
+    }
+}
+
+int Executor::executeJob(const Command& command, const IoFds& fds) {
+    bool wasJob = t_inJob;
+    t_inJob = true;
+
+    // Like a subshell, a job's variables go away with it
+    Environment jobEnvironment(&environment());
+    EnvironmentScope scope(jobEnvironment);
+
+    int status = executeNode(command, fds);
+    t_inJob = wasJob;
+    return status;
+}
+
+void Executor::reapBackground() {
+    if (m_jobs.empty()) {
+        return;
+    }
+    m_jobs.reap();
+
+    // Finished jobs are announced the way interactive shells do; scripts
+    // keep them until `wait` or `jobs` asks
+    if (isatty(STDIN_FILENO)) {
+        std::string done;
+        m_jobs.reportDone(done);
+        std::cout << done << std::flush;
+    }
+}
+
+int Executor::executeNode(const Command& command, const IoFds& fds) {
+    if (!trace::enabled()) {
+        return dispatchNode(command, fds);
+    }
+
+    trace::Span span(command);
+    int status = dispatchNode(command, fds);
+    span.finish(status);
+    return status;
+}
+
+int Executor::dispatchNode(const Command& command, const IoFds& fds) {
+    switch (command.getType()) {
+    case CommandType::SIMPLE:
+        m_lastStatus = executeSimple(command.getCommand(), fds);
+        return m_lastStatus;
+
+    case CommandType::PIPELINE:
+        m_lastStatus = executePipeline(command, fds, true);
+        return m_lastStatus;
+
+    // Lists run their children in order. After `exit` nothing further in
+    // the list runs; an && chain stops at the first failure and an || chain
+    // at the first success.
+    case CommandType::SEQUENCE:
+    case CommandType::LOGICAL_AND:
+    case CommandType::LOGICAL_OR: {
+        int status = 0;
+        size_t count = command.getChildCount();
+        for (size_t i = 0; i < count; ++i) {
+            status = executeNode(command.getChild(i), fds);
+            if (m_exitRequested ||
+                (command.getType() == CommandType::LOGICAL_AND && status != 0) ||
+                (command.getType() == CommandType::LOGICAL_OR && status == 0)) {
+                break;
+            }
+        }
+        return status;
+    }
+    }
+
+    return 1;
+}
+
+void Executor::executeBackground(const Command& command) {
+    IoFds fds;
+
+    // With capture on, the job's stdout and stderr go into a pipe the shell
+    // reads instead of to the terminal
+    int capture = -1;
+    if (m_options.jobOutput) {
+        int id = m_jobs.nextId();
+        capture = m_jobOutput.capture(id, m_options.jobBuffer, m_options.jobPolicy);
+        if (capture >= 0) {
+            fds.out = capture;
+            fds.err = capture;
+        }
+        else {
+            std::cerr << config::SHELL_NAME << ": joboutput: cannot capture job " << id
+                << "; its output goes to the terminal" << std::endl;
+        }
+    }
+
+    // Builtins take the subshell path below so they run asynchronously too
+    if (command.getType() == CommandType::SIMPLE &&
+        builtinFor(command.getCommand()) == BuiltinId::NONE) {
+        int failureStatus = 0;
+        SimpleCommand storage;
+        pid_t pid = launch(expandWords(command.getCommand(), storage), fds, failureStatus);
+        if (capture >= 0) {
+            close(capture);
+        }
+        if (pid > 0) {
+            int id = m_jobs.add({ pid }, command.toString());
+            std::cout << "[" << id << "] " << pid << std::endl;
+        }
+        return;
+    }
+
+    // Detached relay stages would outlive the capture descriptor, so a
+    // captured pipeline that has any runs in a subshell like lists do
+    if (command.getType() == CommandType::PIPELINE && (capture < 0 || !hasRelayStage(command))) {
+        executePipeline(command, fds, false);
+        if (capture >= 0) {
+            close(capture);
+        }
+        return;
+    }
+
+    // Lists need a shell to sequence them, so they run in a new one started
+    // on their text, as do backgrounded builtins
+    pid_t pid = spawnShell(command.toString(), fds);
+    if (capture >= 0) {
+        close(capture);
+    }
+    if (pid < 0) {
+        return;
+    }
+
+    int id = m_jobs.add({ pid }, command.toString());
+    std::cout << "[" << id << "] " << pid << std::endl;
+}
+
+pid_t Executor::spawnShell(const std::string& source, const IoFds& fds) {
+    // A forked copy of the shell would have to run its code in a child of
+    // a threaded process; a new one is spawned instead, with nothing run
+    // between the clone and the exec
+    SimpleCommand shell(config::SHELL_NAME);
+    shell.addArgument("-c");
+    shell.addArgument(source);
+
+    stats::count(stats::Counter::SUBSHELLS);
+    SpawnResult result = ProcessSpawner::spawn("/proc/self/exe", shell, fds, environment().envp());
+    if (result.pid < 0) {
+        std::cerr << config::SHELL_NAME << ": cannot start a subshell: "
+            << std::strerror(result.error) << std::endl;
+    }
+    return result.pid;
+}
+
+bool Executor::hasRelayStage(const Command& command) {
+    std::vector<const SimpleCommand*> stages;
+    collectStages(command, stages);
+    for (const SimpleCommand* stage : stages) {
+        if (builtinFor(*stage) != BuiltinId::NONE || stage->getName() == "tee") {
+            return true;
+        }
+    }
+    return false;
+}
+
+int Executor::executeSimple(const SimpleCommand& original, const IoFds& fds) {
+    SimpleCommand storage;
+    const SimpleCommand& command = expandWords(original, storage);
+    if (command.getName().empty()) {
+        return assignVariables(command, fds);
+    }
+
+    BuiltinId builtin = builtins::find(command.getName());
+    if (builtin != BuiltinId::NONE) {
+        // Assignments before export and unset stay, as for special builtins
+        // in POSIX; for the others they last as long as the command
+        if (command.getAssignments().empty() || builtin == BuiltinId::EXPORT || builtin == BuiltinId::UNSET) {
+            for (const auto& assignment : command.getAssignments()) {
+                environment().assign(assignment, false);
+            }
+            return executeBuiltin(builtin, command, fds, false);
+        }
+
+        Environment overlay(&environment());
+        for (const auto& assignment : command.getAssignments()) {
+            overlay.assign(assignment, true);
+        }
+        EnvironmentScope scope(overlay);
+        return executeBuiltin(builtin, command, fds, false);
+    }
+
+    int failureStatus = 0;
+    std::vector<int> cached;
+    bool useCached = cachingRedirections() && cachedRedirections(command, cached);
+    pid_t pid = launch(command, fds, failureStatus, useCached ? &cached : nullptr);
+    if (pid < 0) {
+        return failureStatus;
+    }
+
+    struct rusage usage;
+    int status = waitFor(pid, &usage);
+    trace::attachProcess(pid, usage);
+    return status;
+}
+
+int Executor::executeBuiltin(BuiltinId id, const SimpleCommand& command, const IoFds& fds,
+    bool subshell, std::string* capture) {
+    IoFds builtinFds = fds;
+    std::vector<int> opened;
+    int status = 1;
+    stats::count(stats::Counter::BUILTINS);
+
+    // Jobs run on worker threads at the same time as each other
+    if (t_inJob && usesShellState(id)) {
+        std::string message = command.getName() + ": not available in parallel jobs\n";
+        pipeio::writeAll(fds.err, message.data(), message.size());
+        return 2;
+    }
+
+    // A substitution runs in the shell, so what it changes would stay
+    if (t_inSubstitution && changesShell(id)) {
+        std::string message = command.getName() + ": not available in command substitutions\n";
+        pipeio::writeAll(fds.err, message.data(), message.size());
+        return 2;
+    }
+
+    if (openRedirections(command, builtinFds, opened, !subshell && cachingRedirections())) {
+        std::string out;
+        std::string err;
+        const std::vector<std::string>& args = command.getArguments();
+
+        // Builtins that work on the shell's own state are run here, the
+        // rest by the registry
+        switch (id) {
+        case BuiltinId::HASH: {
+            std::lock_guard<std::mutex> lock(m_hashMutex);
+            status = m_commandHash.builtin(args, out, err);
+            break;
+        }
+
+        case BuiltinId::COMPGEN: {
+            std::lock_guard<std::mutex> lock(m_hashMutex);
+            m_completion.refresh(m_commandHash.directories(), m_commandHash.generation());
+            status = m_completion.builtin(args, out, err);
+            break;
+        }
+
+        case BuiltinId::JOBS:
+            status = m_jobs.jobsBuiltin(args, out, err);
+            break;
+
+        case BuiltinId::WAIT:
+            status = m_jobs.waitBuiltin(args, out, err);
+            break;
+
+        case BuiltinId::JOBOUTPUT:
+            status = m_jobOutput.builtin(args, out, err);
+            break;
+
+        // A subshell changes a throwaway overlay, never the shell
+        case BuiltinId::EXPORT:
+        case BuiltinId::UNSET: {
+            Environment scratch(&environment());
+            Environment& target = subshell ? scratch : environment();
+            status = id == BuiltinId::EXPORT ? target.exportBuiltin(args, out, err)
+                : target.unsetBuiltin(args, out, err);
+            break;
+        }
+
+        case BuiltinId::PARALLEL:
+            // Jobs write their output to the descriptors as they finish
+            status = Parallel(*this).run(args, builtinFds, err);
+            break;
+
+        case BuiltinId::SHOPT:
+            status = m_options.builtin(args, out, err);
+            break;
+
+        case BuiltinId::SHELLSTATS:
+            status = stats::builtin(args, out, err);
+            break;
+
+        case BuiltinId::HISTORY:
+            if (m_history != nullptr) {
+                status = m_history->builtin(args, out, err);
+            }
+            else {
+                err += "history: history is not enabled\n";
+            }
+            break;
+
+        case BuiltinId::EXIT:
+            status = m_lastStatus;
+            if (!args.empty()) {
+                char* end = nullptr;
+                long value = std::strtol(args[0].c_str(), &end, 10);
+                if (end == args[0].c_str() || *end != '\0') {
+                    err += "exit: " + args[0] + ": numeric argument required\n";
+                    status = 2;
+                }
+                else {
+                    status = static_cast<int>(value & 0xFF);
+                }
+            }
+            if (!subshell && !t_inJob) {
+                m_exitRequested = true;
+            }
+            break;
+
+        default:
+            status = builtins::run(id, args, out, err);
+            break;
+        }
+
+        if (capture != nullptr && builtinFds.out == fds.out) {
+            capture->append(out);
+        }
+        else {
+            pipeio::writeAll(builtinFds.out, out.data(), out.size());
+        }
+        pipeio::writeAll(builtinFds.err, err.data(), err.size());
+    }
+
+    for (int fd : opened) {
+        close(fd);
+    }
+    return status;
+}
+
+int Executor::executePipeline(const Command& command, const IoFds& fds, bool wait) {
+    std::uint64_t started = trace::enabled() ? trace::now() : 0;
+    std::vector<const SimpleCommand*> stages;
+    collectStages(command, stages);
+
+    // Stages with pattern words run as expanded copies
+    std::vector<SimpleCommand> expanded;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (stages[i]->hasWordFlags()) {
+            expanded.resize(stages.size());
+            stages[i] = &expandWords(*stages[i], expanded[i]);
+        }
+    }
+
+    // Each stage is either a child process or an in-process relay thread
+    std::vector<pid_t> pids(stages.size(), -1);
+    std::vector<std::unique_ptr<Relay>> relays(stages.size());
+    std::vector<int> statuses(stages.size(), 0);
+
+    int input = fds.in;
+
+    for (size_t i = 0; i < stages.size(); ++i) {
+        bool last = (i + 1 == stages.size());
+
+        int pipeFds[2] = { -1, -1 };
+        if (!last && !pipeio::makePipe(pipeFds, m_options.pipeSize)) {
+            std::cerr << config::SHELL_NAME << ": pipe: " << std::strerror(errno) << std::endl;
+            if (input != fds.in) {
+                close(input);
+            }
+            statuses.back() = 1;
+            break;
+        }
+
+        IoFds stageFds = fds;
+        stageFds.in = input;
+        stageFds.out = last ? fds.out : pipeFds[1];
+
+        BuiltinId builtin = builtinFor(*stages[i]);
+        if (builtin != BuiltinId::NONE || stages[i]->getName() == "tee") {
+            // The relay takes over the pipe ends it was given
+            std::vector<int> owned;
+            if (input != fds.in) {
+                owned.push_back(input);
+            }
+            if (!last) {
+                owned.push_back(pipeFds[1]);
+            }
+            if (builtin != BuiltinId::NONE) {
+                relays[i] = startBuiltin(builtin, *stages[i], stageFds, std::move(owned));
+            }
+            else {
+                relays[i] = startTee(*stages[i], stageFds, std::move(owned));
+            }
+        }
+        else {
+            pids[i] = launch(*stages[i], stageFds, statuses[i]);
+
+            // The child holds its own copies of the pipe ends now
+            if (input != fds.in) {
+                close(input);
+            }
+            if (!last) {
+                close(pipeFds[1]);
+            }
+        }
+
+        if (!last) {
+            input = pipeFds[0];
+        }
+    }
+
+    if (!wait) {
+        std::vector<pid_t> jobPids;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            if (pids[i] > 0) {
+                jobPids.push_back(pids[i]);
+            }
+            if (relays[i]) {
+                relays[i]->thread.detach();
+            }
+        }
+        if (!jobPids.empty()) {
+            int id = m_jobs.add(jobPids, command.toString());
+            std::cout << "[" << id << "] " << jobPids.back() << std::endl;
+        }
+        return 0;
+    }
+
+    // Stages are not nodes the executor visits, so their spans are
+    // recorded here: each from the pipeline's start until it was reaped
+    for (size_t i = 0; i < stages.size(); ++i) {
+        struct rusage usage;
+        bool haveUsage = false;
+        if (pids[i] > 0) {
+            statuses[i] = waitFor(pids[i], &usage);
+            haveUsage = true;
+        }
+        else if (relays[i]) {
+            relays[i]->thread.join();
+            statuses[i] = relays[i]->status;
+        }
+        trace::record("stage", stages[i]->toString(), pids[i], started, trace::enabled() ? trace::now() : 0,
+            statuses[i], haveUsage ? &usage : nullptr);
+    }
+
+    // The pipeline's status is the status of its last stage
+    return statuses.back();
+}
+
+std::unique_ptr<Executor::Relay> Executor::startTee(const SimpleCommand& command,
+    const IoFds& fds, std::vector<int> owned) {
+    stats::count(stats::Counter::RELAYS);
+    auto relay = std::make_unique<Relay>();
+    IoFds relayFds = fds;
+
+    if (!openRedirections(command, relayFds, owned)) {
+        relay->status = 1;
+        relayFds.in = -1;
+    }
+
+    Relay* state = relay.get();
+    std::vector<std::string> args = command.getArguments();
+
+    relay->thread = std::thread([state, relayFds, args, owned]() {
+        stats::Scope scope(stats::Subsystem::EXECUTOR);
+
+        blockSigpipe();
+
+        std::vector<int> files;
+        if (relayFds.in >= 0) {
+            int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+            for (const auto& arg : args) {
+                if (arg == "-a" || arg == "--append") {
+                    flags = (flags & ~O_TRUNC) | O_APPEND;
+                    continue;
+                }
+                if (arg == "-i" || arg == "-p") {
+                    continue;
+                }
+
+                int fd = open(arg.c_str(), flags, 0666);
+                if (fd < 0) {
+                    std::string message = "tee: " + arg + ": " + std::strerror(errno) + "\n";
+                    pipeio::writeAll(relayFds.err, message.data(), message.size());
+                    state->status = 1;
+                    continue;
+                }
+                files.push_back(fd);
+            }
+
+            // Standard output goes last: it is the one target that consumes
+            // the input, so the files only ever see tee'd copies
+            std::vector<int> targets = files;
+            targets.push_back(relayFds.out);
+            if (!pipeio::fanOut(relayFds.in, targets)) {
+                state->status = 1;
+            }
+        }
+
+        for (int fd : files) {
+            close(fd);
+        }
+        for (int fd : owned) {
+            close(fd);
+        }
+    });
+
+    return relay;
+}
+
+std::unique_ptr<Executor::Relay> Executor::startBuiltin(BuiltinId id, const SimpleCommand& command,
+    const IoFds& fds, std::vector<int> owned) {
+    stats::count(stats::Counter::RELAYS);
+    auto relay = std::make_unique<Relay>();
+    Relay* state = relay.get();
+    bool inJob = t_inJob;
+    bool inSubstitution = t_inSubstitution;
+
+    // The stage is copied: a backgrounded pipeline's relay can outlive the
+    // arena the command lives in
+    relay->thread = std::thread([this, state, id, command, fds, owned, inJob, inSubstitution]() {
+        stats::Scope scope(stats::Subsystem::EXECUTOR);
+        blockSigpipe();
+        t_inJob = inJob;
+        t_inSubstitution = inSubstitution;
+
+        state->status = executeBuiltin(id, command, fds, true);
+
+        for (int fd : owned) {
+            close(fd);
+        }
+    });
+
+    return relay;
+}
+
+void Executor::collectStages(const Command& command, std::vector<const SimpleCommand*>& stages) {
+    if (command.getType() == CommandType::SIMPLE) {
+        stages.push_back(&command.getCommand());
+        return;
+    }
+
+    size_t count = command.getChildCount();
+    stages.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (command.getChild(i).getType() == CommandType::SIMPLE) {
+            stages.push_back(&command.getChild(i).getCommand());
+        }
+    }
+}
+
+pid_t Executor::launch(const SimpleCommand& command, const IoFds& fds, int& failureStatus,
+    const std::vector<int>* openFds) {
+    // FOO=1 cmd sees FOO through an overlay; the shell's own envp block is
+    // only rebuilt when a variable has changed since the last launch
+    Environment overlay(&environment());
+    for (const auto& assignment : command.getAssignments()) {
+        overlay.assign(assignment, true);
+    }
+    const Environment& env = command.getAssignments().empty() ? environment() : overlay;
+    char* const* envp = env.envp();
+
+    std::string path;
+    if (!findCommand(command.getName(), env, false, path)) {
+        std::cerr << config::SHELL_NAME << ": " << command.getName()
+            << ": command not found" << std::endl;
+        failureStatus = 127;
+        return -1;
+    }
+
+    // Redirections the cache does not hold are opened here and handed to
+    // the child. File actions fail with the same errno as the exec, so a
+    // target opened by the child could not be told apart from the program.
+    const std::vector<Redirection>& redirections = command.getRedirections();
+    std::vector<int> targets;
+    std::vector<int> opened;
+    if (!redirections.empty()) {
+        targets = openFds != nullptr ? *openFds : std::vector<int>(redirections.size(), -1);
+    }
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (targets[i] >= 0) {
+            continue;
+        }
+        targets[i] = openRedirection(redirections[i]);
+        if (targets[i] < 0) {
+            for (int fd : opened) {
+                close(fd);
+            }
+            failureStatus = 1;
+            return -1;
+        }
+        opened.push_back(targets[i]);
+    }
+    const std::vector<int>* targetFds = targets.empty() ? nullptr : &targets;
+
+    stats::count(stats::Counter::SPAWNS);
+    SpawnResult result = ProcessSpawner::spawn(path, command, fds, envp, targetFds);
+
+    // A remembered path can vanish between revalidations; look it up again
+    if (result.pid < 0 && result.error == ENOENT && command.getName().find('/') == std::string::npos) {
+        if (findCommand(command.getName(), env, true, path)) {
+            stats::count(stats::Counter::SPAWNS);
+            result = ProcessSpawner::spawn(path, command, fds, envp, targetFds);
+        }
+    }
+
+    for (int fd : opened) {
+        close(fd);
+    }
+    if (result.pid > 0) {
+        return result.pid;
+    }
+
+    stats::count(stats::Counter::SPAWN_FAILURES);
+    if (result.error == ENOENT) {
+        std::cerr << config::SHELL_NAME << ": " << command.getName()
+            << ": command not found" << std::endl;
+        failureStatus = 127;
+    }
+    else {
+        std::cerr << config::SHELL_NAME << ": " << command.getName() << ": "
+            << std::strerror(result.error) << std::endl;
+        failureStatus = 126;
+    }
+    return -1;
+}
+
+const SimpleCommand& Executor::expandWords(const SimpleCommand& command, SimpleCommand& storage) {
+    if (!command.hasWordFlags()) {
+        return command;
+    }
+
+    // Assignments are substituted but never split or globbed. Redirection
+    // targets are taken as written.
+    const std::vector<std::string>& assignments = command.getAssignments();
+    std::vector<std::string> fields;
+    for (size_t i = 0; i < assignments.size(); ++i) {
+        if ((command.getAssignmentFlags(i) & WORD_SUBSTITUTION) == 0) {
+            fields.push_back(assignments[i]);
+            continue;
+        }
+        size_t first = fields.size();
+        expandWord(assignments[i], command.getAssignmentFlags(i), false, fields);
+        if (fields.size() == first) {
+            fields.emplace_back();
+        }
+    }
+    std::vector<std::string> values = std::move(fields);
+    fields.clear();
+
+    // The name is expanded with the arguments: a substitution in command
+    // position can supply both, or vanish and leave the next word the name
+    if (!command.getName().empty() || command.getNameFlags() != 0) {
+        expandWord(command.getName(), command.getNameFlags(), true, fields);
+    }
+
+    // export's NAME=value arguments are assignments too
+    bool exporting = command.getNameFlags() == 0 && command.getName() == "export";
+    const std::vector<std::string>& args = command.getArguments();
+    for (size_t i = 0; i < args.size(); ++i) {
+        bool split = !exporting || !Environment::isAssignment(args[i]);
+        expandWord(args[i], command.getArgumentFlags(i), split, fields);
+    }
+
+    storage = SimpleCommand(fields.empty() ? std::string() : std::move(fields[0]));
+    for (auto& value : values) {
+        storage.addAssignment(value);
+    }
+    for (size_t i = 1; i < fields.size(); ++i) {
+        storage.addArgument(std::move(fields[i]));
+    }
+    for (const auto& redir : command.getRedirections()) {
+        storage.addRedirection(redir.type, redir.target);
+    }
+    return storage;
+}
+
+void Executor::expandWord(const std::string& word, std::uint8_t flags, bool split,
+    std::vector<std::string>& fields) {
+    bool pattern = (flags & WORD_GLOB) != 0;
+    if ((flags & WORD_SUBSTITUTION) == 0) {
+        if (pattern) {
+            expandPattern(word, fields);
+        }
+        else {
+            fields.push_back(word);
+        }
+        return;
+    }
+
+    // In a pattern, text that must not match as a wildcard is escaped:
+    // quoted text and whatever a substitution printed
+    auto appendLiteral = [pattern](std::string& field, std::string_view text) {
+        for (char c : text) {
+            if (pattern && (c == '\\' || lexscan::hasClass(c, lexscan::CLASS_GLOB))) {
+                field += '\\';
+            }
+            field += c;
+        }
+    };
+
+    // The word is walked as the lexer left it: quotes and escapes are
+    // removed here, and each $(...) replaced with its output
+    std::vector<std::string> words;
+    std::string field;
+    bool started = false;
+    bool inQuotes = false;
+    size_t pos = 0;
+    while (pos < word.size()) {
+        char c = word[pos];
+        if (c == '\\' && pos + 1 < word.size()) {
+            if (pattern && !inQuotes) {
+                field += c;
+                field += word[pos + 1];
+            }
+            else {
+                appendLiteral(field, std::string_view(&word[pos + 1], 1));
+            }
+            pos += 2;
+            started = true;
+        }
+        else if (c == '$' && pos + 1 < word.size() && word[pos + 1] == '(') {
+            size_t length = lexscan::findSubstitutionEnd(word.data() + pos, word.size() - pos);
+            size_t inner = word[pos + length - 1] == ')' && length > 2 ? length - 3 : length - 2;
+            std::string output = substitute(std::string_view(word).substr(pos + 2, inner));
+            pos += length;
+
+            if (inQuotes || !split) {
+                appendLiteral(field, output);
+                started = true;
+                continue;
+            }
+
+            // Unquoted output is split into fields at blanks and newlines
+            size_t at = 0;
+            while (at < output.size()) {
+                size_t blank = output.find_first_of(" \t\n", at);
+                if (blank == at) {
+                    if (started) {
+                        words.push_back(std::move(field));
+                        field.clear();
+                        started = false;
+                    }
+                    ++at;
+                    continue;
+                }
+                if (blank == std::string::npos) {
+                    blank = output.size();
+                }
+                appendLiteral(field, std::string_view(output).substr(at, blank - at));
+                started = true;
+                at = blank;
+            }
+        }
+        else if (c == '"') {
+            inQuotes = !inQuotes;
+            started = true;
+            ++pos;
+        }
+        else if (c == '\'' && !inQuotes) {
+            size_t close = word.find('\'', pos + 1);
+            if (close == std::string::npos) {
+                close = word.size();
+            }
+            appendLiteral(field, std::string_view(word).substr(pos + 1, close - pos - 1));
+            pos = std::min(close + 1, word.size());
+            started = true;
+        }
+        else {
+            if (inQuotes) {
+                appendLiteral(field, std::string_view(&word[pos], 1));
+            }
+            else {
+                field += c;
+            }
+            started = true;
+            ++pos;
+        }
+    }
+    if (started) {
+        words.push_back(std::move(field));
+    }
+
+    for (auto& expanded : words) {
+        if (pattern) {
+            expandPattern(expanded, fields);
+        }
+        else {
+            fields.push_back(std::move(expanded));
+        }
+    }
+}
+
+void Executor::expandPattern(const std::string& pattern, std::vector<std::string>& fields) {
+    // A pattern that matches nothing is kept as written, minus its escapes.
+    // The lock is held only here: a substitution runs commands that may
+    // expand patterns of their own.
+    std::lock_guard<std::mutex> lock(m_globMutex);
+    size_t first = fields.size();
+    if (!m_glob.expand(pattern, fields)) {
+        fields.resize(first);
+        fields.push_back(GlobExpander::unescape(pattern));
+    }
+}
+
+std::string Executor::substitute(std::string_view source) {
+    stats::count(stats::Counter::SUBSTITUTIONS);
+    std::string output;
+
+    // The commands are parsed into an arena of their own, one per line
+    CommandArena arena;
+    std::vector<Command> commands;
+    try {
+        Parser parser(source);
+        Command command;
+        while (parser.parseNext(arena, command)) {
+            commands.push_back(command);
+        }
+    }
+    catch (const ParseError& e) {
+        std::cerr << config::SHELL_NAME << ": $(...): " << e.what() << std::endl;
+        return output;
+    }
+    if (commands.empty()) {
+        return output;
+    }
+
+    // Output is captured from the write end of a pipe, except for builtins
+    IoFds fds;
+    int pipeFds[2] = { -1, -1 };
+    const Command& only = commands[0];
+    bool simple = commands.size() == 1 && only.getType() == CommandType::SIMPLE && !only.isBackground();
+
+    if (simple) {
+        SimpleCommand storage;
+        const SimpleCommand& command = expandWords(only.getCommand(), storage);
+        BuiltinId builtin = builtinFor(command);
+
+        // Builtins run here into a string, as a subshell would: variables
+        // set go to an overlay dropped afterwards. Those that act on state
+        // an overlay does not cover are refused below.
+        if (builtin != BuiltinId::NONE && !changesShell(builtin)) {
+            Environment overlay(&environment());
+            for (const auto& assignment : command.getAssignments()) {
+                overlay.assign(assignment, true);
+            }
+            EnvironmentScope scope(overlay);
+            fds.out = -1;
+            executeBuiltin(builtin, command, fds, true, &output);
+        }
+        else if (builtin == BuiltinId::NONE) {
+            if (!pipeio::makePipe(pipeFds, config::SUBSTITUTION_PIPE_SIZE)) {
+                std::cerr << config::SHELL_NAME << ": pipe: " << std::strerror(errno) << std::endl;
+                return output;
+            }
+            fds.out = pipeFds[1];
+            int failureStatus = 0;
+            pid_t pid = launch(command, fds, failureStatus);
+            close(pipeFds[1]);
+            pipeio::readAll(pipeFds[0], output, config::SUBSTITUTION_READ_SIZE);
+            close(pipeFds[0]);
+            if (pid > 0) {
+                waitFor(pid);
+            }
+        }
+        else {
+            simple = false;
+        }
+    }
+
+    // Anything else runs here too, on the pipeline and relay machinery, as
+    // a subshell would: variables go to an overlay, builtins that change
+    // the shell are refused and `exit` ends only the substitution. A helper
+    // thread drains the output meanwhile, so a full pipe never stalls it.
+    if (!simple) {
+        if (!pipeio::makePipe(pipeFds, config::SUBSTITUTION_PIPE_SIZE)) {
+            std::cerr << config::SHELL_NAME << ": pipe: " << std::strerror(errno) << std::endl;
+            return output;
+        }
+        int readFd = pipeFds[0];
+        std::thread reader([&output, readFd]() {
+            pipeio::readAll(readFd, output, config::SUBSTITUTION_READ_SIZE);
+        });
+
+        Environment overlay(&environment());
+        EnvironmentScope scope(overlay);
+        bool inSubstitution = t_inSubstitution;
+        t_inSubstitution = true;
+        fds.out = pipeFds[1];
+        for (const auto& command : commands) {
+            if (command.isBackground()) {
+                executeBackground(command);
+            }
+            else {
+                executeNode(command, fds);
+            }
+            if (m_exitRequested) {
+                m_exitRequested = false;
+                break;
+            }
+        }
+        t_inSubstitution = inSubstitution;
+
+        close(pipeFds[1]);
+        reader.join();
+        close(readFd);
+    }
+
+    while (!output.empty() && output.back() == '\n') {
+        output.pop_back();
+    }
+    return output;
+}
+
+int Executor::assignVariables(const SimpleCommand& command, const IoFds& fds) {
+    // Redirections are still carried out: `FOO=1 > file` creates file
+    IoFds unused = fds;
+    std::vector<int> opened;
+    bool ok = openRedirections(command, unused, opened);
+    for (int fd : opened) {
+        close(fd);
+    }
+    if (!ok) {
+        return 1;
+    }
+
+    for (const auto& assignment : command.getAssignments()) {
+        environment().assign(assignment, false);
+    }
+    return 0;
+}
+
+Environment& Executor::environment() {
+    return t_environment != nullptr ? *t_environment : m_environment;
+}
+
+bool Executor::findCommand(const std::string& name, const Environment& env, bool forget,
+    std::string& path) {
+    // The hash follows the shell's own PATH. An overlay that changes it,
+    // for PATH=/opt/bin cmd or in a subshell, is searched directly; one
+    // that leaves PATH alone hands back the very same variable.
+    if (&env != &m_environment) {
+        const std::string* pathValue = env.get("PATH");
+        const std::string* shellPath = m_environment.get("PATH");
+        if (pathValue != shellPath &&
+            (pathValue == nullptr || shellPath == nullptr || *pathValue != *shellPath)) {
+            return CommandHash::searchPath(pathValue != nullptr ? pathValue->c_str() : nullptr, name, path);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_hashMutex);
+    if (forget) {
+        m_commandHash.remove(name);
+    }
+
+    const std::string* found = m_commandHash.lookup(name);
+    if (found == nullptr) {
+        return false;
+    }
+    path = *found;
+    return true;
+}
+
+int Executor::waitFor(pid_t pid, struct rusage* usage) {
+    int status = 0;
+    while (wait4(pid, &status, 0, usage) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+    return ProcessSpawner::exitStatus(status);
+}
+
+bool Executor::cachingRedirections() const {
+    return m_options.redirectCache && !t_inJob;
+}
+
+bool Executor::cachedRedirections(const SimpleCommand& command, std::vector<int>& fds) {
+    const std::vector<Redirection>& redirections = command.getRedirections();
+    bool any = false;
+    fds.assign(redirections.size(), -1);
+    for (size_t i = 0; i < redirections.size(); ++i) {
+        fds[i] = m_redirects.acquire(redirections[i].target, redirections[i].type);
+        any = any || fds[i] >= 0;
+    }
+    return any;
+}
+
+bool Executor::openRedirections(const SimpleCommand& command, IoFds& fds, std::vector<int>& opened,
+    bool cached) {
+    for (const auto& redir : command.getRedirections()) {
+        int kept = cached ? m_redirects.acquire(redir.target, redir.type) : -1;
+        if (kept >= 0) {
+            if (redir.type == RedirectType::APPEND) {
+                fds.out = kept;
+            }
+            else {
+                fds.in = kept;
+            }
+            continue;
+        }
+
+        int fd = openRedirection(redir);
+        if (fd < 0) {
+            return false;
+        }
+
+        opened.push_back(fd);
+        if (redir.type == RedirectType::OUTPUT || redir.type == RedirectType::APPEND) {
+            fds.out = fd;
+        }
+        else {
+            fds.in = fd;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,192 @@
+// Executor.h - Command execution engine
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "Builtins.h"
+#include "Command.h"
+#include "CommandHash.h"
+#include "Completion.h"
+#include "Environment.h"
+#include "Glob.h"
+#include "HistoryStore.h"
+#include "JobControl.h"
+#include "JobOutput.h"
+#include "ProcessSpawner.h"
+#include "RedirectCache.h"
+#include "ShellOptions.h"
+#include <atomic>
+#include <sys/resource.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class Executor {
+public:
+    // Options set with the `shopt` builtin
+    ShellOptions& options() { return m_options; }
+
+    // History served by the `history` builtin (none until set)
+    void setHistory(HistoryStore* history) { m_history = history; }
+
+    // Execute a parsed command tree and return its exit status
+    int execute(const Command& command);
+
+    // While a script runs, files redirected to are kept open between
+    // execute() calls rather than only within one; endScript() closes them
+    void beginScript() { ++m_scriptDepth; }
+    void endScript();
+
+    // Collect finished background jobs without blocking and report them
+    void reapBackground();
+
+    // Whether the `exit` builtin has run; execute() then returns its status
+    bool exitRequested() const { return m_exitRequested; }
+
+    // Completions of word: command names in command position, else paths
+    void complete(std::string_view word, bool commandPosition, std::vector<CompletionIndex::Match>& out);
+
+    // Execute a node as a job of the `parallel` builtin and wait for it.
+    // Safe to call from several threads at once: builtins on the shell's
+    // jobs, options or history fail in a job with status 2, and `exit`
+    // ends only the job.
+    int executeJob(const Command& command, const IoFds& fds);
+
+private:
+    // A pipeline stage the shell runs itself on a helper thread
+    struct Relay {
+        std::thread thread;
+        int status = 0;
+    };
+
+    // Execute a node with the given stdio and wait for it to finish,
+    // recording a trace span for it when tracing
+    int executeNode(const Command& command, const IoFds& fds);
+
+    // Run a node by type
+    int dispatchNode(const Command& command, const IoFds& fds);
+
+    // Execute a node without waiting; returns immediately
+    void executeBackground(const Command& command);
+
+    // Start a new shell running source with the given stdio, reporting a
+    // failure; returns its pid or -1
+    pid_t spawnShell(const std::string& source, const IoFds& fds);
+
+    // Whether a pipeline has a stage the shell runs itself
+    bool hasRelayStage(const Command& command);
+
+    // Per-node-type execution
+    int executeSimple(const SimpleCommand& command, const IoFds& fds);
+    int executePipeline(const Command& command, const IoFds& fds, bool wait);
+
+    // The command with its substitutions and pattern words expanded into
+    // storage, or the command itself when it has none
+    const SimpleCommand& expandWords(const SimpleCommand& command, SimpleCommand& storage);
+
+    // Expand one word with the given WordFlag bits into fields. Unquoted
+    // substitution output is split into fields when split is set.
+    void expandWord(const std::string& word, std::uint8_t flags, bool split,
+        std::vector<std::string>& fields);
+
+    // Append the paths a pattern matches, or the pattern minus its escapes
+    // when it matches none
+    void expandPattern(const std::string& pattern, std::vector<std::string>& fields);
+
+    // Run the commands of a $(...) and return their output without its
+    // trailing newlines
+    std::string substitute(std::string_view source);
+
+    // Run a command made only of NAME=value words
+    int assignVariables(const SimpleCommand& command, const IoFds& fds);
+
+    // Run a builtin in-process. In a subshell (a pipeline stage) `exit`
+    // only ends the stage. With capture given, output the command does not
+    // redirect is appended to it rather than written to fds.out.
+    int executeBuiltin(BuiltinId id, const SimpleCommand& command, const IoFds& fds, bool subshell,
+        std::string* capture = nullptr);
+
+    // Run a builtin pipeline stage on a helper thread. The relay closes the
+    // descriptors in owned when it finishes.
+    std::unique_ptr<Relay> startBuiltin(BuiltinId id, const SimpleCommand& command, const IoFds& fds,
+        std::vector<int> owned);
+
+    // Run a `tee` stage in-process, fanning the pipe out with tee/splice.
+    // The relay closes the descriptors in owned when it finishes.
+    std::unique_ptr<Relay> startTee(const SimpleCommand& command, const IoFds& fds,
+        std::vector<int> owned);
+
+    // Collect the stages of a pipeline in execution order
+    void collectStages(const Command& command, std::vector<const SimpleCommand*>& stages);
+
+    // Spawn a command, reporting failures the way other shells do. openFds
+    // holds descriptors already open for its redirections (-1 for the
+    // rest); the others are opened in the shell before the spawn.
+    pid_t launch(const SimpleCommand& command, const IoFds& fds, int& failureStatus,
+        const std::vector<int>* openFds = nullptr);
+
+    // Whether this thread may use the redirection cache: commands that run
+    // one at a time on the shell's own thread, with the option on
+    bool cachingRedirections() const;
+
+    // Cached descriptors for a command's redirections, -1 for those to be
+    // opened as usual; false if none is cached
+    bool cachedRedirections(const SimpleCommand& command, std::vector<int>& fds);
+
+    // Environment commands on this thread see: a parallel job's or a
+    // per-command overlay while one is in effect, else the shell's own
+    Environment& environment();
+
+    // Look a command up in the hash, first forgetting it if asked to. When
+    // env sets a PATH of its own, that PATH is searched instead.
+    bool findCommand(const std::string& name, const Environment& env, bool forget, std::string& path);
+
+    // Wait for a child and return its shell exit status; usage, if given,
+    // receives what the child used
+    int waitFor(pid_t pid, struct rusage* usage = nullptr);
+
+    // Open a command's redirections in the shell for commands that run
+    // in-process; opened descriptors are appended to opened, while those
+    // taken from the redirection cache (when cached is set) are not
+    bool openRedirections(const SimpleCommand& command, IoFds& fds, std::vector<int>& opened,
+        bool cached = false);
+
+    // Resolved PATH lookups and the completion index built over the same
+    // PATH; the mutex serializes access from parallel jobs
+    CommandHash m_commandHash;
+    CompletionIndex m_completion;
+    std::mutex m_hashMutex;
+
+    // Runtime options
+    ShellOptions m_options;
+
+    // Shell variables and the environment of started programs
+    Environment m_environment;
+
+    // Pathname expansion; the mutex serializes it between parallel jobs
+    GlobExpander m_glob;
+    std::mutex m_globMutex;
+
+    // Descriptors of repeated >> and < redirections, kept for one command
+    // line, or for a whole script while m_scriptDepth is non-zero
+    RedirectCache m_redirects;
+    int m_scriptDepth = 0;
+
+    // Background jobs and their captured output
+    JobControl m_jobs;
+    JobOutput m_jobOutput;
+
+    // Shell history, owned by the shell
+    HistoryStore* m_history = nullptr;
+
+    // Status of the last command run, for `exit` without an argument
+    std::atomic<int> m_lastStatus{ 0 };
+
+    // Set by `exit`; stops the rest of the command list
+    bool m_exitRequested = false;
+};
+
+#endif // EXECUTOR_H
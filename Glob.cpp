@@ -0,0 +1,581 @@
+// Glob.cpp - Pathname expansion implementation
+
+#include "Glob.h"
+#include "ShellConfig.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+    // Record layout getdents64 fills the buffer with
+    struct LinuxDirent64 {
+        std::uint64_t d_ino;
+        std::int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    // Whether c belongs to a [:name:] character class
+    bool inClass(const std::string& name, int c) {
+        if (name == "alpha") return std::isalpha(c) != 0;
+        if (name == "digit") return std::isdigit(c) != 0;
+        if (name == "alnum") return std::isalnum(c) != 0;
+        if (name == "upper") return std::isupper(c) != 0;
+        if (name == "lower") return std::islower(c) != 0;
+        if (name == "space") return std::isspace(c) != 0;
+        if (name == "blank") return c == ' ' || c == '\t';
+        if (name == "punct") return std::ispunct(c) != 0;
+        if (name == "xdigit") return std::isxdigit(c) != 0;
+        if (name == "cntrl") return std::iscntrl(c) != 0;
+        if (name == "print") return std::isprint(c) != 0;
+        if (name == "graph") return std::isgraph(c) != 0;
+        return false;
+    }
+}
+
+GlobPattern::GlobPattern(std::string_view text)
+    : m_prefixLength(0), m_suffixOffset(0), m_suffixLength(0), m_minLength(0),
+    m_literal(true), m_hidden(false) {
+    std::string run;
+    auto flushRun = [this, &run]() {
+        if (!run.empty()) {
+            m_ops.push_back({ OpKind::LITERAL, static_cast<std::uint32_t>(m_literals.size()),
+                static_cast<std::uint32_t>(run.size()) });
+            m_literals += run;
+            m_minLength += run.size();
+            run.clear();
+        }
+    };
+
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '\\' && i + 1 < text.size()) {
+            run += text[++i];
+            continue;
+        }
+
+        if (c == '*') {
+            flushRun();
+            if (m_ops.empty() || m_ops.back().kind != OpKind::STAR) {
+                m_ops.push_back({ OpKind::STAR, 0, 0 });
+            }
+            m_literal = false;
+            continue;
+        }
+
+        if (c == '?') {
+            flushRun();
+            m_ops.push_back({ OpKind::ANY, 0, 1 });
+            ++m_minLength;
+            m_literal = false;
+            continue;
+        }
+
+        CharSet set = {};
+        size_t end = 0;
+        if (c == '[' && parseSet(text, i, set, end)) {
+            flushRun();
+            m_ops.push_back({ OpKind::SET, static_cast<std::uint32_t>(m_sets.size()), 1 });
+            m_sets.push_back(set);
+            ++m_minLength;
+            m_literal = false;
+            i = end;
+            continue;
+        }
+
+        run += c;
+    }
+    flushRun();
+
+    // Consecutive literals were merged, so the prefix and suffix are at
+    // most one operation each
+    if (!m_ops.empty() && m_ops.front().kind == OpKind::LITERAL) {
+        m_prefixLength = m_ops.front().length;
+        m_hidden = m_literals[0] == '.';
+    }
+    if (m_ops.size() > 1 && m_ops.back().kind == OpKind::LITERAL) {
+        m_suffixOffset = m_ops.back().index;
+        m_suffixLength = m_ops.back().length;
+    }
+}
+
+bool GlobPattern::matches(std::string_view name) const {
+    if (name.size() < m_minLength) {
+        return false;
+    }
+    if (m_prefixLength > 0 && std::memcmp(name.data(), m_literals.data(), m_prefixLength) != 0) {
+        return false;
+    }
+    if (m_suffixLength > 0 && std::memcmp(name.data() + name.size() - m_suffixLength,
+        m_literals.data() + m_suffixOffset, m_suffixLength) != 0) {
+        return false;
+    }
+
+    // Every operation but * has a fixed width, so on a mismatch it is
+    // enough to let the most recent * absorb one more character
+    size_t op = 0;
+    size_t pos = 0;
+    size_t starOp = m_ops.size();
+    size_t starPos = 0;
+    while (pos < name.size()) {
+        if (op < m_ops.size()) {
+            const Op& current = m_ops[op];
+            switch (current.kind) {
+            case OpKind::STAR:
+                starOp = op++;
+                starPos = pos;
+                continue;
+
+            case OpKind::ANY:
+                ++op;
+                ++pos;
+                continue;
+
+            case OpKind::SET: {
+                auto c = static_cast<unsigned char>(name[pos]);
+                if ((m_sets[current.index][c >> 6] >> (c & 63)) & 1) {
+                    ++op;
+                    ++pos;
+                    continue;
+                }
+                break;
+            }
+
+            case OpKind::LITERAL:
+                if (name.size() - pos >= current.length &&
+                    std::memcmp(name.data() + pos, m_literals.data() + current.index, current.length) == 0) {
+                    ++op;
+                    pos += current.length;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        if (starOp == m_ops.size()) {
+            return false;
+        }
+        op = starOp + 1;
+        pos = ++starPos;
+    }
+
+    while (op < m_ops.size() && m_ops[op].kind == OpKind::STAR) {
+        ++op;
+    }
+    return op == m_ops.size();
+}
+
+bool GlobPattern::parseSet(std::string_view text, size_t start, CharSet& set, size_t& end) {
+    size_t i = start + 1;
+    bool negate = i < text.size() && (text[i] == '!' || text[i] == '^');
+    if (negate) {
+        ++i;
+    }
+
+    auto add = [&set](unsigned char c) {
+        set[c >> 6] |= std::uint64_t(1) << (c & 63);
+    };
+
+    // A ] right after the opening bracket is a member, not the end
+    for (bool first = true; i < text.size(); first = false) {
+        char c = text[i];
+        if (c == ']' && !first) {
+            if (negate) {
+                for (auto& word : set) {
+                    word = ~word;
+                }
+            }
+            end = i;
+            return true;
+        }
+
+        if (c == '[' && i + 1 < text.size() && text[i + 1] == ':') {
+            size_t close = text.find(":]", i + 2);
+            if (close != std::string_view::npos) {
+                std::string name(text.substr(i + 2, close - i - 2));
+                for (int member = 0; member < 256; ++member) {
+                    if (inClass(name, member)) {
+                        add(static_cast<unsigned char>(member));
+                    }
+                }
+                i = close + 2;
+                continue;
+            }
+        }
+
+        if (c == '\\' && i + 1 < text.size()) {
+            c = text[++i];
+        }
+
+        // Ranges, with an escaped upper bound allowed
+        if (i + 2 < text.size() && text[i + 1] == '-' && text[i + 2] != ']') {
+            size_t high = i + 2;
+            if (text[high] == '\\' && high + 1 < text.size()) {
+                ++high;
+            }
+            auto low = static_cast<unsigned char>(c);
+            auto top = static_cast<unsigned char>(text[high]);
+            for (unsigned member = low; member <= top; ++member) {
+                add(static_cast<unsigned char>(member));
+            }
+            i = high + 1;
+            continue;
+        }
+
+        add(static_cast<unsigned char>(c));
+        ++i;
+    }
+    return false;
+}
+
+GlobExpander::GlobExpander() : m_expansion(0), m_caching(false) {}
+
+bool GlobExpander::expand(const std::string& pattern, std::vector<std::string>& out) {
+    std::vector<Component> components;
+    bool literal = true;
+    size_t pos = 0;
+    std::string prefix;
+    if (!pattern.empty() && pattern[0] == '/') {
+        prefix = "/";
+        pos = pattern.find_first_not_of('/');
+        if (pos == std::string::npos) {
+            return false;
+        }
+    }
+
+    while (pos <= pattern.size()) {
+        size_t slash = pattern.find('/', pos);
+        if (slash == std::string::npos) {
+            slash = pattern.size();
+        }
+        std::string_view text(pattern.data() + pos, slash - pos);
+        components.push_back({ GlobPattern(text), text == "**" });
+        literal = literal && components.back().pattern.isLiteral();
+        pos = slash + 1;
+    }
+
+    // Nothing to match: the word stands for itself
+    if (literal) {
+        return false;
+    }
+
+    // With every directory above the last component spelled out, the
+    // walk visits one directory and its sorted matches are the result
+    bool ordered = true;
+    for (size_t i = 0; i + 1 < components.size(); ++i) {
+        ordered = ordered && components[i].pattern.isLiteral() && !components[i].globstar;
+    }
+
+    size_t first = out.size();
+    ++m_expansion;
+    walk(components, 0, prefix, out);
+    if (!m_caching) {
+        m_cache.clear();
+    }
+    if (out.size() == first) {
+        return false;
+    }
+
+    // Otherwise each directory's matches came out in order, which is the
+    // order of the full paths unless a directory name is a prefix of
+    // another followed by a character sorting before /
+    auto begin = out.begin() + static_cast<std::ptrdiff_t>(first);
+    if (!ordered && !std::is_sorted(begin, out.end())) {
+        std::sort(begin, out.end());
+    }
+    return true;
+}
+
+std::string GlobExpander::unescape(std::string_view pattern) {
+    std::string text;
+    text.reserve(pattern.size());
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+            ++i;
+        }
+        text += pattern[i];
+    }
+    return text;
+}
+
+void GlobExpander::setCaching(bool caching) {
+    m_caching = caching;
+    if (!caching) {
+        m_cache.clear();
+    }
+}
+
+void GlobExpander::clearCache() {
+    if (!m_cache.empty()) {
+        m_cache.clear();
+    }
+}
+
+void GlobExpander::walk(const std::vector<Component>& components, size_t index, std::string& prefix,
+    std::vector<std::string>& out) {
+    const Component& component = components[index];
+    bool last = index + 1 == components.size();
+    size_t mark = prefix.size();
+
+    if (component.globstar) {
+        walkGlobstar(components, index, prefix, out);
+        return;
+    }
+
+    // Literal components are appended without listing anything; whether
+    // the path exists is only asked once, at the end
+    if (component.pattern.isLiteral()) {
+        prefix += component.pattern.literal();
+        if (last) {
+            struct stat info;
+            bool isDir = !prefix.empty() && prefix.back() == '/';
+            if ((isDir ? stat(prefix.c_str(), &info) : lstat(prefix.c_str(), &info)) == 0) {
+                out.push_back(prefix);
+            }
+        }
+        else {
+            prefix += '/';
+            walk(components, index + 1, prefix, out);
+        }
+        prefix.resize(mark);
+        return;
+    }
+
+    Listing* listing = list(prefix);
+    if (listing == nullptr) {
+        return;
+    }
+
+    const GlobPattern& pattern = component.pattern;
+    std::vector<const Entry*> matched = select(*listing, [&pattern](std::string_view name) {
+        if (name[0] == '.' && (!pattern.matchesHidden() || name == "." || name == "..")) {
+            return false;
+        }
+        return pattern.matches(name);
+    });
+
+    for (const Entry* match : matched) {
+        const Entry& entry = *match;
+        std::string_view name = listing->name(entry);
+        prefix.append(name.data(), name.size());
+        if (last) {
+            out.push_back(prefix);
+        }
+        else if (isDirectory(prefix, entry.type, true)) {
+            prefix += '/';
+            walk(components, index + 1, prefix, out);
+        }
+        prefix.resize(mark);
+    }
+}
+
+void GlobExpander::walkGlobstar(const std::vector<Component>& components, size_t index, std::string& prefix,
+    std::vector<std::string>& out) {
+    bool last = index + 1 == components.size();
+    size_t mark = prefix.size();
+
+    // Zero directories: the rest of the pattern applies right here
+    if (!last) {
+        walk(components, index + 1, prefix, out);
+    }
+
+    Listing* listing = list(prefix);
+    if (listing == nullptr) {
+        return;
+    }
+
+    std::vector<const Entry*> visible = select(*listing, [](std::string_view name) {
+        return name[0] != '.';
+    });
+
+    // Symbolic links are not followed, so the walk cannot loop
+    for (const Entry* match : visible) {
+        const Entry& entry = *match;
+        std::string_view name = listing->name(entry);
+        prefix.append(name.data(), name.size());
+        if (last) {
+            out.push_back(prefix);
+        }
+        if (isDirectory(prefix, entry.type, false)) {
+            prefix += '/';
+            walkGlobstar(components, index, prefix, out);
+        }
+        prefix.resize(mark);
+    }
+}
+
+GlobExpander::Listing* GlobExpander::list(const std::string& directory) {
+    const char* path = directory.empty() ? "." : directory.c_str();
+
+    // A listing read earlier in this expansion is used as is. One from an
+    // earlier expansion costs a stat to revalidate and is only ever
+    // replaced between expansions, never while a walk holds it.
+    std::unique_ptr<Listing>& cached = m_cache[directory];
+    if (cached) {
+        struct stat info;
+        if (cached->expansion == m_expansion ||
+            (stat(path, &info) == 0 && info.st_dev == cached->device && info.st_ino == cached->inode &&
+                info.st_mtim.tv_sec == cached->modified.tv_sec &&
+                info.st_mtim.tv_nsec == cached->modified.tv_nsec)) {
+            cached->expansion = m_expansion;
+            return cached.get();
+        }
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        m_cache.erase(directory);
+        return nullptr;
+    }
+
+    auto listing = std::make_unique<Listing>();
+    listing->expansion = m_expansion;
+    struct stat info;
+    if (fstat(fd, &info) == 0) {
+        listing->device = info.st_dev;
+        listing->inode = info.st_ino;
+        listing->modified = info.st_mtim;
+    }
+    bool ok = readDirectory(fd, *listing);
+    close(fd);
+    if (!ok) {
+        m_cache.erase(directory);
+        return nullptr;
+    }
+
+    cached = std::move(listing);
+    return cached.get();
+}
+
+bool GlobExpander::readDirectory(int fd, Listing& listing) {
+#if defined(__linux__) && defined(SYS_getdents64)
+    if (m_buffer.empty()) {
+        m_buffer.resize(config::GLOB_READ_BUFFER);
+    }
+
+    while (true) {
+        long bytes = syscall(SYS_getdents64, fd, m_buffer.data(), m_buffer.size());
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            return false;
+        }
+        if (bytes == 0) {
+            return true;
+        }
+
+        for (long pos = 0; pos < bytes;) {
+            const char* record = m_buffer.data() + pos;
+            unsigned short length = 0;
+            std::memcpy(&length, record + offsetof(LinuxDirent64, d_reclen), sizeof(length));
+            const char* name = record + offsetof(LinuxDirent64, d_name);
+            size_t nameLength = std::strlen(name);
+
+            listing.entries.push_back({ static_cast<std::uint32_t>(listing.names.size()),
+                static_cast<std::uint16_t>(nameLength),
+                static_cast<std::uint8_t>(record[offsetof(LinuxDirent64, d_type)]) });
+            listing.names.insert(listing.names.end(), name, name + nameLength);
+            pos += length;
+        }
+    }
+#else
+    int copy = dup(fd);
+    DIR* dir = copy >= 0 ? fdopendir(copy) : nullptr;
+    if (dir == nullptr) {
+        if (copy >= 0) {
+            close(copy);
+        }
+        return false;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        size_t nameLength = std::strlen(entry->d_name);
+        listing.entries.push_back({ static_cast<std::uint32_t>(listing.names.size()),
+            static_cast<std::uint16_t>(nameLength), static_cast<std::uint8_t>(entry->d_type) });
+        listing.names.insert(listing.names.end(), entry->d_name, entry->d_name + nameLength);
+    }
+    closedir(dir);
+    return true;
+#endif
+}
+
+void GlobExpander::sortByName(const Listing& listing, std::vector<const Entry*>& entries) {
+    // Sorting the short names beats sorting the paths built from them,
+    // which share the whole directory prefix. The first eight bytes of
+    // each name, big-endian, settle most comparisons without a memcmp.
+    std::vector<std::pair<std::uint64_t, const Entry*>> keyed;
+    keyed.reserve(entries.size());
+    for (const Entry* entry : entries) {
+        std::uint64_t key = 0;
+        const char* name = listing.names.data() + entry->offset;
+        for (size_t i = 0; i < 8; ++i) {
+            key = (key << 8) | (i < entry->length ? static_cast<unsigned char>(name[i]) : 0u);
+        }
+        keyed.emplace_back(key, entry);
+    }
+
+    std::sort(keyed.begin(), keyed.end(), [&listing](const auto& a, const auto& b) {
+        if (a.first != b.first) {
+            return a.first < b.first;
+        }
+        return listing.name(*a.second) < listing.name(*b.second);
+    });
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        entries[i] = keyed[i].second;
+    }
+}
+
+template <typename Select>
+std::vector<const GlobExpander::Entry*> GlobExpander::select(Listing& listing, Select keep) {
+    if (m_caching && !listing.sorted) {
+        std::vector<const Entry*> all;
+        all.reserve(listing.entries.size());
+        for (const Entry& entry : listing.entries) {
+            all.push_back(&entry);
+        }
+        sortByName(listing, all);
+
+        std::vector<Entry> ordered;
+        ordered.reserve(all.size());
+        for (const Entry* entry : all) {
+            ordered.push_back(*entry);
+        }
+        listing.entries = std::move(ordered);
+        listing.sorted = true;
+    }
+
+    std::vector<const Entry*> selected;
+    for (const Entry& entry : listing.entries) {
+        if (keep(listing.name(entry))) {
+            selected.push_back(&entry);
+        }
+    }
+    if (!listing.sorted) {
+        sortByName(listing, selected);
+    }
+    return selected;
+}
+
+bool GlobExpander::isDirectory(const std::string& path, std::uint8_t type, bool followLinks) {
+    if (type == DT_DIR) {
+        return true;
+    }
+    if (type != DT_UNKNOWN && (type != DT_LNK || !followLinks)) {
+        return false;
+    }
+
+    struct stat info;
+    int rc = followLinks ? stat(path.c_str(), &info) : lstat(path.c_str(), &info);
+    return rc == 0 && S_ISDIR(info.st_mode);
+}
@@ -0,0 +1,165 @@
+// Glob.h - Pathname expansion
+
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// One path component of a pattern (*, ?, [...] and backslash escapes),
+// compiled once into a sequence of match operations.
+//
+// Runs of literal characters become single operations, bracket
+// expressions become 256-bit sets, and a literal prefix, a literal suffix
+// and a minimum length are pulled out so most non-matching names are
+// rejected before the matcher runs.
+class GlobPattern {
+public:
+    explicit GlobPattern(std::string_view text);
+
+    // Whether the pattern has no wildcards; literal() is then the name it
+    // stands for
+    bool isLiteral() const { return m_literal; }
+    const std::string& literal() const { return m_literals; }
+
+    // Whether the pattern starts with a literal '.', the only way a
+    // hidden name can match
+    bool matchesHidden() const { return m_hidden; }
+
+    bool matches(std::string_view name) const;
+
+private:
+    enum class OpKind : std::uint8_t {
+        LITERAL,    // m_literals[index, index + length)
+        ANY,        // ?
+        STAR,       // *
+        SET         // m_sets[index]
+    };
+
+    struct Op {
+        OpKind kind;
+        std::uint32_t index;
+        std::uint32_t length;
+    };
+
+    using CharSet = std::array<std::uint64_t, 4>;
+
+    // Parse the bracket expression at text[start]; false when it is not
+    // closed, in which case the [ is an ordinary character
+    static bool parseSet(std::string_view text, size_t start, CharSet& set, size_t& end);
+
+    std::vector<Op> m_ops;
+    std::string m_literals;
+    std::vector<CharSet> m_sets;
+    size_t m_prefixLength;      // Literal prefix: m_literals[0, length)
+    size_t m_suffixOffset;      // Literal suffix: m_literals[offset, offset + length)
+    size_t m_suffixLength;
+    size_t m_minLength;
+    bool m_literal;
+    bool m_hidden;
+};
+
+// Expands pathname patterns against the filesystem.
+//
+// A pattern is split into components. Literal components are never listed:
+// the walk just appends them to the path, and a fully literal tail is
+// checked with one lstat at the end. Wildcard components list their
+// directory with getdents64 into a large buffer, so a directory of 100,000
+// entries takes a handful of system calls, and the listing lands in one
+// flat name block. A component that is exactly ** matches any number of
+// directories. Names starting with '.' only match a pattern that starts
+// with a literal '.', and . and .. never match.
+//
+// Within one expansion a directory is read at most once, which matters for
+// ** where every level is visited both as a match and as a parent. With
+// caching on, listings are also kept across expansions until clearCache()
+// (the executor clears them once per command line) and reread when the
+// directory's modification time changes.
+class GlobExpander {
+public:
+    GlobExpander();
+
+    GlobExpander(const GlobExpander&) = delete;
+    GlobExpander& operator=(const GlobExpander&) = delete;
+
+    // Append the paths pattern matches, sorted, to out. Returns false and
+    // leaves out alone when nothing matches or the pattern has no wildcards.
+    bool expand(const std::string& pattern, std::vector<std::string>& out);
+
+    // A pattern with its escapes removed, which is what a pattern that
+    // matches nothing stands for
+    static std::string unescape(std::string_view pattern);
+
+    // Keep listings between expansions
+    void setCaching(bool caching);
+
+    // Forget cached listings
+    void clearCache();
+
+private:
+    struct Component {
+        GlobPattern pattern;
+        bool globstar;  // The component is **
+    };
+
+    struct Entry {
+        std::uint32_t offset;   // Into Listing::names
+        std::uint16_t length;
+        std::uint8_t type;      // DT_* value, DT_UNKNOWN if the fs gave none
+    };
+
+    struct Listing {
+        std::vector<char> names;
+        std::vector<Entry> entries;
+        dev_t device = 0;
+        ino_t inode = 0;
+        struct timespec modified = {};
+        std::uint64_t expansion = 0;    // Expansion it was read during
+        bool sorted = false;            // Entries are in name order
+
+        std::string_view name(const Entry& entry) const {
+            return std::string_view(names.data() + entry.offset, entry.length);
+        }
+    };
+
+    // Walk components[index...] below prefix ("" or ending in '/')
+    void walk(const std::vector<Component>& components, size_t index, std::string& prefix,
+        std::vector<std::string>& out);
+
+    // The ** component at index: zero or more directories below prefix
+    void walkGlobstar(const std::vector<Component>& components, size_t index, std::string& prefix,
+        std::vector<std::string>& out);
+
+    // Listing of a directory, from the cache or read now; nullptr if it
+    // cannot be read
+    Listing* list(const std::string& directory);
+
+    // Read every entry of an open directory
+    bool readDirectory(int fd, Listing& listing);
+
+    // Put entries of a listing in name order
+    static void sortByName(const Listing& listing, std::vector<const Entry*>& entries);
+
+    // Entries of a listing worth walking, in name order. A listing that is
+    // kept is sorted once and reused; otherwise only the selected entries
+    // are sorted.
+    template <typename Select>
+    std::vector<const Entry*> select(Listing& listing, Select keep);
+
+    // Whether path, an entry of the given type, is a directory
+    static bool isDirectory(const std::string& path, std::uint8_t type, bool followLinks);
+
+    std::unordered_map<std::string, std::unique_ptr<Listing>> m_cache;
+    std::vector<char> m_buffer;
+    std::uint64_t m_expansion;
+    bool m_caching;
+};
+
+#endif // GLOB_H
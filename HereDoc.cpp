@@ -0,0 +1,64 @@
+// HereDoc.cpp - In-memory files for here-documents and here-strings implementation
+
+#include "HereDoc.h"
+#include "PipeIO.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+    // Where memfd_create is missing, an unlinked temporary file stands in
+    int openTemporary() {
+        const char* directory = std::getenv("TMPDIR");
+        std::string path = std::string(directory != nullptr && *directory != '\0' ? directory : "/tmp")
+            + "/cppshell-heredoc-XXXXXX";
+        int fd = mkostemp(&path[0], O_CLOEXEC);
+        if (fd >= 0) {
+            unlink(path.c_str());
+        }
+        return fd;
+    }
+}
+
+namespace heredoc {
+
+    int open(std::string_view body, bool addNewline) {
+        int fd = -1;
+        bool sealable = false;
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+        fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        sealable = fd >= 0;
+#endif
+        if (fd < 0) {
+            fd = openTemporary();
+            if (fd < 0) {
+                return -1;
+            }
+        }
+
+        if (!pipeio::writeAll(fd, body.data(), body.size()) ||
+            (addNewline && !pipeio::writeAll(fd, "\n", 1))) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+
+#if defined(__linux__) && defined(F_ADD_SEALS)
+        if (sealable) {
+            fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL);
+        }
+#endif
+        (void)sealable;
+
+        lseek(fd, 0, SEEK_SET);
+        return fd;
+    }
+}
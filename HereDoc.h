@@ -0,0 +1,21 @@
+// HereDoc.h - In-memory files for here-documents and here-strings
+
+#ifndef HERE_DOC_H
+#define HERE_DOC_H
+
+#include <string_view>
+
+// Here-documents and here-strings are handed to commands as an anonymous
+// in-memory file rather than a temporary file on disk or a pipe. Nothing
+// touches the filesystem, a body of any size is written before the command
+// starts so there is no pipe to fill up, and the command gets a regular
+// file it may seek in or mmap. The file is sealed once written, so it
+// cannot change or grow under a reader.
+namespace heredoc {
+    // A close-on-exec descriptor positioned at the start of a file holding
+    // body, followed by a newline if asked (as a here-string is); -1 with
+    // errno set on failure
+    int open(std::string_view body, bool addNewline = false);
+}
+
+#endif // HERE_DOC_H
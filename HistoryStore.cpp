@@ -0,0 +1,618 @@
+// HistoryStore.cpp - Append-only command history implementation
+
+#include "HistoryStore.h"
+#include "PipeIO.h"
+#include "ShellConfig.h"
+#include "ShellStats.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unordered_map>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+    // Bump whenever the index layout changes
+    const std::uint32_t INDEX_VERSION = 1;
+    const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+    const char MAGIC[8] = { 'C', 'P', 'S', 'H', 'H', 'I', 'X', '\0' };
+
+    // Bytes at the end of the indexed region hashed to tell whether the log
+    // is still the one the index was built from
+    const size_t CHECK_BYTES = 4096;
+
+    // How often a rebuild hands consumed log pages back
+    const size_t RELEASE_CHECK_LINES = 4096;
+
+    struct IndexHeader {
+        char magic[8];
+        std::uint32_t byteOrder;
+        std::uint32_t version;
+        std::uint64_t logBytes;
+        std::uint64_t logCheck;
+        std::uint64_t entryCount;
+        std::uint64_t trigramCount;
+        std::uint64_t postingsSize;
+        std::uint64_t reserved;
+    };
+
+    // FNV-1a over the last CHECK_BYTES of the indexed region
+    std::uint64_t checkTail(const char* data, size_t size) {
+        size_t start = size > CHECK_BYTES ? size - CHECK_BYTES : 0;
+        std::uint64_t h = 0xCBF29CE484222325ULL;
+        for (size_t i = start; i < size; ++i) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 0x100000001B3ULL;
+        }
+        return h;
+    }
+
+    inline std::uint32_t trigramAt(const char* p) {
+        return (static_cast<std::uint32_t>(static_cast<unsigned char>(p[0])) << 16) |
+            (static_cast<std::uint32_t>(static_cast<unsigned char>(p[1])) << 8) |
+            static_cast<std::uint32_t>(static_cast<unsigned char>(p[2]));
+    }
+
+    // Distinct trigrams of a string, sorted
+    void collectTrigrams(std::string_view text, std::vector<std::uint32_t>& trigrams) {
+        trigrams.clear();
+        for (size_t i = 0; i + 3 <= text.size(); ++i) {
+            trigrams.push_back(trigramAt(text.data() + i));
+        }
+        std::sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    }
+
+    // Entries are stored one per line, so a newline in one is written as
+    // \n and a backslash as \\. Other backslash pairs, which logs written
+    // before escaping may hold, are read back as they are.
+    std::string escapeEntry(std::string_view text) {
+        std::string line;
+        line.reserve(text.size());
+        for (char c : text) {
+            if (c == '\n') {
+                line += "\\n";
+            }
+            else {
+                if (c == '\\') {
+                    line += '\\';
+                }
+                line += c;
+            }
+        }
+        return line;
+    }
+
+    std::string unescapeEntry(std::string_view line) {
+        std::string text;
+        text.reserve(line.size());
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == '\\' && i + 1 < line.size() && (line[i + 1] == 'n' || line[i + 1] == '\\')) {
+                text += line[++i] == 'n' ? '\n' : '\\';
+            }
+            else {
+                text += line[i];
+            }
+        }
+        return text;
+    }
+
+    // Postings are ascending entry ids stored as LEB128 gaps
+    void putVarint(std::string& out, std::uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+}
+
+HistoryStore::HistoryStore()
+    : m_indexedBytes(0), m_indexedCount(0), m_offsets(nullptr), m_trigrams(nullptr),
+    m_trigramCount(0), m_postings(nullptr), m_postingsSize(0), m_logFd(-1),
+    m_stopping(false) {}
+
+HistoryStore::~HistoryStore() {
+    close();
+}
+
+bool HistoryStore::open(const std::string& path) {
+    close();
+    stats::Scope scope(stats::Subsystem::HISTORY);
+
+    m_logFd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (m_logFd < 0 || !m_log.open(path)) {
+        int error = errno;
+        close();
+        errno = error;
+        return false;
+    }
+
+    m_path = path;
+    m_indexPath = path + config::HISTORY_INDEX_SUFFIX;
+    m_stopping = false;
+
+    // An index that is there but does not fit the log is rebuilt rather
+    // than waited on until the threshold
+    bool damagedIndex = false;
+    if (!loadIndex()) {
+        damagedIndex = !m_index.view().empty();
+        m_index.close();
+        m_indexedBytes = 0;
+        m_indexedCount = 0;
+        m_offsets = nullptr;
+    }
+    scanTail(m_indexedBytes);
+
+    // A log left without a final newline (say by a crash) gets one before
+    // anything is appended to it
+    std::string_view log = m_log.view();
+    if (!log.empty() && log.back() != '\n') {
+        pipeio::writeAll(m_logFd, "\n", 1);
+    }
+
+    // Started before the writer thread so the fork happens while the
+    // shell is still single-threaded
+    if (m_tail.size() >= config::HISTORY_REINDEX_THRESHOLD || (damagedIndex && !m_tail.empty())) {
+        startReindex();
+    }
+
+    m_writer = std::thread(&HistoryStore::writerLoop, this);
+    return true;
+}
+
+void HistoryStore::close() {
+    if (m_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_writer.join();
+    }
+
+    if (m_logFd >= 0) {
+        ::close(m_logFd);
+        m_logFd = -1;
+    }
+
+    m_log.close();
+    m_index.close();
+    m_indexedBytes = 0;
+    m_indexedCount = 0;
+    m_offsets = nullptr;
+    m_trigrams = nullptr;
+    m_trigramCount = 0;
+    m_postings = nullptr;
+    m_postingsSize = 0;
+    m_tail.clear();
+    m_session.clear();
+    m_pending.clear();
+}
+
+void HistoryStore::append(const std::string& entry) {
+    if (entry.empty()) {
+        return;
+    }
+
+    stats::Scope scope(stats::Subsystem::HISTORY);
+
+    // One entry per line, with its newlines escaped in the log
+    m_session.push_back(entry);
+    std::string line = escapeEntry(entry);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_logFd < 0) {
+            return;
+        }
+        m_pending.push_back(std::move(line));
+    }
+    m_wake.notify_one();
+}
+
+size_t HistoryStore::size() const {
+    return m_indexedCount + m_tail.size() + m_session.size();
+}
+
+std::string HistoryStore::entry(size_t id) const {
+    if (id < m_indexedCount + m_tail.size()) {
+        return unescapeEntry(logLine(id));
+    }
+    id -= m_indexedCount + m_tail.size();
+    return id < m_session.size() ? m_session[id] : std::string();
+}
+
+std::string_view HistoryStore::logLine(size_t id) const {
+    if (id < m_indexedCount) {
+        std::uint64_t start;
+        std::memcpy(&start, m_offsets + id * sizeof(start), sizeof(start));
+        std::uint64_t end = m_indexedBytes - 1;
+        if (id + 1 < m_indexedCount) {
+            std::memcpy(&end, m_offsets + (id + 1) * sizeof(end), sizeof(end));
+            --end;
+        }
+        return m_log.view().substr(start, end - start);
+    }
+
+    id -= m_indexedCount;
+    return m_log.view().substr(m_tail[id].first, m_tail[id].second - m_tail[id].first);
+}
+
+size_t HistoryStore::searchBackward(std::string_view text, size_t before) const {
+    before = std::min(before, size());
+
+    // Unindexed entries are the newest, so they are checked first
+    for (size_t id = before; id > m_indexedCount; --id) {
+        if (contains(id - 1, text)) {
+            return id - 1;
+        }
+    }
+
+    size_t limit = std::min(before, m_indexedCount);
+    bool usable = false;
+    std::vector<std::uint32_t> candidates = indexCandidates(text, usable);
+    if (usable) {
+        for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+            if (*it < limit && contains(*it, text)) {
+                return *it;
+            }
+        }
+        return NOT_FOUND;
+    }
+
+    for (size_t id = limit; id > 0; --id) {
+        if (contains(id - 1, text)) {
+            return id - 1;
+        }
+    }
+    return NOT_FOUND;
+}
+
+std::vector<size_t> HistoryStore::search(std::string_view text) const {
+    std::vector<size_t> matches;
+
+    bool usable = false;
+    std::vector<std::uint32_t> candidates = indexCandidates(text, usable);
+    if (usable) {
+        for (std::uint32_t id : candidates) {
+            if (contains(id, text)) {
+                matches.push_back(id);
+            }
+        }
+    }
+    else {
+        for (size_t id = 0; id < m_indexedCount; ++id) {
+            if (contains(id, text)) {
+                matches.push_back(id);
+            }
+        }
+    }
+
+    for (size_t id = m_indexedCount; id < size(); ++id) {
+        if (contains(id, text)) {
+            matches.push_back(id);
+        }
+    }
+    return matches;
+}
+
+int HistoryStore::builtin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    std::vector<size_t> ids;
+
+    if (!args.empty() && args[0] == "-s") {
+        if (args.size() != 2) {
+            err += "history: usage: history -s text\n";
+            return 2;
+        }
+        ids = search(args[1]);
+    }
+    else {
+        size_t count = config::MAX_HISTORY_SIZE;
+        if (!args.empty()) {
+            char* end = nullptr;
+            count = static_cast<size_t>(std::strtoull(args[0].c_str(), &end, 10));
+            if (args.size() > 1 || end == args[0].c_str() || *end != '\0') {
+                err += "history: " + args[0] + ": numeric argument required\n";
+                return 2;
+            }
+        }
+        size_t total = size();
+        for (size_t id = total - std::min(count, total); id < total; ++id) {
+            ids.push_back(id);
+        }
+    }
+
+    for (size_t id : ids) {
+        std::string number = std::to_string(id + 1);
+        if (number.size() < 5) {
+            number.insert(0, 5 - number.size(), ' ');
+        }
+        out += number;
+        out += "  ";
+        out += entry(id);
+        out += "\n";
+    }
+    return 0;
+}
+
+bool HistoryStore::loadIndex() {
+    if (!m_index.open(m_indexPath)) {
+        return false;
+    }
+
+    std::string_view data = m_index.view();
+    IndexHeader header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    std::string_view log = m_log.view();
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.byteOrder != BYTE_ORDER_MARK ||
+        header.version != INDEX_VERSION ||
+        header.logBytes > log.size() ||
+        (header.logBytes > 0 && log[header.logBytes - 1] != '\n') ||
+        header.logCheck != checkTail(log.data(), header.logBytes)) {
+        return false;
+    }
+
+    std::uint64_t expected = sizeof(header) + header.entryCount * sizeof(std::uint64_t) +
+        header.trigramCount * sizeof(TrigramEntry) + header.postingsSize;
+    if (header.entryCount > header.logBytes || data.size() != expected) {
+        return false;
+    }
+
+    // Entries are cut out of the log by these offsets, so they must start
+    // at 0 and rise strictly within the indexed bytes. This reads only the
+    // offset table, never the log.
+    const char* base = data.data() + sizeof(header);
+    std::uint64_t previous = 0;
+    for (std::uint64_t i = 0; i < header.entryCount; ++i) {
+        std::uint64_t offset;
+        std::memcpy(&offset, base + i * sizeof(offset), sizeof(offset));
+        if (offset >= header.logBytes || (i == 0 ? offset != 0 : offset <= previous)) {
+            return false;
+        }
+        previous = offset;
+    }
+    if (header.entryCount == 0 && header.logBytes != 0) {
+        return false;
+    }
+
+    m_offsets = base;
+    m_trigrams = reinterpret_cast<const TrigramEntry*>(base + header.entryCount * sizeof(std::uint64_t));
+    m_postings = reinterpret_cast<const char*>(m_trigrams + header.trigramCount);
+    m_trigramCount = static_cast<size_t>(header.trigramCount);
+    m_postingsSize = static_cast<size_t>(header.postingsSize);
+    m_indexedCount = static_cast<size_t>(header.entryCount);
+    m_indexedBytes = static_cast<size_t>(header.logBytes);
+    return true;
+}
+
+void HistoryStore::scanTail(size_t from) {
+    std::string_view log = m_log.view();
+    size_t pos = from;
+    while (pos < log.size()) {
+        size_t newline = log.find('\n', pos);
+        if (newline == std::string_view::npos) {
+            break;
+        }
+        m_tail.emplace_back(pos, newline);
+        pos = newline + 1;
+    }
+}
+
+std::vector<std::uint32_t> HistoryStore::indexCandidates(std::string_view text, bool& usable) const {
+    // The index is over the log's escaped lines; escaping maps each
+    // character on its own, so an entry holding text holds it escaped
+    std::vector<std::uint32_t> candidates;
+    std::string escaped = escapeEntry(text);
+    usable = escaped.size() >= 3 && m_indexedCount > 0;
+    if (!usable) {
+        return candidates;
+    }
+
+    // The entries holding the query's rarest trigram are a superset of the
+    // matches and usually a tiny one
+    std::vector<std::uint32_t> trigrams;
+    collectTrigrams(escaped, trigrams);
+
+    const TrigramEntry* rarest = nullptr;
+    const TrigramEntry* end = m_trigrams + m_trigramCount;
+    for (std::uint32_t trigram : trigrams) {
+        const TrigramEntry* it = std::lower_bound(m_trigrams, end, trigram,
+            [](const TrigramEntry& entry, std::uint32_t value) { return entry.trigram < value; });
+        if (it == end || it->trigram != trigram) {
+            return candidates;
+        }
+        if (rarest == nullptr || it->count < rarest->count) {
+            rarest = it;
+        }
+    }
+
+    candidates.reserve(rarest->count);
+    size_t pos = static_cast<size_t>(rarest->postings);
+    std::uint32_t id = 0;
+    for (std::uint32_t i = 0; i < rarest->count && pos < m_postingsSize; ++i) {
+        std::uint32_t gap = 0;
+        for (int shift = 0; pos < m_postingsSize && shift < 35; shift += 7) {
+            std::uint8_t byte = static_cast<std::uint8_t>(m_postings[pos++]);
+            gap |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        id += gap;
+        if (id >= m_indexedCount) {
+            break;
+        }
+        candidates.push_back(id);
+    }
+    return candidates;
+}
+
+bool HistoryStore::contains(size_t id, std::string_view text) const {
+    // Lines without a backslash are their entry as they stand
+    if (id < m_indexedCount + m_tail.size()) {
+        std::string_view line = logLine(id);
+        if (line.find('\\') == std::string_view::npos) {
+            return line.find(text) != std::string_view::npos;
+        }
+        return unescapeEntry(line).find(text) != std::string::npos;
+    }
+    return entry(id).find(text) != std::string::npos;
+}
+
+void HistoryStore::writerLoop() {
+    stats::Scope scope(stats::Subsystem::HISTORY);
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_wake.wait(lock, [this]() { return !m_pending.empty() || m_stopping; });
+
+        std::vector<std::string> batch;
+        batch.swap(m_pending);
+        lock.unlock();
+
+        if (!batch.empty()) {
+            writeEntries(batch);
+        }
+
+        lock.lock();
+        if (m_stopping && m_pending.empty()) {
+            break;
+        }
+    }
+}
+
+void HistoryStore::writeEntries(const std::vector<std::string>& entries) {
+    // One write per batch; O_APPEND keeps concurrent shells from
+    // interleaving within a batch
+    std::string data;
+    for (const auto& entry : entries) {
+        data += entry;
+        data += '\n';
+    }
+    pipeio::writeAll(m_logFd, data.data(), data.size());
+}
+
+void HistoryStore::startReindex() {
+    // Double fork: the intermediate child exits at once and is reaped here,
+    // leaving the worker orphaned so it never needs waiting for
+    pid_t pid = fork();
+    if (pid < 0) {
+        return;
+    }
+    if (pid == 0) {
+        if (fork() == 0) {
+            // Its own session keeps terminal signals meant for the shell away
+            setsid();
+            setpriority(PRIO_PROCESS, 0, 10);
+            _exit(rebuildIndex() ? 0 : 1);
+        }
+        _exit(0);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+}
+
+bool HistoryStore::rebuildIndex() {
+    // The log is mapped afresh so the index covers entries written by other
+    // shells since this one started
+    MappedFile log;
+    if (!log.open(m_path)) {
+        return false;
+    }
+
+    std::string_view data = log.view();
+    size_t indexed = data.rfind('\n');
+    indexed = indexed == std::string_view::npos ? 0 : indexed + 1;
+
+    struct Postings {
+        std::uint32_t count = 0;
+        std::uint32_t last = 0;
+        std::string bytes;
+    };
+    std::unordered_map<std::uint32_t, Postings> postings;
+    std::vector<std::uint64_t> offsets;
+    std::vector<std::uint32_t> trigrams;
+
+    size_t pos = 0;
+    while (pos < indexed) {
+        if (offsets.size() % RELEASE_CHECK_LINES == 0) {
+            log.release(pos);
+        }
+
+        size_t newline = data.find('\n', pos);
+        std::uint32_t id = static_cast<std::uint32_t>(offsets.size());
+        offsets.push_back(pos);
+
+        collectTrigrams(data.substr(pos, newline - pos), trigrams);
+        for (std::uint32_t trigram : trigrams) {
+            Postings& list = postings[trigram];
+            putVarint(list.bytes, id - list.last);
+            list.last = id;
+            ++list.count;
+        }
+        pos = newline + 1;
+    }
+
+    std::vector<std::uint32_t> keys;
+    keys.reserve(postings.size());
+    for (const auto& item : postings) {
+        keys.push_back(item.first);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<TrigramEntry> table;
+    table.reserve(keys.size());
+    std::uint64_t postingsSize = 0;
+    for (std::uint32_t key : keys) {
+        const Postings& list = postings[key];
+        table.push_back(TrigramEntry{ key, list.count, postingsSize });
+        postingsSize += list.bytes.size();
+    }
+
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.version = INDEX_VERSION;
+    header.logBytes = indexed;
+    header.logCheck = checkTail(data.data(), indexed);
+    header.entryCount = offsets.size();
+    header.trigramCount = table.size();
+    header.postingsSize = postingsSize;
+
+    // Written beside the old index and renamed over it, so a reader never
+    // sees a partial file
+    std::string tmpPath = m_indexPath + ".tmp" + std::to_string(getpid());
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = pipeio::writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+        pipeio::writeAll(fd, reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(std::uint64_t)) &&
+        pipeio::writeAll(fd, reinterpret_cast<const char*>(table.data()), table.size() * sizeof(TrigramEntry));
+    for (size_t i = 0; ok && i < keys.size(); ++i) {
+        const std::string& bytes = postings[keys[i]].bytes;
+        ok = pipeio::writeAll(fd, bytes.data(), bytes.size());
+    }
+    ok = ::close(fd) == 0 && ok;
+
+    if (!ok || std::rename(tmpPath.c_str(), m_indexPath.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
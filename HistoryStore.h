@@ -0,0 +1,130 @@
+// HistoryStore.h - Append-only command history with a trigram index
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include "MappedFile.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Unbounded command history.
+//
+// The history file is an append-only log with one entry per line, newlines
+// within an entry escaped as \n (and backslashes as \\). It is
+// mapped rather than read at startup, and new entries are appended by a
+// writer thread, so neither startup nor exit cost grows with the history.
+//
+// A side file (<history>.idx) holds the line offsets of the indexed part of
+// the log and a trigram index over it: for each three-byte sequence, the
+// sorted ids of the entries containing it. Substring searches look up the
+// rarest trigram of the query and check only its entries. Lines appended
+// since the index was built are searched directly. Once there are enough of
+// them, a detached background process rebuilds the index, so the work is
+// neither waited for nor cut short when the shell exits.
+class HistoryStore {
+public:
+    static constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+
+    HistoryStore();
+    ~HistoryStore();
+
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    // Open (creating if needed) the history log at path
+    bool open(const std::string& path);
+
+    // Write out pending entries and stop the writer thread
+    void close();
+
+    // Add an entry; it is written to the log asynchronously
+    void append(const std::string& entry);
+
+    // Number of entries, oldest first
+    size_t size() const;
+
+    // Entry by id (0 is the oldest)
+    std::string entry(size_t id) const;
+
+    // Id of the newest entry before `before` that contains text, or NOT_FOUND
+    size_t searchBackward(std::string_view text, size_t before) const;
+
+    // Ids of all entries containing text, oldest first
+    std::vector<size_t> search(std::string_view text) const;
+
+    // Implementation of the `history` builtin:
+    //   history             list the most recent entries
+    //   history n           list the last n entries
+    //   history -s text     list every entry containing text
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+private:
+    // One row of the index's trigram table
+    struct TrigramEntry {
+        std::uint32_t trigram;
+        std::uint32_t count;
+        std::uint64_t postings;
+    };
+
+    // Load the index if it matches the log; false means it must be rebuilt
+    bool loadIndex();
+
+    // Split the unindexed end of the log into lines
+    void scanTail(size_t from);
+
+    // Line of the log holding an entry read at open, still escaped
+    std::string_view logLine(size_t id) const;
+
+    // Indexed entry ids whose text contains every trigram of text, oldest
+    // first. Sets usable to false when the query is too short for the index.
+    std::vector<std::uint32_t> indexCandidates(std::string_view text, bool& usable) const;
+
+    // Whether an entry contains text
+    bool contains(size_t id, std::string_view text) const;
+
+    // Writer thread: appends queued entries to the log
+    void writerLoop();
+    void writeEntries(const std::vector<std::string>& entries);
+
+    // Rebuild the index from the log in a detached process
+    void startReindex();
+    bool rebuildIndex();
+
+    std::string m_path;
+    std::string m_indexPath;
+
+    // The log as it was at open
+    MappedFile m_log;
+    size_t m_indexedBytes;
+
+    // Index over the first m_indexedCount entries
+    MappedFile m_index;
+    size_t m_indexedCount;
+    const char* m_offsets;
+    const TrigramEntry* m_trigrams;
+    size_t m_trigramCount;
+    const char* m_postings;
+    size_t m_postingsSize;
+
+    // Complete lines of the log past the indexed part, as [start, end)
+    std::vector<std::pair<size_t, size_t>> m_tail;
+
+    // Entries added in this session; a deque keeps their views stable
+    std::deque<std::string> m_session;
+
+    // Writer thread state
+    int m_logFd;
+    std::thread m_writer;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<std::string> m_pending;
+    bool m_stopping;
+};
+
+#endif // HISTORY_STORE_H
@@ -0,0 +1,405 @@
+// JobControl.cpp - Background job tracking implementation
+
+#include "JobControl.h"
+#include "ProcessSpawner.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+    // epoll data of the signalfd; every other event carries a pid
+    const std::uint64_t SIGNAL_EVENT = ~std::uint64_t(0);
+
+    const int MAX_EVENTS = 256;
+
+    // Poll interval for processes no descriptor reports on
+    const int UNWATCHED_POLL_MS = 50;
+
+    int openPidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+        (void)pid;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+}
+
+JobControl::JobControl() : m_running(0), m_pidfdLimit(0), m_monitoring(false), m_epoll(-1), m_signalFd(-1) {
+#ifdef __linux__
+    // SIGCHLD is blocked before any helper thread exists, so they all
+    // inherit the mask and the signal is only ever seen through the
+    // signalfd. Spawned children get an empty mask of their own. A signal
+    // that arrives before the signalfd exists stays pending for it.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+#endif
+}
+
+JobControl::~JobControl() {
+    for (const auto& item : m_pidfds) {
+        close(item.second);
+    }
+    if (m_signalFd >= 0) {
+        close(m_signalFd);
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+}
+
+int JobControl::add(const std::vector<pid_t>& pids, const std::string& text) {
+    startMonitoring();
+
+    Job job;
+    job.id = nextId();
+    job.pids = pids;
+    job.remaining = pids.size();
+    job.text = text;
+    job.started = trace::enabled() ? trace::now() : 0;
+
+    for (pid_t pid : pids) {
+        m_pidJobs[pid] = job.id;
+
+        // The child cannot have been reaped yet, so even if it has already
+        // exited its pid still names it and the pidfd is simply ready
+        int pidfd = m_epoll >= 0 && m_pidfds.size() < m_pidfdLimit ? openPidfd(pid) : -1;
+#ifdef __linux__
+        if (pidfd >= 0) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = static_cast<std::uint64_t>(pid);
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, pidfd, &event) == 0) {
+                m_pidfds[pid] = pidfd;
+                continue;
+            }
+            close(pidfd);
+        }
+#endif
+        m_unwatched.push_back(pid);
+    }
+
+    if (job.remaining == 0) {
+        job.done = true;
+    }
+    else {
+        ++m_running;
+    }
+
+    int id = job.id;
+    m_jobs.emplace(id, std::move(job));
+    return id;
+}
+
+int JobControl::nextId() const {
+    return m_jobs.empty() ? 1 : m_jobs.rbegin()->first + 1;
+}
+
+void JobControl::reap() {
+    if (m_running == 0) {
+        return;
+    }
+    if (m_epoll < 0) {
+        pollUnwatched();
+        return;
+    }
+    dispatch(0);
+}
+
+void JobControl::reportDone(std::string& out) {
+    for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+        if (it->second.done) {
+            out += describe(it->second, false);
+            it = m_jobs.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+size_t JobControl::runningCount() const {
+    return m_running;
+}
+
+int JobControl::jobsBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    bool withPids = false;
+    bool pidsOnly = false;
+    for (const auto& arg : args) {
+        if (arg == "-l") {
+            withPids = true;
+        }
+        else if (arg == "-p") {
+            pidsOnly = true;
+        }
+        else {
+            err += "jobs: " + arg + ": invalid option\n";
+            err += "jobs: usage: jobs [-l | -p]\n";
+            return 2;
+        }
+    }
+
+    reap();
+
+    // Finished jobs are listed once and then forgotten
+    for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+        const Job& job = it->second;
+        if (pidsOnly) {
+            if (!job.pids.empty()) {
+                out += std::to_string(job.pids.front()) + "\n";
+            }
+        }
+        else {
+            out += describe(job, withPids);
+        }
+        it = job.done ? m_jobs.erase(it) : std::next(it);
+    }
+    return 0;
+}
+
+int JobControl::waitBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    (void)out;
+
+    if (args.empty()) {
+        while (m_running > 0) {
+            if (m_epoll >= 0) {
+                dispatch(-1);
+            }
+            else {
+                int status = 0;
+                struct rusage usage;
+                pid_t pid = wait4(-1, &status, 0, &usage);
+                if (pid < 0 && errno != EINTR) {
+                    break;
+                }
+                if (pid > 0) {
+                    exited(pid, status, &usage);
+                }
+            }
+        }
+
+        // Waited-for jobs are not reported as done afterwards
+        for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+            it = it->second.done ? m_jobs.erase(it) : std::next(it);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (const auto& spec : args) {
+        Job* job = findJob(spec);
+        if (job == nullptr) {
+            err += "wait: " + spec + ": no such job\n";
+            status = 127;
+            continue;
+        }
+
+        int id = job->id;
+        while (!m_jobs[id].done) {
+            if (m_epoll >= 0) {
+                dispatch(-1);
+            }
+            else {
+                int raw = 0;
+                struct rusage usage;
+                pid_t pid = wait4(-1, &raw, 0, &usage);
+                if (pid < 0 && errno != EINTR) {
+                    break;
+                }
+                if (pid > 0) {
+                    exited(pid, raw, &usage);
+                }
+            }
+        }
+
+        status = m_jobs[id].status;
+        m_jobs.erase(id);
+    }
+    return status;
+}
+
+void JobControl::startMonitoring() {
+    if (m_monitoring) {
+        return;
+    }
+    m_monitoring = true;
+
+    // Thousands of background jobs would need as many pidfds. Half the
+    // descriptor limit is left to the shell's own files and pipes; jobs
+    // past that are covered by the signalfd. The limit itself is left
+    // alone, since children would inherit a raised one.
+    struct rlimit limit;
+    m_pidfdLimit = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+        ? static_cast<size_t>(limit.rlim_cur / 2) : SIZE_MAX;
+
+#ifdef __linux__
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    m_signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (m_epoll >= 0 && m_signalFd >= 0) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = SIGNAL_EVENT;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_signalFd, &event);
+    }
+#endif
+}
+
+void JobControl::dispatch(int timeoutMs) {
+#ifdef __linux__
+    // Without a signalfd, pidfd-less processes can only be polled
+    if (m_signalFd < 0 && !m_unwatched.empty()) {
+        pollUnwatched();
+        if (timeoutMs < 0 || timeoutMs > UNWATCHED_POLL_MS) {
+            timeoutMs = UNWATCHED_POLL_MS;
+        }
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(m_epoll, events, MAX_EVENTS, timeoutMs);
+    if (count < 0) {
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (events[i].data.u64 == SIGNAL_EVENT) {
+            // Signals coalesce, so one read stands for any number of
+            // exits; only the pidfd-less processes need checking
+            struct signalfd_siginfo info;
+            while (read(m_signalFd, &info, sizeof(info)) == sizeof(info)) {
+            }
+            pollUnwatched();
+            continue;
+        }
+
+        pid_t pid = static_cast<pid_t>(events[i].data.u64);
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, WNOHANG, &usage) == pid) {
+            auto found = m_pidfds.find(pid);
+            if (found != m_pidfds.end()) {
+                close(found->second); // Also drops it from the epoll set
+                m_pidfds.erase(found);
+            }
+            exited(pid, status, &usage);
+        }
+    }
+#else
+    (void)timeoutMs;
+#endif
+}
+
+void JobControl::exited(pid_t pid, int status, const struct rusage* usage) {
+    auto found = m_pidJobs.find(pid);
+    if (found == m_pidJobs.end()) {
+        return;
+    }
+
+    auto jobIt = m_jobs.find(found->second);
+    m_pidJobs.erase(found);
+    if (jobIt == m_jobs.end()) {
+        return;
+    }
+
+    Job& job = jobIt->second;
+
+    // The span ends when the exit was noticed, which for jobs reaped between
+    // commands can be later than the exit itself
+    if (trace::enabled()) {
+        trace::record("job", job.text, pid, job.started, trace::now(),
+            ProcessSpawner::exitStatus(status), usage);
+    }
+    if (pid == job.pids.back()) {
+        job.status = ProcessSpawner::exitStatus(status);
+    }
+    if (job.remaining > 0 && --job.remaining == 0) {
+        job.done = true;
+        --m_running;
+    }
+}
+
+void JobControl::pollUnwatched() {
+    for (size_t i = 0; i < m_unwatched.size();) {
+        int status = 0;
+        pid_t pid = m_unwatched[i];
+        struct rusage usage;
+        pid_t rc = wait4(pid, &status, WNOHANG, &usage);
+        if (rc == pid || (rc < 0 && errno == ECHILD)) {
+            m_unwatched[i] = m_unwatched.back();
+            m_unwatched.pop_back();
+            exited(pid, rc == pid ? status : 0, rc == pid ? &usage : nullptr);
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+JobControl::Job* JobControl::findJob(const std::string& spec) {
+    if (spec.empty()) {
+        return nullptr;
+    }
+
+    char* end = nullptr;
+    if (spec[0] == '%') {
+        long id = std::strtol(spec.c_str() + 1, &end, 10);
+        if (*end != '\0') {
+            return nullptr;
+        }
+        auto found = m_jobs.find(static_cast<int>(id));
+        return found == m_jobs.end() ? nullptr : &found->second;
+    }
+
+    long pid = std::strtol(spec.c_str(), &end, 10);
+    if (end == spec.c_str() || *end != '\0') {
+        return nullptr;
+    }
+    for (auto& item : m_jobs) {
+        for (pid_t jobPid : item.second.pids) {
+            if (jobPid == pid) {
+                return &item.second;
+            }
+        }
+    }
+    return nullptr;
+}
+
+std::string JobControl::describe(const Job& job, bool withPids) const {
+    std::string state = "Running";
+    if (job.done) {
+        state = job.status == 0 ? "Done" : "Exit " + std::to_string(job.status);
+    }
+    state.resize(std::max<size_t>(state.size(), 24), ' ');
+
+    std::string line = "[" + std::to_string(job.id) + "]  ";
+    if (withPids) {
+        for (pid_t pid : job.pids) {
+            line += std::to_string(pid) + " ";
+        }
+    }
+    line += state + job.text;
+    if (!job.done) {
+        line += " &";
+    }
+    return line + "\n";
+}
@@ -0,0 +1,103 @@
+// JobControl.h - Background job tracking
+
+#ifndef JOB_CONTROL_H
+#define JOB_CONTROL_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// Tracks background jobs and notices when they finish.
+//
+// Everything is driven by one epoll set. Each background process gets a
+// pidfd, which becomes readable when the process exits, so a completion
+// costs one epoll event and one waitpid on a known pid, whatever the number
+// of jobs. Processes that could not get a pidfd (older kernels, or past
+// half the descriptor limit) are covered by a signalfd for SIGCHLD, which
+// is blocked for the whole shell so no handler ever runs asynchronously. Foreground children
+// are waited for by pid elsewhere and never show up here.
+class JobControl {
+public:
+    JobControl();
+    ~JobControl();
+
+    JobControl(const JobControl&) = delete;
+    JobControl& operator=(const JobControl&) = delete;
+
+    // Start tracking a job made of pids (a pipeline's stages in order; the
+    // last one's status is the job's). Returns the job number.
+    int add(const std::vector<pid_t>& pids, const std::string& text);
+
+    // Number the next job added will get
+    int nextId() const;
+
+    // Collect jobs that have finished, without blocking
+    void reap();
+
+    // Append a line for each finished job to out and forget those jobs
+    void reportDone(std::string& out);
+
+    // Number of jobs still running
+    size_t runningCount() const;
+
+    // Whether there are no jobs, running or finished
+    bool empty() const { return m_jobs.empty(); }
+
+    // Implementation of the `jobs` builtin:
+    //   jobs        list jobs
+    //   jobs -l     list jobs with their process ids
+    //   jobs -p     list only each job's first process id
+    int jobsBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+    // Implementation of the `wait` builtin:
+    //   wait             wait for every job
+    //   wait %n | pid    wait for one job and return its status
+    int waitBuiltin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+private:
+    struct Job {
+        int id = 0;
+        std::vector<pid_t> pids;
+        size_t remaining = 0;
+        int status = 0;
+        std::string text;
+        bool done = false;
+        std::uint64_t started = 0; // Trace clock, when tracing
+    };
+
+    // Set up the epoll set and signalfd; shells that never start a
+    // background job do without them
+    void startMonitoring();
+
+    // Handle pending events, waiting up to timeoutMs (-1 = forever)
+    void dispatch(int timeoutMs);
+
+    // Record that a process exited with a raw wait status and, if known,
+    // what it used
+    void exited(pid_t pid, int status, const struct rusage* usage);
+
+    // Poll the processes that have no pidfd
+    void pollUnwatched();
+
+    // Find a job by %n or pid; nullptr if there is none
+    Job* findJob(const std::string& spec);
+
+    std::string describe(const Job& job, bool withPids) const;
+
+    std::map<int, Job> m_jobs;
+    std::unordered_map<pid_t, int> m_pidJobs; // pid -> job number
+    std::unordered_map<pid_t, int> m_pidfds;  // pid -> pidfd
+    std::vector<pid_t> m_unwatched;
+    size_t m_running;
+    size_t m_pidfdLimit; // Most pidfds held at once
+    bool m_monitoring;
+
+    int m_epoll;
+    int m_signalFd;
+};
+
+#endif // JOB_CONTROL_H
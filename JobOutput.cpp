@@ -0,0 +1,450 @@
+// JobOutput.cpp - Captured output of background jobs implementation
+
+#include "JobOutput.h"
+#include "PipeIO.h"
+#include "ShellConfig.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace {
+
+    const int MAX_EVENTS = 64;
+
+    // Smallest power of two at least value, or the top bit when none fits
+    size_t roundUpPowerOfTwo(size_t value) {
+        const size_t top = ~(~size_t(0) >> 1);
+        size_t result = 1;
+        while (result < value && result != top) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    // Read and throw away whatever fd has
+    ssize_t discardInput(int fd) {
+        char scratch[16 * 1024];
+        return read(fd, scratch, sizeof(scratch));
+    }
+}
+
+OutputRing::OutputRing(size_t capacity)
+    : m_capacity(roundUpPowerOfTwo(std::max<size_t>(capacity, 16))),
+    m_reserved(0), m_head(0), m_tail(0) {
+    m_data.reset(new char[m_capacity]);
+}
+
+ssize_t OutputRing::fill(int fd, bool overwrite) {
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+
+    // An overwriting read is kept to a quarter of the ring, which bounds
+    // what a reader racing with it has to give up
+    size_t room = space();
+    if (overwrite) {
+        room = std::max(room, m_capacity / 4);
+    }
+    if (room == 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    m_reserved.store(head + room, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t offset = static_cast<size_t>(head & (m_capacity - 1));
+    size_t first = std::min(room, m_capacity - offset);
+    struct iovec parts[2];
+    parts[0].iov_base = m_data.get() + offset;
+    parts[0].iov_len = first;
+    parts[1].iov_base = m_data.get();
+    parts[1].iov_len = room - first;
+
+    ssize_t n = readv(fd, parts, room > first ? 2 : 1);
+    if (n > 0) {
+        head += static_cast<uint64_t>(n);
+    }
+    m_head.store(head, std::memory_order_release);
+    m_reserved.store(head, std::memory_order_release);
+    return n;
+}
+
+size_t OutputRing::space() const {
+    uint64_t used = m_head.load(std::memory_order_relaxed) - m_tail.load();
+    return used >= m_capacity ? 0 : m_capacity - static_cast<size_t>(used);
+}
+
+uint64_t OutputRing::read(std::string& out, bool consume) {
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    uint64_t start = std::max(tail, head > m_capacity ? head - m_capacity : 0);
+
+    size_t before = out.size();
+    for (uint64_t pos = start; pos < head;) {
+        size_t offset = static_cast<size_t>(pos & (m_capacity - 1));
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(head - pos, m_capacity - offset));
+        out.append(m_data.get() + offset, chunk);
+        pos += chunk;
+    }
+
+    // Whatever the writer reserved since may have been overwritten while
+    // it was being copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t reserved = m_reserved.load(std::memory_order_relaxed);
+    uint64_t intact = reserved > m_capacity ? reserved - m_capacity : 0;
+    if (intact > start) {
+        uint64_t damaged = std::min(intact, head) - start;
+        out.erase(before, static_cast<size_t>(damaged));
+        start += damaged;
+    }
+
+    if (consume) {
+        m_tail.store(head);
+    }
+    return start - tail;
+}
+
+uint64_t OutputRing::buffered() const {
+    return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+}
+
+struct JobOutput::Stream {
+    Stream(int job, int fd, size_t capacity, OverflowPolicy policy)
+        : job(job), fd(fd), policy(policy), ring(capacity) {}
+
+    int job;
+    int fd;
+    OverflowPolicy policy;
+    OutputRing ring;
+
+    std::atomic<uint64_t> dropped{ 0 }; // Discarded by DROP_NEWEST
+    uint64_t lost = 0;                  // Overwritten before being read
+
+    std::atomic<bool> paused{ false };   // The I/O thread stopped reading
+    std::atomic<bool> released{ false }; // Nobody wants the output any more
+    std::atomic<bool> closed{ false };   // The I/O thread saw end of file
+};
+
+JobOutput::JobOutput() : m_reserved(0), m_epoll(-1), m_wakeFd(-1), m_stopping(false) {}
+
+JobOutput::~JobOutput() {
+    if (m_thread.joinable()) {
+        m_stopping = true;
+        wake();
+        m_thread.join();
+    }
+
+    for (const auto& item : m_streams) {
+        if (!item.second->closed) {
+            close(item.second->fd);
+        }
+    }
+    for (const auto& stream : m_released) {
+        if (!stream->closed) {
+            close(stream->fd);
+        }
+    }
+    if (m_wakeFd >= 0) {
+        close(m_wakeFd);
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+}
+
+int JobOutput::capture(int id, size_t capacity, OverflowPolicy policy) {
+#ifdef __linux__
+    // The epoll set is only made for the first captured job
+    if (m_epoll < 0) {
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_epoll >= 0 && m_wakeFd >= 0) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeFd, &event);
+        }
+    }
+    if (m_epoll < 0 || m_wakeFd < 0) {
+        return -1;
+    }
+
+    sweep();
+    release(id);
+
+    if (m_reserved + roundUpPowerOfTwo(capacity) > config::JOB_OUTPUT_BUDGET) {
+        return -1;
+    }
+
+    int fds[2];
+    if (!pipeio::makePipe(fds, 0)) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    auto stream = std::make_shared<Stream>(id, fds[0], capacity, policy);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = stream.get();
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fds[0], &event) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    // The I/O thread only exists once something is captured
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&JobOutput::pump, this);
+    }
+
+    m_reserved += stream->ring.capacity();
+    m_streams[id] = std::move(stream);
+    return fds[1];
+#else
+    (void)id;
+    (void)capacity;
+    (void)policy;
+    return -1;
+#endif
+}
+
+void JobOutput::release(int id) {
+    auto found = m_streams.find(id);
+    if (found == m_streams.end()) {
+        return;
+    }
+
+    std::shared_ptr<Stream> stream = std::move(found->second);
+    m_streams.erase(found);
+    if (stream->closed) {
+        m_reserved -= stream->ring.capacity();
+        return;
+    }
+
+    // The job is still writing; its output is read and thrown away until
+    // the pipe closes
+    stream->released = true;
+    m_released.push_back(std::move(stream));
+    wake();
+}
+
+int JobOutput::builtin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    sweep();
+
+    if (args.empty()) {
+        for (const auto& item : m_streams) {
+            Stream& stream = *item.second;
+            uint64_t buffered = stream.ring.buffered();
+            uint64_t overwritten = buffered > stream.ring.capacity() ? buffered - stream.ring.capacity() : 0;
+            out += "[" + std::to_string(item.first) + "]  " +
+                std::to_string(buffered - overwritten) + " bytes buffered, " +
+                std::to_string(stream.dropped + stream.lost + overwritten) + " dropped, " +
+                (stream.closed ? "finished" : (stream.paused ? "blocked" : "running")) + "\n";
+        }
+        return 0;
+    }
+
+    const std::string& action = args[0];
+    if (action != "tail" && action != "dump" && action != "drain" && action != "clear") {
+        err += "joboutput: " + action + ": invalid action\n";
+        err += "joboutput: usage: joboutput [tail [-n lines] | dump | drain | clear] [%job]\n";
+        return 2;
+    }
+
+    size_t lines = config::JOB_OUTPUT_TAIL_LINES;
+    std::string spec;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-n" && action == "tail" && i + 1 < args.size()) {
+            char* end = nullptr;
+            lines = static_cast<size_t>(std::strtoul(args[++i].c_str(), &end, 10));
+            if (*end != '\0') {
+                err += "joboutput: " + args[i] + ": invalid line count\n";
+                return 2;
+            }
+        }
+        else if (spec.empty()) {
+            spec = args[i];
+        }
+        else {
+            err += "joboutput: too many arguments\n";
+            return 2;
+        }
+    }
+
+    auto found = m_streams.end();
+    if (spec.empty()) {
+        if (!m_streams.empty()) {
+            found = std::prev(m_streams.end());
+        }
+    }
+    else {
+        char* end = nullptr;
+        const char* number = spec.c_str() + (spec[0] == '%' ? 1 : 0);
+        long id = std::strtol(number, &end, 10);
+        if (end != number && *end == '\0') {
+            found = m_streams.find(static_cast<int>(id));
+        }
+    }
+    if (found == m_streams.end()) {
+        err += "joboutput: " + (spec.empty() ? std::string("current") : spec) + ": no such job\n";
+        return 1;
+    }
+
+    Stream& stream = *found->second;
+    bool consume = action == "drain" || action == "clear";
+    std::string text;
+    uint64_t lost = stream.ring.read(text, consume);
+    if (consume) {
+        stream.lost += lost;
+    }
+
+    if (action == "tail") {
+        // Walk back over the newlines that end the last lines
+        size_t start = lines == 0 ? text.size() : 0;
+        size_t limit = text.size() - (!text.empty() && text.back() == '\n' ? 1 : 0);
+        for (size_t count = 0; count < lines; ++count) {
+            size_t newline = limit == 0 ? std::string::npos : text.rfind('\n', limit - 1);
+            if (newline == std::string::npos) {
+                start = 0;
+                break;
+            }
+            start = newline + 1;
+            limit = newline;
+        }
+        out += text.substr(start);
+    }
+    else if (action != "clear") {
+        out += text;
+    }
+
+    if (consume) {
+        // Room was made; a job blocked on a full ring can go on
+        if (stream.paused) {
+            wake();
+        }
+        if (stream.closed) {
+            m_reserved -= stream.ring.capacity();
+            m_streams.erase(found);
+        }
+    }
+    return 0;
+}
+
+void JobOutput::pump() {
+#ifdef __linux__
+    struct epoll_event events[MAX_EVENTS];
+    while (!m_stopping) {
+        int count = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.ptr != nullptr) {
+                service(*static_cast<Stream*>(events[i].data.ptr));
+                continue;
+            }
+
+            // Woken by the shell: resume streams that have room again or
+            // whose output is no longer wanted
+            uint64_t value = 0;
+            while (read(m_wakeFd, &value, sizeof(value)) == sizeof(value)) {
+            }
+            for (size_t p = 0; p < m_paused.size();) {
+                Stream* stream = m_paused[p];
+                if (stream->released || stream->ring.space() > 0) {
+                    struct epoll_event event = {};
+                    event.events = EPOLLIN;
+                    event.data.ptr = stream;
+                    stream->paused = false;
+                    epoll_ctl(m_epoll, EPOLL_CTL_ADD, stream->fd, &event);
+                    m_paused[p] = m_paused.back();
+                    m_paused.pop_back();
+                }
+                else {
+                    ++p;
+                }
+            }
+        }
+    }
+#endif
+}
+
+void JobOutput::service(Stream& stream) {
+#ifdef __linux__
+    ssize_t n = 0;
+    if (stream.released) {
+        n = discardInput(stream.fd);
+    }
+    else if (stream.policy == OverflowPolicy::DROP_OLDEST) {
+        n = stream.ring.fill(stream.fd, true);
+    }
+    else if (stream.ring.space() > 0) {
+        n = stream.ring.fill(stream.fd, false);
+    }
+    else if (stream.policy == OverflowPolicy::DROP_NEWEST) {
+        n = discardInput(stream.fd);
+        if (n > 0) {
+            stream.dropped += static_cast<uint64_t>(n);
+        }
+    }
+    else {
+        // Backpressure: stop reading so the job blocks once its pipe fills.
+        // Checking for room after publishing the pause means a drain that
+        // raced with it cannot be missed.
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, stream.fd, nullptr);
+        stream.paused = true;
+        if (stream.ring.space() == 0) {
+            m_paused.push_back(&stream);
+            return;
+        }
+        stream.paused = false;
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = &stream;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, stream.fd, &event);
+        return;
+    }
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        // A forked job may hold a copy of the descriptor, so closing it
+        // alone would not take it out of the epoll set. From here on the
+        // stream is the shell's to free.
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, stream.fd, nullptr);
+        close(stream.fd);
+        stream.closed.store(true, std::memory_order_release);
+    }
+#else
+    (void)stream;
+#endif
+}
+
+void JobOutput::wake() {
+    if (m_wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(m_wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void JobOutput::sweep() {
+    for (size_t i = 0; i < m_released.size();) {
+        if (m_released[i]->closed) {
+            m_reserved -= m_released[i]->ring.capacity();
+            m_released[i] = std::move(m_released.back());
+            m_released.pop_back();
+        }
+        else {
+            ++i;
+        }
+    }
+}
@@ -0,0 +1,114 @@
+// JobOutput.h - Captured output of background jobs
+
+#ifndef JOB_OUTPUT_H
+#define JOB_OUTPUT_H
+
+#include "ShellOptions.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Byte ring with one writer and one reader and no locks.
+//
+// Positions are running byte counts: the writer owns head, the reader owns
+// tail, and bytes [tail, head) are buffered. A writer allowed to overwrite
+// unread data first publishes how far it is about to write in reserved, so
+// a reader that raced with it can tell which of the bytes it copied are
+// still intact, as with a seqlock.
+class OutputRing {
+public:
+    // Capacity is rounded up to a power of two
+    explicit OutputRing(size_t capacity);
+
+    size_t capacity() const { return m_capacity; }
+
+    // Writer: read once from fd into free space, overwriting unread data
+    // when overwrite is set. Returns what read(2) returned; 0 with errno
+    // set to ENOSPC when there was no room.
+    ssize_t fill(int fd, bool overwrite);
+
+    // Writer: bytes the ring can take without overwriting
+    size_t space() const;
+
+    // Reader: append buffered bytes to out and, if consume is set, drop
+    // them. Returns the number of bytes overwritten before they were read.
+    uint64_t read(std::string& out, bool consume);
+
+    // Reader: bytes buffered (counting any already overwritten)
+    uint64_t buffered() const;
+
+private:
+    std::unique_ptr<char[]> m_data;
+    size_t m_capacity;
+    std::atomic<uint64_t> m_reserved;
+    std::atomic<uint64_t> m_head;
+    std::atomic<uint64_t> m_tail;
+};
+
+// Collects what background jobs write, so they neither interleave with each
+// other nor with the prompt.
+//
+// Each captured job writes into a pipe whose other end the shell reads on
+// one I/O thread, which multiplexes all of them with epoll and copies the
+// data into the job's ring. A full ring either stops being read, so the job
+// blocks on its pipe (backpressure), or drops the oldest or newest output.
+// Memory is bounded per job by the ring and overall by
+// config::JOB_OUTPUT_BUDGET; jobs beyond the budget are not captured.
+class JobOutput {
+public:
+    JobOutput();
+    ~JobOutput();
+
+    JobOutput(const JobOutput&) = delete;
+    JobOutput& operator=(const JobOutput&) = delete;
+
+    // Start capturing the output of job number id. Returns the descriptor
+    // the job should write to (the caller closes it once the job has its
+    // copies), or -1 if the job cannot be captured.
+    int capture(int id, size_t capacity, OverflowPolicy policy);
+
+    // Stop capturing job id and discard its output
+    void release(int id);
+
+    // Implementation of the `joboutput` builtin:
+    //   joboutput                   list captured jobs
+    //   joboutput tail [-n N] [%n]  show the last lines without consuming
+    //   joboutput dump [%n]         show everything buffered
+    //   joboutput drain [%n]        show and consume the buffered output
+    //   joboutput clear [%n]        discard the buffered output
+    // Without a job the most recent one is used.
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+private:
+    struct Stream;
+
+    // I/O thread body; it and the epoll set exist once a job is captured
+    void pump();
+
+    // Handle a readable (or hung up) pipe on the I/O thread
+    void service(Stream& stream);
+
+    // Ask the I/O thread to look at paused and released streams
+    void wake();
+
+    // Free released streams whose pipe has closed
+    void sweep();
+
+    std::map<int, std::shared_ptr<Stream>> m_streams; // job number -> stream
+    std::vector<std::shared_ptr<Stream>> m_released;   // still open, output discarded
+    size_t m_reserved;                                 // ring bytes allocated
+
+    int m_epoll;
+    int m_wakeFd;
+    std::atomic<bool> m_stopping;
+    std::thread m_thread;
+
+    // Streams the I/O thread stopped reading; touched only by that thread
+    std::vector<Stream*> m_paused;
+};
+
+#endif // JOB_OUTPUT_H
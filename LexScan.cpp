@@ -0,0 +1,185 @@
+// LexScan.cpp - Vectorized character scanning implementation
+
+#include "LexScan.h"
+#include <cstring>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEXSCAN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEXSCAN_SSE2 1
+#endif
+
+namespace {
+
+    inline unsigned countTrailingZeros(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+#if defined(LEXSCAN_AVX2)
+    const size_t BLOCK = 32;
+    using Vector = __m256i;
+
+    inline Vector load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const Vector*>(p)); }
+    inline Vector splat(char c) { return _mm256_set1_epi8(c); }
+    inline Vector eq(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+    inline Vector either(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+    inline Vector minU8(Vector a, Vector b) { return _mm256_min_epu8(a, b); }
+    inline Vector sub(Vector a, Vector b) { return _mm256_sub_epi8(a, b); }
+    inline unsigned bits(Vector v) { return static_cast<unsigned>(_mm256_movemask_epi8(v)); }
+#elif defined(LEXSCAN_SSE2)
+    const size_t BLOCK = 16;
+    using Vector = __m128i;
+
+    inline Vector load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const Vector*>(p)); }
+    inline Vector splat(char c) { return _mm_set1_epi8(c); }
+    inline Vector eq(Vector a, Vector b) { return _mm_cmpeq_epi8(a, b); }
+    inline Vector either(Vector a, Vector b) { return _mm_or_si128(a, b); }
+    inline Vector minU8(Vector a, Vector b) { return _mm_min_epu8(a, b); }
+    inline Vector sub(Vector a, Vector b) { return _mm_sub_epi8(a, b); }
+    inline unsigned bits(Vector v) { return static_cast<unsigned>(_mm_movemask_epi8(v)); }
+#endif
+
+#if defined(LEXSCAN_AVX2) || defined(LEXSCAN_SSE2)
+    // Lanes holding \t \n \v \f or \r: (c - 9) as unsigned is at most 4
+    inline Vector controlSpace(Vector v) {
+        Vector shifted = sub(v, splat('\t'));
+        return eq(minU8(shifted, splat(4)), shifted);
+    }
+#endif
+
+    // Scalar tail shared by all scanners
+    inline size_t scanTail(const char* data, size_t pos, size_t size, std::uint8_t classes) {
+        while (pos < size && !lexscan::hasClass(data[pos], classes)) {
+            ++pos;
+        }
+        return pos;
+    }
+}
+
+namespace lexscan {
+
+    size_t findWordEnd(const char* data, size_t size) {
+        size_t pos = 0;
+#if defined(LEXSCAN_AVX2) || defined(LEXSCAN_SSE2)
+        const Vector space = splat(' ');
+        const Vector pipe = splat('|');
+        const Vector amp = splat('&');
+        const Vector semi = splat(';');
+        const Vector less = splat('<');
+        const Vector greater = splat('>');
+        const Vector backslash = splat('\\');
+        const Vector single = splat('\'');
+        const Vector dquote = splat('"');
+
+        for (; pos + BLOCK <= size; pos += BLOCK) {
+            Vector v = load(data + pos);
+            Vector hits = either(either(either(eq(v, space), controlSpace(v)),
+                either(eq(v, pipe), eq(v, amp))),
+                either(either(either(eq(v, semi), eq(v, less)),
+                    either(eq(v, greater), eq(v, backslash))),
+                    either(eq(v, single), eq(v, dquote))));
+            unsigned mask = bits(hits);
+            if (mask != 0) {
+                return pos + countTrailingZeros(mask);
+            }
+        }
+#endif
+        return scanTail(data, pos, size, CLASS_SPACE | CLASS_OPERATOR | CLASS_ESCAPE | CLASS_QUOTE);
+    }
+
+    size_t skipBlanks(const char* data, size_t size) {
+        size_t pos = 0;
+#if defined(LEXSCAN_AVX2) || defined(LEXSCAN_SSE2)
+        const Vector space = splat(' ');
+        const Vector tab = splat('\t');
+        const Vector cr = splat('\r');
+        const unsigned full = BLOCK == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+
+        for (; pos + BLOCK <= size; pos += BLOCK) {
+            Vector v = load(data + pos);
+            unsigned mask = bits(either(either(eq(v, space), eq(v, tab)), eq(v, cr)));
+            if (mask != full) {
+                return pos + countTrailingZeros(~mask & full);
+            }
+        }
+#endif
+        while (pos < size && hasClass(data[pos], CLASS_BLANK)) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    size_t findQuoteEnd(const char* data, size_t size, char quote) {
+        size_t pos = 0;
+#if defined(LEXSCAN_AVX2) || defined(LEXSCAN_SSE2)
+        const Vector quoteChar = splat(quote);
+        const Vector backslash = splat('\\');
+
+        for (; pos + BLOCK <= size; pos += BLOCK) {
+            Vector v = load(data + pos);
+            unsigned mask = bits(either(eq(v, quoteChar), eq(v, backslash)));
+            if (mask != 0) {
+                return pos + countTrailingZeros(mask);
+            }
+        }
+#endif
+        while (pos < size && data[pos] != quote && data[pos] != '\\') {
+            ++pos;
+        }
+        return pos;
+    }
+
+    size_t findSubstitutionEnd(const char* data, size_t size) {
+        size_t depth = 1;
+        size_t pos = 2;
+        while (pos < size) {
+            char c = data[pos];
+            if (c == '\\') {
+                pos += 2;
+            }
+            else if (c == '\'') {
+                const void* close = std::memchr(data + pos + 1, '\'', size - pos - 1);
+                pos = close != nullptr ? static_cast<size_t>(static_cast<const char*>(close) - data) + 1 : size;
+            }
+            else if (c == '"') {
+                for (++pos; pos < size && data[pos] != '"';) {
+                    if (data[pos] == '\\') {
+                        pos += 2;
+                    }
+                    else if (data[pos] == '$' && pos + 1 < size && data[pos + 1] == '(') {
+                        pos += findSubstitutionEnd(data + pos, size - pos);
+                    }
+                    else {
+                        ++pos;
+                    }
+                }
+                ++pos;
+            }
+            else if (c == '$' && pos + 1 < size && data[pos + 1] == '(') {
+                pos += findSubstitutionEnd(data + pos, size - pos);
+            }
+            else {
+                if (c == '(') {
+                    ++depth;
+                }
+                else if (c == ')' && --depth == 0) {
+                    return pos + 1;
+                }
+                ++pos;
+            }
+        }
+        return size;
+    }
+}
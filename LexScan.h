@@ -0,0 +1,89 @@
+// LexScan.h - Vectorized character scanning for the lexer
+
+#ifndef LEX_SCAN_H
+#define LEX_SCAN_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Scanning primitives for the lexer's hot loops. Each function returns the
+// offset of the first byte that stops the scan (or size if none does).
+// Bulk input is examined 32 bytes at a time with AVX2 or 16 bytes at a time
+// with SSE2, whichever the build targets; the remaining tail, and builds
+// without either, use a constexpr character-class table.
+namespace lexscan {
+    // Character classes; a byte may belong to several
+    enum CharClass : std::uint8_t {
+        CLASS_SPACE = 1 << 0,     // isspace() in the C locale, ends a word
+        CLASS_OPERATOR = 1 << 1,  // | & ; < > end a word
+        CLASS_ESCAPE = 1 << 2,    // backslash
+        CLASS_BLANK = 1 << 3,     // space, tab and CR, skipped between tokens
+        CLASS_GLOB = 1 << 4,      // * ? [ make a word a pathname pattern
+        CLASS_QUOTE = 1 << 5      // ' and " start a quoted part of a word
+    };
+
+    constexpr std::array<std::uint8_t, 256> makeClassTable() {
+        std::array<std::uint8_t, 256> table{};
+        for (unsigned char c : { ' ', '\t', '\n', '\v', '\f', '\r' }) {
+            table[c] |= CLASS_SPACE;
+        }
+        for (unsigned char c : { '|', '&', ';', '<', '>' }) {
+            table[c] |= CLASS_OPERATOR;
+        }
+        table[static_cast<unsigned char>('\\')] |= CLASS_ESCAPE;
+        for (unsigned char c : { ' ', '\t', '\r' }) {
+            table[c] |= CLASS_BLANK;
+        }
+        for (unsigned char c : { '*', '?', '[' }) {
+            table[c] |= CLASS_GLOB;
+        }
+        for (unsigned char c : { '\'', '"' }) {
+            table[c] |= CLASS_QUOTE;
+        }
+        return table;
+    }
+
+    constexpr std::array<std::uint8_t, 256> CHAR_CLASS = makeClassTable();
+
+    inline bool hasClass(char c, std::uint8_t classes) {
+        return (CHAR_CLASS[static_cast<unsigned char>(c)] & classes) != 0;
+    }
+
+    // Whether any byte of a word is a wildcard. Words are short, so this is
+    // a plain table scan.
+    inline bool hasGlob(const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            if (hasClass(data[i], CLASS_GLOB)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether a word has a $( starting a command substitution
+    inline bool hasSubstitution(const char* data, size_t size) {
+        for (size_t i = 0; i + 1 < size; ++i) {
+            if (data[i] == '$' && data[i + 1] == '(') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Length of the command substitution at data[0] (its "$("), up to and
+    // including the closing parenthesis, or size if it is never closed.
+    // Nested parentheses, quotes and escapes inside it are skipped over.
+    size_t findSubstitutionEnd(const char* data, size_t size);
+
+    // First whitespace, operator, backslash or quote
+    size_t findWordEnd(const char* data, size_t size);
+
+    // First byte that is not a blank (space, tab, CR)
+    size_t skipBlanks(const char* data, size_t size);
+
+    // First occurrence of quote or a backslash
+    size_t findQuoteEnd(const char* data, size_t size, char quote);
+}
+
+#endif // LEX_SCAN_H
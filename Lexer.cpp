@@ -1,14 +1,62 @@
 // Lexer.cpp - Lexical analyzer implementation
 
 #include "Lexer.h"
-#include <cctype>
+#include "LexScan.h"
+#include <algorithm>
 
-Lexer::Lexer(const std::string& input)
-    : m_input(input), m_current(0) {}
+namespace {
+    // The pattern for a word with quoted parts: the quotes are removed and
+    // the wildcards and backslashes inside them escaped, as an unquoted
+    // escape already is, so that only the unquoted wildcards match
+    std::string quotedPattern(std::string_view raw) {
+        std::string pattern;
+        auto appendLiteral = [&pattern](char c) {
+            if (c == '\\' || lexscan::hasClass(c, lexscan::CLASS_GLOB)) {
+                pattern += '\\';
+            }
+            pattern += c;
+        };
+
+        size_t pos = 0;
+        while (pos < raw.size()) {
+            char c = raw[pos];
+            if (c == '\\') {
+                pattern.append(raw.substr(pos, 2));
+                pos += 2;
+            }
+            else if (c == '\'') {
+                size_t close = std::min(raw.find('\'', pos + 1), raw.size());
+                for (++pos; pos < close; ++pos) {
+                    appendLiteral(raw[pos]);
+                }
+                ++pos;
+            }
+            else if (c == '"') {
+                for (++pos; pos < raw.size() && raw[pos] != '"'; ++pos) {
+                    if (raw[pos] == '\\' && pos + 1 < raw.size()) {
+                        ++pos;
+                    }
+                    appendLiteral(raw[pos]);
+                }
+                ++pos;
+            }
+            else {
+                pattern += c;
+                ++pos;
+            }
+        }
+        return pattern;
+    }
+}
+
+Lexer::Lexer(std::string_view input)
+    : m_input(input), m_current(0), m_line(1), m_tokenLine(1),
+      m_hereDocumentEnd(0), m_hereDocumentOpen(false) {}
 
 Token Lexer::nextToken() {
     // Skip any whitespace
     skipWhitespace();
+    m_tokenLine = m_line;
 
     // Check if we've reached the end of input
     if (isAtEnd()) {
@@ -41,6 +89,13 @@ Token Lexer::nextToken() {
     }
     else if (c == '<') {
         advance();
+        if (peek() == '<') {
+            advance();
+            if (match('<')) {
+                return Token(TokenType::HERESTRING, "<<<");
+            }
+            return handleHereDocument(match('-'));
+        }
         return Token(TokenType::REDIRECT_IN, "<");
     }
     else if (c == '>') {
@@ -53,13 +108,19 @@ Token Lexer::nextToken() {
     }
     else if (c == '\n') {
         advance();
+        ++m_line;
+
+        // The bodies of here-documents on this line were read already
+        if (m_hereDocumentEnd > m_current) {
+            size_t from = m_current;
+            m_current = m_hereDocumentEnd;
+            countLines(from);
+        }
+        m_hereDocumentEnd = 0;
         return Token(TokenType::NEWLINE, "\n");
     }
-    else if (c == '\"' || c == '\'') {
-        return handleQuote(c);
-    }
     else {
-        // Default case: handle a word token
+        // Default case: handle a word token, quoted parts and all
         return handleWord();
     }
 }
@@ -107,64 +168,265 @@ bool Lexer::match(char expected) {
 }
 
 Token Lexer::handleWord() {
-    std::string value;
+    size_t start = m_current;
+
+    // Fast path: a word that is one quoted string without escapes or
+    // substitutions is a view into the input between its quotes
+    char quote = peek();
+    if (quote == '"' || quote == '\'') {
+        const char* text = m_input.data() + start + 1;
+        size_t size = m_input.size() - start - 1;
+        size_t length = quote == '"'
+            ? lexscan::findQuoteEnd(text, size, '"')
+            : std::min(m_input.find('\'', start + 1), m_input.size()) - start - 1;
+        size_t after = start + 1 + length + 1;
+        bool closed = length < size && text[length] == quote;
+        bool ends = after >= m_input.size() ||
+            lexscan::hasClass(m_input[after], lexscan::CLASS_SPACE | lexscan::CLASS_OPERATOR);
+        if (closed && ends && (quote == '\'' || !lexscan::hasSubstitution(text, length))) {
+            m_current = after;
+            countLines(start);
+            return Token(TokenType::WORD, m_input.substr(start + 1, length));
+        }
+    }
+
+    // Most words contain no quotes or escapes and are returned as a view
+    // into the input without being copied
+    m_current += lexscan::findWordEnd(m_input.data() + m_current, m_input.size() - m_current);
+    if (lexscan::hasSubstitution(m_input.data() + start, m_current - start)) {
+        m_current = start;
+        return handleSubstitution();
+    }
+    if (isAtEnd() || !lexscan::hasClass(peek(), lexscan::CLASS_ESCAPE | lexscan::CLASS_QUOTE)) {
+        Token token(TokenType::WORD, m_input.substr(start, m_current - start));
+        if (lexscan::hasGlob(m_input.data() + start, m_current - start)) {
+            token.addFlags(WORD_GLOB);
+        }
+        return token;
+    }
+
+    // Quotes and escapes are removed, so the rest of the word is
+    // materialized. Only wildcards outside them make it a pattern.
+    std::string value(m_input.substr(start, m_current - start));
+    bool glob = lexscan::hasGlob(value.data(), value.size());
+    bool quotes = false;
 
     // Keep consuming characters until we hit a delimiter
     while (!isAtEnd()) {
         char c = peek();
 
         // Break if we hit a special character or whitespace
-        if (isspace(c) || c == '|' || c == '&' || c == ';' || c == '<' || c == '>') {
+        if (lexscan::hasClass(c, lexscan::CLASS_SPACE | lexscan::CLASS_OPERATOR)) {
             break;
         }
 
         // Handle escaped characters
-        if (c == '\\' && !isAtEnd()) {
+        if (c == '\\') {
             advance(); // Skip the backslash
             if (!isAtEnd()) {
                 value += advance(); // Add the escaped character
             }
         }
+        else if (c == '\'') {
+            // Single quotes keep everything up to the next one literally
+            size_t close = m_input.find('\'', m_current + 1);
+            size_t end = close == std::string_view::npos ? m_input.size() : close;
+            value.append(m_input.data() + m_current + 1, end - m_current - 1);
+            m_current = std::min(end + 1, m_input.size());
+            quotes = true;
+        }
+        else if (c == '"') {
+            // Double quotes keep their text but a backslash still escapes
+            advance(); // Skip the opening quote
+            while (!isAtEnd() && peek() != '"') {
+                if (peek() == '\\') {
+                    advance();
+                    if (!isAtEnd()) {
+                        value += advance();
+                    }
+                    continue;
+                }
+                size_t run = lexscan::findQuoteEnd(m_input.data() + m_current, m_input.size() - m_current, '"');
+                if (lexscan::hasSubstitution(m_input.data() + m_current, run)) {
+                    m_current = start;
+                    return handleSubstitution();
+                }
+                value.append(m_input.data() + m_current, run);
+                m_current += run;
+            }
+            if (!isAtEnd()) {
+                advance(); // Skip the closing quote
+            }
+            quotes = true;
+        }
         else {
-            value += advance();
+            // Copy the run up to the next special character in one go
+            size_t run = lexscan::findWordEnd(m_input.data() + m_current, m_input.size() - m_current);
+            if (lexscan::hasSubstitution(m_input.data() + m_current, run)) {
+                m_current = start;
+                return handleSubstitution();
+            }
+            glob = glob || lexscan::hasGlob(m_input.data() + m_current, run);
+            value.append(m_input.data() + m_current, run);
+            m_current += run;
         }
     }
 
-    return Token(TokenType::WORD, value);
+    // Quoted text and escaped newlines are part of the word but still end
+    // a line
+    countLines(start);
+
+    // A pattern keeps its escapes so the wildcards they protect stay
+    // literal; without quotes the raw text is exactly that
+    if (glob) {
+        Token token = quotes
+            ? Token::makeOwned(TokenType::WORD, quotedPattern(m_input.substr(start, m_current - start)))
+            : Token(TokenType::WORD, m_input.substr(start, m_current - start));
+        token.addFlags(WORD_GLOB);
+        return token;
+    }
+
+    return Token::makeOwned(TokenType::WORD, std::move(value));
 }
 
-Token Lexer::handleQuote(char quoteChar) {
-    advance(); // Skip the opening quote
-    std::string value;
+Token Lexer::handleSubstitution() {
+    size_t start = m_current;
+    bool glob = false;
 
-    while (!isAtEnd() && peek() != quoteChar) {
-        // Handle escaped characters within quotes
-        if (peek() == '\\') {
-            advance(); // Skip the backslash
+    // A substitution runs to its closing parenthesis whatever it contains,
+    // and so do quotes, which the executor removes; the rest of the word
+    // ends as any other does
+    while (!isAtEnd()) {
+        char c = peek();
+        if (lexscan::hasClass(c, lexscan::CLASS_SPACE | lexscan::CLASS_OPERATOR)) {
+            break;
+        }
+        if (c == '\\') {
+            m_current = std::min(m_current + 2, m_input.size());
+        }
+        else if (c == '$' && peekNext() == '(') {
+            skipSubstitution();
+        }
+        else if (c == '"') {
+            advance();
+            skipQuotedSubstitution();
             if (!isAtEnd()) {
-                value += advance(); // Add the escaped character
+                advance();
             }
         }
+        else if (c == '\'') {
+            size_t close = m_input.find('\'', m_current + 1);
+            m_current = close == std::string_view::npos ? m_input.size() : close + 1;
+        }
         else {
-            value += advance();
+            glob = glob || lexscan::hasClass(c, lexscan::CLASS_GLOB);
+            ++m_current;
+        }
+    }
+
+    // The executor splits the word around its substitutions, so it is
+    // handed over as written
+    countLines(start);
+    Token token(TokenType::WORD, m_input.substr(start, m_current - start));
+    token.addFlags(WORD_SUBSTITUTION | (glob ? WORD_GLOB : 0));
+    return token;
+}
+
+Token Lexer::handleHereDocument(bool stripTabs) {
+    // The delimiter is the next word with its quotes and escapes removed.
+    // Bodies are always taken literally, quoted delimiter or not.
+    skipWhitespace();
+    std::string delimiter;
+    while (!isAtEnd() && !lexscan::hasClass(peek(), lexscan::CLASS_SPACE | lexscan::CLASS_OPERATOR)) {
+        char c = advance();
+        if (c == '\\' && !isAtEnd()) {
+            delimiter += advance();
+        }
+        else if (c != '"' && c != '\'') {
+            delimiter += c;
         }
     }
+    if (delimiter.empty()) {
+        return Token(TokenType::HEREDOC); // No text: the parser reports it
+    }
+
+    // The body starts on the line after the command, or after the body of
+    // an earlier here-document on the same line
+    size_t start = m_hereDocumentEnd;
+    if (start <= m_current) {
+        size_t newline = m_input.find('\n', m_current);
+        start = newline == std::string_view::npos ? m_input.size() : newline + 1;
+    }
 
-    if (!isAtEnd()) {
-        advance(); // Skip the closing quote
+    // Lines up to the one holding only the delimiter
+    size_t end = start;
+    size_t next = m_input.size();
+    m_hereDocumentOpen = true;
+    while (end < m_input.size()) {
+        size_t newline = m_input.find('\n', end);
+        size_t lineEnd = newline == std::string_view::npos ? m_input.size() : newline;
+        std::string_view line = m_input.substr(end, lineEnd - end);
+        if (stripTabs) {
+            line.remove_prefix(std::min(line.find_first_not_of('\t'), line.size()));
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line == delimiter) {
+            next = newline == std::string_view::npos ? m_input.size() : newline + 1;
+            m_hereDocumentOpen = false;
+            break;
+        }
+        end = newline == std::string_view::npos ? m_input.size() : newline + 1;
     }
+    m_hereDocumentEnd = std::max(next, start);
 
-    return Token(TokenType::WORD, value);
+    // A body is a view into the input unless tabs have to be removed
+    std::string_view body = m_input.substr(start, end - start);
+    if (!stripTabs) {
+        return Token(TokenType::HEREDOC, body);
+    }
+    std::string stripped;
+    stripped.reserve(body.size());
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t newline = body.find('\n', pos);
+        size_t lineEnd = newline == std::string_view::npos ? body.size() : newline + 1;
+        size_t text = std::min(body.find_first_not_of('\t', pos), lineEnd);
+        stripped.append(body.data() + text, lineEnd - text);
+        pos = lineEnd;
+    }
+    return Token::makeOwned(TokenType::HEREDOC, std::move(stripped));
 }
 
-void Lexer::skipWhitespace() {
-    while (!isAtEnd()) {
-        char c = peek();
-        if (c == ' ' || c == '\t' || c == '\r') {
-            advance();
+void Lexer::skipQuotedSubstitution() {
+    while (!isAtEnd() && peek() != '"') {
+        if (peek() == '\\') {
+            m_current = std::min(m_current + 2, m_input.size());
+        }
+        else if (peek() == '$' && peekNext() == '(') {
+            skipSubstitution();
         }
         else {
-            break;
+            ++m_current;
         }
     }
-}
\ No newline at end of file
+}
+
+void Lexer::skipSubstitution() {
+    m_current += lexscan::findSubstitutionEnd(m_input.data() + m_current, m_input.size() - m_current);
+}
+
+void Lexer::countLines(size_t from) {
+    m_line += static_cast<size_t>(std::count(m_input.begin() + from, m_input.begin() + m_current, '\n'));
+}
+
+void Lexer::skipWhitespace() {
+    m_current += lexscan::skipBlanks(m_input.data() + m_current, m_input.size() - m_current);
+
+    // A # at the start of a token comments out the rest of the line
+    if (peek() == '#') {
+        size_t end = m_input.find('\n', m_current);
+        m_current = (end == std::string_view::npos) ? m_input.size() : end;
+    }
+}
@@ -5,13 +5,14 @@
 
 #include "Token.h"
 #include <string>
+#include <string_view>
 #include <vector>
-#include <memory>
 
 class Lexer {
 public:
-    // Constructor takes input string to tokenize
-    explicit Lexer(const std::string& input);
+    // Constructor takes the input to tokenize. The input is not copied:
+    // tokens refer into it, so it must outlive the lexer and its tokens.
+    explicit Lexer(std::string_view input);
 
     // Get the next token from the input
     Token nextToken();
@@ -22,6 +23,15 @@ public:
     // Check if the lexer has reached the end of input
     bool isAtEnd() const { return m_current >= m_input.size(); }
 
+    // Offset of the next unread character
+    size_t position() const { return m_current; }
+
+    // Line of the most recently returned token, counted from 1
+    size_t line() const { return m_tokenLine; }
+
+    // Whether the input ended inside a here-document, before its delimiter
+    bool hereDocumentOpen() const { return m_hereDocumentOpen; }
+
 private:
     // Helper methods for tokenization
     char advance(); // Move to next character and return it
@@ -30,16 +40,27 @@ private:
     bool match(char expected); // Check if current char matches expected and advance if so
 
     // Token generation methods
-    Token handleWord(); // Process a word token (command or argument)
-    Token handleQuote(char quoteChar); // Process a quoted string
+    Token handleWord(); // Process a word token (command or argument) and its quotes
+    Token handleSubstitution(); // Process a word containing $(...)
+    void skipSubstitution(); // Move past the $(...) at the current position
+    void skipQuotedSubstitution(); // Move to the '"' closing a string that may hold $(...)
     Token handleOperator(); // Process an operator or redirect
+    Token handleHereDocument(bool stripTabs); // Read the delimiter and body of a << or <<-
 
-    // Skip whitespace characters
+    // Skip whitespace characters and comments
     void skipWhitespace();
 
+    // Add the newlines between from and the current position to the line
+    // count; every run skipped without looking at each byte goes through it
+    void countLines(size_t from);
+
     // Member variables
-    std::string m_input; // Input string
+    std::string_view m_input; // Input buffer (not owned)
     size_t m_current; // Current position in input
+    size_t m_line; // Line number of the current position
+    size_t m_tokenLine; // Line number of the last token returned
+    size_t m_hereDocumentEnd; // End of the here-document bodies read on this line, or 0
+    bool m_hereDocumentOpen; // Last here-document read had no delimiter line
 };
 
 #endif // LEXER_H
\ No newline at end of file
@@ -0,0 +1,870 @@
+// LineEditor.cpp - Interactive line editing implementation
+
+#include "LineEditor.h"
+#include "PipeIO.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+    const char PASTE_START[] = "\x1b[200~";
+    const char PASTE_END[] = "\x1b[201~";
+    const size_t PASTE_END_LENGTH = sizeof(PASTE_END) - 1;
+
+    // Characters a completed word has to escape
+    const char SPECIAL[] = " \t\n\\'\"$&|;<>()*?[]`#";
+
+    bool isContinuation(unsigned char c) {
+        return (c & 0xC0) == 0x80;
+    }
+
+    // Terminal cells a row takes: one per character, UTF-8 continuation
+    // bytes taking none
+    size_t cells(std::string_view row) {
+        size_t count = 0;
+        for (char c : row) {
+            count += isContinuation(static_cast<unsigned char>(c)) ? 0 : 1;
+        }
+        return count;
+    }
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n';
+    }
+
+    // Characters that end the word being completed
+    bool isWordBreak(char c) {
+        return isSpace(c) || std::strchr(";|&<>()", c) != nullptr;
+    }
+
+    std::string escapeWord(std::string_view word) {
+        std::string escaped;
+        escaped.reserve(word.size());
+        for (char c : word) {
+            if (std::strchr(SPECIAL, c) != nullptr) {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    std::string unescapeWord(std::string_view word) {
+        std::string plain;
+        plain.reserve(word.size());
+        for (size_t i = 0; i < word.size(); ++i) {
+            if (word[i] == '\\' && i + 1 < word.size()) {
+                ++i;
+            }
+            plain += word[i];
+        }
+        return plain;
+    }
+
+    size_t terminalColumns() {
+        struct winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+            return size.ws_col;
+        }
+        return 80;
+    }
+
+    void appendMove(std::string& out, size_t count, char direction) {
+        out += "\x1b[";
+        out += std::to_string(count);
+        out += direction;
+    }
+}
+
+LineEditor::LineEditor(HistoryStore& history, Completer completer)
+    : m_history(history), m_completer(std::move(completer)), m_interactive(false), m_savedMode(),
+    m_raw(false), m_cursor(0), m_done(false), m_eof(false), m_historyIndex(0), m_searching(false),
+    m_match(HistoryStore::NOT_FOUND), m_searchFailed(false), m_cursorBeforeSearch(0),
+    m_pasting(false), m_lastTab(false), m_columns(0), m_row(0), m_column(0), m_screenRows(1) {
+    const char* term = std::getenv("TERM");
+    m_interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+        term != nullptr && std::strcmp(term, "dumb") != 0;
+}
+
+LineEditor::~LineEditor() {
+    leaveRawMode();
+}
+
+bool LineEditor::readLine(const std::string& prompt, std::string& line) {
+    line.clear();
+    std::cout.flush();
+    if (!enterRawMode()) {
+        return false;
+    }
+
+    m_prompt = prompt;
+    m_buffer.clear();
+    m_cursor = 0;
+    m_done = false;
+    m_eof = false;
+    m_historyIndex = m_history.size();
+    m_draft.clear();
+    m_searching = false;
+    m_pasting = false;
+    m_lastTab = false;
+    m_shown = Frame();
+    m_columns = 0;
+    m_row = 0;
+    m_column = 0;
+    m_screenRows = 1;
+    m_output = "\x1b[?2004h";
+
+    // Keys typed while the last command ran come first
+    char chunk[64 * 1024];
+    if (!m_pending.empty()) {
+        std::string input;
+        input.swap(m_pending);
+        size_t used = process(input.data(), input.size());
+        m_pending.assign(input, used, std::string::npos);
+    }
+
+    while (!m_done) {
+        if (!m_pasting) {
+            render();
+        }
+
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            m_buffer.clear();
+            finish(true);
+            break;
+        }
+
+        // A sequence cut short by the last read is completed by this one
+        const char* data = chunk;
+        size_t size = static_cast<size_t>(n);
+        std::string input;
+        if (!m_pending.empty()) {
+            input.swap(m_pending);
+            input.append(chunk, size);
+            data = input.data();
+            size = input.size();
+        }
+        size_t used = process(data, size);
+        m_pending.assign(data + used, size - used);
+    }
+
+    leaveRawMode();
+    line = m_buffer;
+    return !m_eof;
+}
+
+bool LineEditor::enterRawMode() {
+    if (m_raw) {
+        return true;
+    }
+    if (tcgetattr(STDIN_FILENO, &m_savedMode) != 0) {
+        return false;
+    }
+
+    // Output processing stays on; the editor writes \r\n itself anyway
+    struct termios raw = m_savedMode;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) != 0) {
+        return false;
+    }
+    m_raw = true;
+    return true;
+}
+
+void LineEditor::leaveRawMode() {
+    if (m_raw) {
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &m_savedMode);
+        m_raw = false;
+    }
+}
+
+size_t LineEditor::process(const char* data, size_t size) {
+    size_t i = 0;
+    while (i < size && !m_done) {
+        // Pasted text is taken as is up to the closing marker, which may
+        // still be on its way
+        if (m_pasting) {
+            std::string_view rest(data + i, size - i);
+            size_t end = rest.find(std::string_view(PASTE_END, PASTE_END_LENGTH));
+            if (end == std::string_view::npos) {
+                size_t keep = 0;
+                for (size_t length = std::min(rest.size(), PASTE_END_LENGTH - 1); length > 0; --length) {
+                    if (rest.substr(rest.size() - length) == std::string_view(PASTE_END, length)) {
+                        keep = length;
+                        break;
+                    }
+                }
+                m_paste.append(rest.substr(0, rest.size() - keep));
+                return size - keep;
+            }
+            m_paste.append(rest.substr(0, end));
+            i += end + PASTE_END_LENGTH;
+            m_pasting = false;
+            insertPaste();
+            continue;
+        }
+
+        bool afterTab = m_lastTab;
+        m_lastTab = false;
+        unsigned char c = static_cast<unsigned char>(data[i]);
+
+        if (c == 0x1B) {
+            size_t length = sequenceLength(data + i, size - i);
+            if (length == 0) {
+                break;
+            }
+            handleSequence(std::string_view(data + i, length));
+            i += length;
+            continue;
+        }
+
+        // A run of ordinary characters goes in with one insert
+        if (c >= 0x20 && c != 0x7F) {
+            size_t end = i + 1;
+            while (end < size && static_cast<unsigned char>(data[end]) >= 0x20 && data[end] != 0x7F) {
+                ++end;
+            }
+            std::string_view text(data + i, end - i);
+            if (m_searching) {
+                m_query.append(text);
+                searchFor(m_match == HistoryStore::NOT_FOUND ? m_history.size() : m_match + 1);
+            }
+            else {
+                insert(text);
+            }
+            i = end;
+            continue;
+        }
+
+        if (c == '\t' && !m_searching) {
+            complete(afterTab);
+            m_lastTab = true;
+        }
+        else {
+            handleControl(c);
+        }
+        ++i;
+    }
+    return i;
+}
+
+size_t LineEditor::sequenceLength(const char* data, size_t size) {
+    // ESC on its own at the end of a read is the Escape key; terminals
+    // send the sequences keys make in one piece
+    if (size < 2) {
+        return 1;
+    }
+    if (data[1] == '[') {
+        size_t end = 2;
+        while (end < size && static_cast<unsigned char>(data[end]) >= 0x20 &&
+            static_cast<unsigned char>(data[end]) <= 0x3F) {
+            ++end;
+        }
+        return end < size ? end + 1 : 0;
+    }
+    if (data[1] == 'O') {
+        return size < 3 ? 0 : 3;
+    }
+    return 2;
+}
+
+void LineEditor::handleSequence(std::string_view sequence) {
+    if (sequence == std::string_view(PASTE_START, sizeof(PASTE_START) - 1)) {
+        if (m_searching) {
+            endSearch(true);
+        }
+        m_pasting = true;
+        m_paste.clear();
+        return;
+    }
+    if (m_searching) {
+        endSearch(true);
+        if (sequence.size() == 1) {
+            return;
+        }
+    }
+
+    // Alt-key
+    if (sequence.size() == 2) {
+        switch (sequence[1]) {
+        case 'b': m_cursor = wordStart(m_cursor); break;
+        case 'f': m_cursor = wordEnd(m_cursor); break;
+        case 'd': erase(m_cursor, wordEnd(m_cursor)); break;
+        case 0x7F:
+        case 0x08: erase(wordStart(m_cursor), m_cursor); break;
+        case '\r': insert("\n"); break;
+        default: break;
+        }
+        return;
+    }
+    if (sequence.size() < 3) {
+        return;
+    }
+
+    // CSI or SS3: the final byte names the key, the parameters before it
+    // the key for ~ sequences and the modifiers
+    char key = sequence.back();
+    std::string_view parameters = sequence.substr(2, sequence.size() - 3);
+    bool control = parameters.find(";5") != std::string_view::npos;
+    if (key == '~') {
+        int number = std::atoi(std::string(parameters).c_str());
+        key = number == 1 || number == 7 ? 'H' : number == 4 || number == 8 ? 'F' : number == 3 ? 'X' : 0;
+    }
+
+    switch (key) {
+    case 'A':
+        historyMove(true);
+        break;
+    case 'B':
+        historyMove(false);
+        break;
+    case 'C':
+        if (control) {
+            m_cursor = wordEnd(m_cursor);
+        }
+        else if (m_cursor < m_buffer.size()) {
+            do {
+                ++m_cursor;
+            } while (m_cursor < m_buffer.size() && isContinuation(static_cast<unsigned char>(m_buffer[m_cursor])));
+        }
+        break;
+    case 'D':
+        if (control) {
+            m_cursor = wordStart(m_cursor);
+        }
+        else if (m_cursor > 0) {
+            do {
+                --m_cursor;
+            } while (m_cursor > 0 && isContinuation(static_cast<unsigned char>(m_buffer[m_cursor])));
+        }
+        break;
+    case 'H':
+        m_cursor = 0;
+        break;
+    case 'F':
+        m_cursor = m_buffer.size();
+        break;
+    case 'X':
+        if (m_cursor < m_buffer.size()) {
+            size_t end = m_cursor + 1;
+            while (end < m_buffer.size() && isContinuation(static_cast<unsigned char>(m_buffer[end]))) {
+                ++end;
+            }
+            erase(m_cursor, end);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void LineEditor::handleControl(unsigned char c) {
+    if (m_searching) {
+        switch (c) {
+        case 0x12:  // Ctrl-R: next older match
+            startSearch();
+            return;
+        case 0x08:
+        case 0x7F:
+            if (!m_query.empty()) {
+                m_query.pop_back();
+                m_match = HistoryStore::NOT_FOUND;
+                searchFor(m_history.size());
+            }
+            return;
+        case 0x07:  // Ctrl-G: give up, back to the line as it was
+        case 0x03:
+            endSearch(false);
+            if (c == 0x07) {
+                return;
+            }
+            break;
+        default:
+            endSearch(true);
+            break;
+        }
+    }
+
+    switch (c) {
+    case '\r':
+    case '\n':
+        finish(false);
+        break;
+
+    case 0x01:  // Ctrl-A
+        m_cursor = 0;
+        break;
+
+    case 0x02:  // Ctrl-B
+        handleSequence("\x1b[D");
+        break;
+
+    case 0x03:  // Ctrl-C: abandon the line
+        draw();
+        moveTo(m_shown.rows.size() - 1, cells(m_shown.rows.back()));
+        m_output += "^C\r\n\x1b[?2004l";
+        flush();
+        m_buffer.clear();
+        m_done = true;
+        break;
+
+    case 0x04:  // Ctrl-D: end of input on an empty line, else delete
+        if (m_buffer.empty()) {
+            finish(true);
+        }
+        else {
+            handleSequence("\x1b[3~");
+        }
+        break;
+
+    case 0x05:  // Ctrl-E
+        m_cursor = m_buffer.size();
+        break;
+
+    case 0x06:  // Ctrl-F
+        handleSequence("\x1b[C");
+        break;
+
+    case 0x08:  // Backspace
+    case 0x7F:
+        if (m_cursor > 0) {
+            size_t start = m_cursor - 1;
+            while (start > 0 && isContinuation(static_cast<unsigned char>(m_buffer[start]))) {
+                --start;
+            }
+            erase(start, m_cursor);
+        }
+        break;
+
+    case 0x0B:  // Ctrl-K
+        erase(m_cursor, m_buffer.size());
+        break;
+
+    case 0x0C:  // Ctrl-L: clear the screen and draw afresh
+        m_output += "\x1b[H\x1b[2J";
+        m_shown = Frame();
+        m_row = 0;
+        m_column = 0;
+        m_screenRows = 1;
+        break;
+
+    case 0x0E:  // Ctrl-N
+        historyMove(false);
+        break;
+
+    case 0x10:  // Ctrl-P
+        historyMove(true);
+        break;
+
+    case 0x12:  // Ctrl-R
+        startSearch();
+        break;
+
+    case 0x15:  // Ctrl-U
+        erase(0, m_cursor);
+        break;
+
+    case 0x17:  // Ctrl-W
+        erase(wordStart(m_cursor), m_cursor);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void LineEditor::insert(std::string_view text) {
+    m_buffer.insert(m_cursor, text.data(), text.size());
+    m_cursor += text.size();
+}
+
+void LineEditor::insertPaste() {
+    // Terminals send pasted line breaks as \r
+    std::string text;
+    text.reserve(m_paste.size());
+    for (size_t i = 0; i < m_paste.size(); ++i) {
+        char c = m_paste[i];
+        if (c == '\r') {
+            if (i + 1 < m_paste.size() && m_paste[i + 1] == '\n') {
+                ++i;
+            }
+            c = '\n';
+        }
+        text += c;
+    }
+    insert(text);
+    m_paste.clear();
+    m_paste.shrink_to_fit();
+}
+
+void LineEditor::erase(size_t from, size_t to) {
+    if (from < to) {
+        m_buffer.erase(from, to - from);
+        m_cursor = from;
+    }
+}
+
+size_t LineEditor::wordStart(size_t from) const {
+    while (from > 0 && isSpace(m_buffer[from - 1])) {
+        --from;
+    }
+    while (from > 0 && !isSpace(m_buffer[from - 1])) {
+        --from;
+    }
+    return from;
+}
+
+size_t LineEditor::wordEnd(size_t from) const {
+    while (from < m_buffer.size() && isSpace(m_buffer[from])) {
+        ++from;
+    }
+    while (from < m_buffer.size() && !isSpace(m_buffer[from])) {
+        ++from;
+    }
+    return from;
+}
+
+void LineEditor::historyMove(bool older) {
+    size_t count = m_history.size();
+    if (older ? m_historyIndex == 0 : m_historyIndex >= count) {
+        return;
+    }
+    if (m_historyIndex == count) {
+        m_draft = m_buffer;
+    }
+
+    m_historyIndex += older ? -1 : 1;
+    if (m_historyIndex == count) {
+        m_buffer = m_draft;
+    }
+    else {
+        m_buffer.assign(m_history.entry(m_historyIndex));
+    }
+    m_cursor = m_buffer.size();
+}
+
+void LineEditor::complete(bool list) {
+    if (!m_completer) {
+        return;
+    }
+
+    // The word ends at the cursor and starts after the last unescaped break
+    size_t start = m_cursor;
+    while (start > 0 && !(isWordBreak(m_buffer[start - 1]) && (start < 2 || m_buffer[start - 2] != '\\'))) {
+        --start;
+    }
+    size_t before = start;
+    while (before > 0 && isSpace(m_buffer[before - 1]) && m_buffer[before - 1] != '\n') {
+        --before;
+    }
+    bool commandPosition = before == 0 || std::strchr(";|&(\n", m_buffer[before - 1]) != nullptr;
+
+    std::string word = unescapeWord(std::string_view(m_buffer).substr(start, m_cursor - start));
+    std::vector<CompletionIndex::Match> matches;
+    m_completer(word, commandPosition, matches);
+    if (matches.empty()) {
+        m_output += '\a';
+        return;
+    }
+
+    if (matches.size() == 1) {
+        std::string text = escapeWord(matches[0].text) + (matches[0].directory ? "/" : " ");
+        erase(start, m_cursor);
+        insert(text);
+        return;
+    }
+
+    size_t common = matches[0].text.size();
+    for (const auto& match : matches) {
+        size_t same = 0;
+        while (same < common && same < match.text.size() && match.text[same] == matches[0].text[same]) {
+            ++same;
+        }
+        common = same;
+    }
+    if (common > word.size()) {
+        erase(start, m_cursor);
+        insert(escapeWord(std::string_view(matches[0].text).substr(0, common)));
+        return;
+    }
+    if (!list) {
+        m_output += '\a';
+        return;
+    }
+
+    // Second Tab: list the candidates in columns below the line, then draw
+    // the line again under them. Paths are listed by their last component.
+    size_t lead = word.rfind('/') + 1;
+    size_t width = 0;
+    for (const auto& match : matches) {
+        width = std::max(width, cells(match.text) - lead + (match.directory ? 1 : 0));
+    }
+    width += 2;
+    size_t perRow = std::max<size_t>(1, terminalColumns() / width);
+
+    draw();
+    moveTo(m_shown.rows.size() - 1, cells(m_shown.rows.back()));
+    m_output += "\r\n";
+    for (size_t i = 0; i < matches.size(); ++i) {
+        const auto& match = matches[i];
+        m_output.append(match.text, lead, std::string::npos);
+        if (match.directory) {
+            m_output += '/';
+        }
+        bool rowEnd = (i + 1) % perRow == 0 || i + 1 == matches.size();
+        if (rowEnd) {
+            m_output += "\r\n";
+        }
+        else {
+            m_output.append(width - (cells(match.text) - lead) - (match.directory ? 1 : 0), ' ');
+        }
+    }
+    m_shown = Frame();
+    m_row = 0;
+    m_column = 0;
+    m_screenRows = 1;
+}
+
+void LineEditor::finish(bool eof) {
+    if (m_searching) {
+        endSearch(true);
+    }
+    m_done = true;
+    m_eof = eof;
+
+    draw();
+    moveTo(m_shown.rows.size() - 1, cells(m_shown.rows.back()));
+    m_output += "\r\n\x1b[?2004l";
+    flush();
+}
+
+void LineEditor::startSearch() {
+    if (m_searching) {
+        searchFor(m_match == HistoryStore::NOT_FOUND ? m_history.size() : m_match);
+        return;
+    }
+    m_searching = true;
+    m_searchFailed = false;
+    m_query.clear();
+    m_match = HistoryStore::NOT_FOUND;
+    m_beforeSearch = m_buffer;
+    m_cursorBeforeSearch = m_cursor;
+}
+
+void LineEditor::searchFor(size_t before) {
+    if (m_query.empty()) {
+        m_searchFailed = false;
+        return;
+    }
+
+    size_t id = m_history.searchBackward(m_query, before);
+    m_searchFailed = id == HistoryStore::NOT_FOUND;
+    if (m_searchFailed) {
+        return;
+    }
+
+    m_match = id;
+    m_buffer.assign(m_history.entry(id));
+    size_t found = m_buffer.find(m_query);
+    m_cursor = found != std::string::npos ? found : m_buffer.size();
+}
+
+void LineEditor::endSearch(bool keep) {
+    m_searching = false;
+    if (!keep) {
+        m_buffer = m_beforeSearch;
+        m_cursor = m_cursorBeforeSearch;
+    }
+    m_historyIndex = m_history.size();
+}
+
+LineEditor::Frame LineEditor::layout(size_t columns) const {
+    Frame frame;
+    frame.rows.emplace_back();
+    size_t column = 0;
+
+    std::string label;
+    if (m_searching) {
+        label = (m_searchFailed ? "(failed reverse-i-search)`" : "(reverse-i-search)`") + m_query + "': ";
+    }
+    const std::string& head = m_searching ? label : m_prompt;
+
+    // Control characters show as ^X and tabs as spaces to the next stop
+    auto place = [&](unsigned char c, bool cursor) {
+        if (c == '\n') {
+            if (cursor) {
+                frame.cursorRow = frame.rows.size() - 1;
+                frame.cursorColumn = std::min(column, columns - 1);
+            }
+            frame.rows.emplace_back();
+            column = 0;
+            return;
+        }
+
+        size_t width = isContinuation(c) ? 0 : 1;
+        if (c == '\t') {
+            width = 8 - column % 8;
+        }
+        else if (c < 0x20 || c == 0x7F) {
+            width = 2;
+        }
+        if (width > 0 && column + width > columns) {
+            frame.rows.emplace_back();
+            column = 0;
+        }
+        if (cursor) {
+            frame.cursorRow = frame.rows.size() - 1;
+            frame.cursorColumn = column;
+        }
+
+        std::string& row = frame.rows.back();
+        if (c == '\t') {
+            row.append(std::min(width, columns - column), ' ');
+        }
+        else if (c < 0x20 || c == 0x7F) {
+            row += '^';
+            row += static_cast<char>(c ^ 0x40);
+        }
+        else {
+            row += static_cast<char>(c);
+        }
+        column += width;
+    };
+
+    for (char c : head) {
+        place(static_cast<unsigned char>(c), false);
+    }
+    for (size_t i = 0; i < m_buffer.size(); ++i) {
+        place(static_cast<unsigned char>(m_buffer[i]), i == m_cursor);
+    }
+
+    if (m_cursor >= m_buffer.size()) {
+        if (column >= columns) {
+            frame.rows.emplace_back();
+            column = 0;
+        }
+        frame.cursorRow = frame.rows.size() - 1;
+        frame.cursorColumn = column;
+    }
+    return frame;
+}
+
+void LineEditor::draw() {
+    size_t columns = terminalColumns();
+
+    // A resized terminal has reflowed what is on screen; start over from
+    // the row the cursor is on
+    if (m_columns != 0 && columns != m_columns) {
+        m_output += '\r';
+        if (m_row > 0) {
+            appendMove(m_output, m_row, 'A');
+        }
+        m_output += "\x1b[J";
+        m_shown = Frame();
+        m_row = 0;
+        m_column = 0;
+        m_screenRows = 1;
+    }
+    m_columns = columns;
+
+    Frame frame = layout(columns);
+    for (size_t i = 0; i < frame.rows.size(); ++i) {
+        const std::string& row = frame.rows[i];
+        const std::string* old = i < m_shown.rows.size() ? &m_shown.rows[i] : nullptr;
+        if (old != nullptr && *old == row) {
+            continue;
+        }
+
+        // Rewrite from the first cell that differs
+        size_t same = 0;
+        if (old != nullptr) {
+            size_t limit = std::min(old->size(), row.size());
+            while (same < limit && (*old)[same] == row[same]) {
+                ++same;
+            }
+            while (same > 0 && same < row.size() && isContinuation(static_cast<unsigned char>(row[same]))) {
+                --same;
+            }
+        }
+
+        moveTo(i, cells(std::string_view(row).substr(0, same)));
+        m_output.append(row, same, std::string::npos);
+        m_column = cells(row);
+        if (old != nullptr && cells(*old) > m_column) {
+            m_output += "\x1b[K";
+        }
+
+        // A full row leaves the terminal waiting to wrap; a carriage return
+        // settles where the cursor is
+        if (m_column >= columns) {
+            m_output += '\r';
+            m_column = 0;
+        }
+    }
+
+    if (frame.rows.size() < m_shown.rows.size()) {
+        moveTo(frame.rows.size(), 0);
+        m_output += "\x1b[J";
+    }
+
+    moveTo(frame.cursorRow, frame.cursorColumn);
+    m_shown = std::move(frame);
+}
+
+void LineEditor::render() {
+    draw();
+    flush();
+}
+
+void LineEditor::moveTo(size_t row, size_t column) {
+    if (row > m_row) {
+        // Rows drawn before can be reached directly; new ones are made by
+        // line feeds, which scroll at the bottom of the screen
+        size_t reachable = std::min(row, m_screenRows - 1);
+        if (reachable > m_row) {
+            appendMove(m_output, reachable - m_row, 'B');
+            m_row = reachable;
+        }
+        while (m_row < row) {
+            m_output += "\r\n";
+            ++m_row;
+            m_column = 0;
+        }
+        m_screenRows = std::max(m_screenRows, m_row + 1);
+    }
+    else if (row < m_row) {
+        appendMove(m_output, m_row - row, 'A');
+        m_row = row;
+    }
+
+    if (column != m_column) {
+        if (column == 0) {
+            m_output += '\r';
+        }
+        else if (column > m_column) {
+            appendMove(m_output, column - m_column, 'C');
+        }
+        else {
+            appendMove(m_output, m_column - column, 'D');
+        }
+        m_column = column;
+    }
+}
+
+void LineEditor::flush() {
+    pipeio::writeAll(STDOUT_FILENO, m_output.data(), m_output.size());
+    m_output.clear();
+}
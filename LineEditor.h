@@ -0,0 +1,147 @@
+// LineEditor.h - Interactive line editing on a raw-mode terminal
+
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include "Completion.h"
+#include "HistoryStore.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <termios.h>
+#include <vector>
+
+// Reads command lines from a terminal in raw mode.
+//
+// Every key handler only edits the buffer. Once all input that has arrived
+// is processed, the prompt and buffer are laid out into screen rows and
+// compared with the rows on screen. Only what changed is sent: the cursor
+// moves to the first differing cell, the rest of that row is rewritten,
+// and rows that shrank are cleared. Each frame goes out in one write(), so
+// a keystroke over a slow link costs one small packet rather than a
+// repaint of the whole line, and typed-ahead keys cost one frame between
+// them. Bracketed paste is collected whole and inserted at once, so a large
+// paste costs time linear in its size. Pasted newlines stay in the buffer,
+// which then spans several rows.
+//
+// Keys: the usual Emacs-style movement and editing keys, Up/Down and
+// Ctrl-P/Ctrl-N through history, Ctrl-R incremental history search, Tab
+// completion (twice lists the candidates) and Alt-Enter for a newline.
+class LineEditor {
+public:
+    // Fills out with the completions of a word, command names when the
+    // word is in command position
+    using Completer = std::function<void(std::string_view word, bool commandPosition,
+        std::vector<CompletionIndex::Match>& out)>;
+
+    LineEditor(HistoryStore& history, Completer completer);
+    ~LineEditor();
+
+    LineEditor(const LineEditor&) = delete;
+    LineEditor& operator=(const LineEditor&) = delete;
+
+    // Whether input and output are a terminal the editor can drive
+    bool isInteractive() const { return m_interactive; }
+
+    // Read one line, drawing prompt in front of it. Returns false at the
+    // end of input: Ctrl-D on an empty line, or the terminal going away.
+    bool readLine(const std::string& prompt, std::string& line);
+
+private:
+    // Screen rows of the prompt and buffer, as the bytes written for each,
+    // and where the cursor goes
+    struct Frame {
+        std::vector<std::string> rows;
+        size_t cursorRow = 0;
+        size_t cursorColumn = 0;
+    };
+
+    bool enterRawMode();
+    void leaveRawMode();
+
+    // Handle a batch of input; stops early once a line is finished, or at
+    // an incomplete escape sequence, and returns the bytes consumed
+    size_t process(const char* data, size_t size);
+
+    // Length of the escape sequence at data[0], 0 if more input is needed
+    static size_t sequenceLength(const char* data, size_t size);
+
+    void handleSequence(std::string_view sequence);
+    void handleControl(unsigned char c);
+
+    // Editing
+    void insert(std::string_view text);
+    void insertPaste();
+    void erase(size_t from, size_t to);
+    size_t wordStart(size_t from) const;
+    size_t wordEnd(size_t from) const;
+    void historyMove(bool older);
+    void complete(bool list);
+    void finish(bool eof);
+
+    // Incremental search
+    void startSearch();
+    void searchFor(size_t before);
+    void endSearch(bool keep);
+
+    // Lay out the current state for a terminal of the given width
+    Frame layout(size_t columns) const;
+
+    // Queue what turns the screen from m_shown into the current state
+    void draw();
+
+    // Draw and write the frame out
+    void render();
+
+    // Queue cursor movement to a row and column of the frame
+    void moveTo(size_t row, size_t column);
+
+    void flush();
+
+    HistoryStore& m_history;
+    Completer m_completer;
+    bool m_interactive;
+
+    struct termios m_savedMode;
+    bool m_raw;
+
+    std::string m_prompt;
+    std::string m_buffer;
+    size_t m_cursor;
+    bool m_done;
+    bool m_eof;
+
+    // History browsing: entry shown, or the history size for the line
+    // being written, which is kept in m_draft meanwhile
+    size_t m_historyIndex;
+    std::string m_draft;
+
+    // Ctrl-R search
+    bool m_searching;
+    std::string m_query;
+    size_t m_match;
+    bool m_searchFailed;
+    std::string m_beforeSearch;
+    size_t m_cursorBeforeSearch;
+
+    // A paste in progress, and input held over to the next batch
+    bool m_pasting;
+    std::string m_paste;
+    std::string m_pending;
+
+    // Tab pressed last, so another lists the candidates
+    bool m_lastTab;
+
+    // What is on screen: its rows, the terminal cursor, and how many rows
+    // exist below the first so the cursor can move down without scrolling
+    Frame m_shown;
+    size_t m_columns;
+    size_t m_row;
+    size_t m_column;
+    size_t m_screenRows;
+
+    // Output of the frame being built
+    std::string m_output;
+};
+
+#endif // LINE_EDITOR_H
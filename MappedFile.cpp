@@ -0,0 +1,104 @@
+// MappedFile.cpp - Read-only memory-mapped file implementation
+
+#include "MappedFile.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    // Release memory in steps of at least this much to keep madvise calls rare
+    const size_t RELEASE_STEP = 4 * 1024 * 1024;
+}
+
+MappedFile::MappedFile()
+    : m_data(nullptr), m_size(0), m_released(0), m_mapped(false) {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        ::close(fd);
+        errno = EISDIR;
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            ::close(fd);
+            madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(data);
+            m_size = static_cast<size_t>(st.st_size);
+            m_mapped = true;
+            return true;
+        }
+    }
+
+    // Not mappable: read it instead
+    char chunk[64 * 1024];
+    while (true) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return false;
+        }
+        m_buffer.append(chunk, static_cast<size_t>(n));
+    }
+    ::close(fd);
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_mapped) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_released = 0;
+    m_mapped = false;
+    m_buffer.clear();
+}
+
+void MappedFile::release(size_t offset) {
+    if (!m_mapped || offset < m_released + RELEASE_STEP) {
+        return;
+    }
+
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t end = offset / pageSize * pageSize;
+    if (end > m_released) {
+        madvise(const_cast<char*>(m_data) + m_released, end - m_released, MADV_DONTNEED);
+        m_released = end;
+    }
+}
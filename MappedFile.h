@@ -0,0 +1,48 @@
+// MappedFile.h - Read-only memory-mapped file
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <string_view>
+
+// Maps a whole file read-only so it can be lexed in place.
+//
+// The mapping is advised for sequential access, and release() lets a
+// streaming reader hand already-consumed pages back to the kernel, so the
+// resident size stays bounded however large the file is. Inputs that cannot
+// be mapped (pipes, character devices) are read into memory instead.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map a file; on failure returns false with errno set
+    bool open(const std::string& path);
+
+    // Unmap the file
+    void close();
+
+    // Contents of the file
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+
+    // Drop the pages wholly before offset from memory. They stay mapped and
+    // are faulted back in from the file if touched again.
+    void release(size_t offset);
+
+    // Start releasing from the beginning again, after a pass over the file
+    // that released pages behind it
+    void rewind() { m_released = 0; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+    size_t m_released;
+    bool m_mapped;
+    std::string m_buffer; // Contents of inputs that could not be mapped
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,368 @@
+// Parallel.cpp - Parallel job runner implementation
+
+#include "Parallel.h"
+#include "Executor.h"
+#include "Parser.h"
+#include "PipeIO.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+    // Exit status cap, as in GNU parallel
+    const size_t MAX_FAILURE_STATUS = 101;
+
+    const char* const PLACEHOLDERS[] = { "{}", "{.}", "{/}", "{//}", "{#}" };
+
+    // First read size for argument lists and parked job output
+    const size_t READ_CHUNK = 4096;
+
+    // Anonymous file a job's output is collected in
+    int makeCaptureFile() {
+#ifdef __linux__
+        int fd = memfd_create("cppshell-parallel", MFD_CLOEXEC);
+        if (fd >= 0) {
+            return fd;
+        }
+#endif
+        char path[] = "/tmp/cppshell-parallel-XXXXXX";
+        int file = mkstemp(path);
+        if (file >= 0) {
+            unlink(path);
+            fcntl(file, F_SETFD, FD_CLOEXEC);
+        }
+        return file;
+    }
+
+    // Empty a capture file for the next job
+    void resetCapture(int fd) {
+        if (ftruncate(fd, 0) == 0) {
+            lseek(fd, 0, SEEK_SET);
+        }
+    }
+}
+
+Parallel::Parallel(Executor& executor)
+    : m_executor(executor), m_slots(0), m_keepOrder(false), m_ungrouped(false),
+    m_failFast(false), m_nullFd(-1), m_halted(false), m_failed(0), m_nextToEmit(0) {}
+
+Parallel::~Parallel() {
+    if (m_nullFd >= 0) {
+        close(m_nullFd);
+    }
+}
+
+int Parallel::run(const std::vector<std::string>& args, const IoFds& fds, std::string& err) {
+    unsigned cores = std::thread::hardware_concurrency();
+    m_slots = cores > 0 ? cores : 1;
+    m_fds = fds;
+
+    // Options
+    size_t pos = 0;
+    for (; pos < args.size(); ++pos) {
+        const std::string& arg = args[pos];
+        if (arg == "--") {
+            ++pos;
+            break;
+        }
+        if (arg == "-k" || arg == "--keep-order") {
+            m_keepOrder = true;
+        }
+        else if (arg == "-u" || arg == "--ungroup") {
+            m_ungrouped = true;
+        }
+        else if (arg == "--fail-fast") {
+            m_failFast = true;
+        }
+        else if (arg == "-j" || arg == "--jobs" || (arg.size() > 2 && arg.compare(0, 2, "-j") == 0)) {
+            std::string value = arg.size() > 2 && arg[1] == 'j' ? arg.substr(2) : std::string();
+            if (value.empty()) {
+                if (pos + 1 >= args.size()) {
+                    err += "parallel: " + arg + ": option requires an argument\n";
+                    return 2;
+                }
+                value = args[++pos];
+            }
+            char* end = nullptr;
+            unsigned long slots = std::strtoul(value.c_str(), &end, 10);
+            if (end == value.c_str() || *end != '\0') {
+                err += "parallel: " + value + ": invalid job count\n";
+                return 2;
+            }
+            m_slots = static_cast<size_t>(slots);
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            err += "parallel: " + arg + ": invalid option\n";
+            err += "parallel: usage: parallel [-j slots] [-k] [-u] [--fail-fast] command... [::: arg...]\n";
+            return 2;
+        }
+        else {
+            break;
+        }
+    }
+
+    // Command template, then the arguments
+    std::string source;
+    bool haveArguments = false;
+    for (; pos < args.size(); ++pos) {
+        if (args[pos] == ":::") {
+            haveArguments = true;
+            m_arguments.assign(args.begin() + static_cast<std::ptrdiff_t>(pos) + 1, args.end());
+            break;
+        }
+        if (!source.empty()) {
+            source += ' ';
+        }
+        source += args[pos];
+    }
+
+    if (source.empty()) {
+        err += "parallel: usage: parallel [-j slots] [-k] [-u] [--fail-fast] command... [::: arg...]\n";
+        return 2;
+    }
+
+    bool hasPlaceholder = false;
+    for (const char* placeholder : PLACEHOLDERS) {
+        hasPlaceholder = hasPlaceholder || source.find(placeholder) != std::string::npos;
+    }
+    if (!hasPlaceholder) {
+        source += " {}";
+    }
+
+    // Words, not text, are substituted, so an argument containing spaces or
+    // operators stays a single word
+    try {
+        Parser parser(source);
+        m_template = parser.parse(m_templateArena);
+    }
+    catch (const ParseError& e) {
+        err += std::string("parallel: ") + e.what() + "\n";
+        return 2;
+    }
+
+    if (!haveArguments) {
+        std::string input;
+        pipeio::readAll(fds.in, input, READ_CHUNK);
+        size_t start = 0;
+        while (start < input.size()) {
+            size_t newline = input.find('\n', start);
+            if (newline == std::string::npos) {
+                newline = input.size();
+            }
+            m_arguments.push_back(input.substr(start, newline - start));
+            start = newline + 1;
+        }
+    }
+
+    if (m_arguments.empty()) {
+        return 0;
+    }
+
+    // Jobs never share the shell's input
+    m_nullFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (m_keepOrder) {
+        m_pending.resize(m_arguments.size());
+    }
+
+    size_t workers = m_slots == 0 ? m_arguments.size() : std::min(m_slots, m_arguments.size());
+    for (size_t i = 0; i < workers; ++i) {
+        m_queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t job = 0; job < m_arguments.size(); ++job) {
+        m_queues[job % workers]->jobs.push_back(job);
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back(&Parallel::work, this, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Jobs skipped by --fail-fast leave gaps that -k would wait on forever;
+    // whatever finished after a gap is written out now
+    for (const auto& output : m_pending) {
+        if (output.done) {
+            pipeio::writeAll(m_fds.out, output.out.data(), output.out.size());
+            pipeio::writeAll(m_fds.err, output.err.data(), output.err.size());
+        }
+    }
+
+    return static_cast<int>(std::min(m_failed.load(), MAX_FAILURE_STATUS));
+}
+
+void Parallel::work(size_t worker) {
+    // Each worker keeps its own arena and capture files for all its jobs
+    CommandArena arena;
+    int outFd = -1;
+    int errFd = -1;
+    if (!m_ungrouped) {
+        outFd = makeCaptureFile();
+        errFd = makeCaptureFile();
+    }
+
+    size_t job = 0;
+    while (!m_halted && takeJob(worker, job)) {
+        arena.clear();
+        Command command = arena.get(instantiate(m_template, arena, job));
+
+        IoFds jobFds = m_fds;
+        jobFds.in = m_nullFd >= 0 ? m_nullFd : m_fds.in;
+        if (outFd >= 0 && errFd >= 0) {
+            jobFds.out = outFd;
+            jobFds.err = errFd;
+        }
+
+        int status = m_executor.executeJob(command, jobFds);
+        if (status != 0) {
+            m_failed.fetch_add(1);
+            if (m_failFast) {
+                m_halted = true;
+            }
+        }
+
+        if (outFd >= 0 && errFd >= 0) {
+            emit(job, outFd, errFd);
+            resetCapture(outFd);
+            resetCapture(errFd);
+        }
+    }
+
+    if (outFd >= 0) {
+        close(outFd);
+    }
+    if (errFd >= 0) {
+        close(errFd);
+    }
+}
+
+bool Parallel::takeJob(size_t worker, size_t& job) {
+    {
+        WorkQueue& own = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Steal the newest job of the next non-empty queue
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        WorkQueue& victim = *m_queues[(worker + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+NodeIndex Parallel::instantiate(const Command& node, CommandArena& arena, size_t job) const {
+    if (node.getType() == CommandType::SIMPLE) {
+        const SimpleCommand& source = node.getCommand();
+        SimpleCommand command(substitute(source.getName(), job), source.getNameFlags());
+        const std::vector<std::string>& args = source.getArguments();
+        for (size_t i = 0; i < args.size(); ++i) {
+            command.addArgument(substitute(args[i], job), source.getArgumentFlags(i));
+        }
+        for (const auto& redir : source.getRedirections()) {
+            command.addRedirection(redir.type, substitute(redir.target, job));
+        }
+        const std::vector<std::string>& assignments = source.getAssignments();
+        for (size_t i = 0; i < assignments.size(); ++i) {
+            command.addAssignment(substitute(assignments[i], job), source.getAssignmentFlags(i));
+        }
+        return arena.addSimple(std::move(command));
+    }
+
+    std::vector<NodeIndex> children;
+    children.reserve(node.getChildCount());
+    for (size_t i = 0; i < node.getChildCount(); ++i) {
+        children.push_back(instantiate(node.getChild(i), arena, job));
+    }
+    return arena.addList(node.getType(), children.data(), children.size());
+}
+
+std::string Parallel::substitute(const std::string& word, size_t job) const {
+    if (word.find('{') == std::string::npos) {
+        return word;
+    }
+
+    const std::string& arg = m_arguments[job];
+    size_t slash = arg.rfind('/');
+    std::string base = slash == std::string::npos ? arg : arg.substr(slash + 1);
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : arg.substr(0, slash));
+    size_t dot = arg.rfind('.');
+    std::string stem = dot == std::string::npos || (slash != std::string::npos && dot < slash)
+        ? arg : arg.substr(0, dot);
+
+    std::string result;
+    for (size_t i = 0; i < word.size(); ++i) {
+        if (word.compare(i, 2, "{}") == 0) {
+            result += arg;
+            i += 1;
+        }
+        else if (word.compare(i, 3, "{.}") == 0) {
+            result += stem;
+            i += 2;
+        }
+        else if (word.compare(i, 3, "{/}") == 0) {
+            result += base;
+            i += 2;
+        }
+        else if (word.compare(i, 4, "{//}") == 0) {
+            result += dir;
+            i += 3;
+        }
+        else if (word.compare(i, 3, "{#}") == 0) {
+            result += std::to_string(job + 1);
+            i += 2;
+        }
+        else {
+            result += word[i];
+        }
+    }
+    return result;
+}
+
+void Parallel::emit(size_t job, int outFd, int errFd) {
+    std::lock_guard<std::mutex> lock(m_outputMutex);
+
+    // Out of turn under -k: park the output until the jobs before it are out
+    if (m_keepOrder && job != m_nextToEmit) {
+        lseek(outFd, 0, SEEK_SET);
+        lseek(errFd, 0, SEEK_SET);
+        pipeio::readAll(outFd, m_pending[job].out, READ_CHUNK);
+        pipeio::readAll(errFd, m_pending[job].err, READ_CHUNK);
+        m_pending[job].done = true;
+        return;
+    }
+
+    lseek(outFd, 0, SEEK_SET);
+    lseek(errFd, 0, SEEK_SET);
+    pipeio::drain(outFd, m_fds.out);
+    pipeio::drain(errFd, m_fds.err);
+
+    if (!m_keepOrder) {
+        return;
+    }
+
+    for (++m_nextToEmit; m_nextToEmit < m_pending.size() && m_pending[m_nextToEmit].done; ++m_nextToEmit) {
+        PendingOutput& output = m_pending[m_nextToEmit];
+        pipeio::writeAll(m_fds.out, output.out.data(), output.out.size());
+        pipeio::writeAll(m_fds.err, output.err.data(), output.err.size());
+        output = PendingOutput();
+    }
+}
@@ -0,0 +1,98 @@
+// Parallel.h - Parallel job runner behind the `parallel` builtin
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "Command.h"
+#include "ProcessSpawner.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Executor;
+
+// Runs one command template per argument on a fixed number of job slots.
+//
+//   parallel [-j slots] [-k] [-u] [--fail-fast] command... [::: arg...]
+//
+// The command is parsed once into a template tree. Each job copies that tree
+// with the placeholders {} (the argument), {.} (without extension), {/}
+// (basename), {//} (dirname) and {#} (job number) filled in; without any
+// placeholder the argument is appended. Jobs run through the executor, so
+// pipelines, lists, builtins and redirections all work. Without ::: the
+// arguments are the lines of standard input.
+//
+// Slots default to the number of cores. Each slot is a worker thread with
+// its own deque of jobs; a worker takes the oldest job of its own deque and,
+// when that is empty, steals the newest job of another's. A job's output is
+// collected and written in one piece when it finishes (-u writes it
+// directly), in completion order or, with -k, in argument order. With
+// --fail-fast no new jobs start once one has failed. The status is the
+// number of failed jobs, capped at 101.
+class Parallel {
+public:
+    explicit Parallel(Executor& executor);
+    ~Parallel();
+
+    Parallel(const Parallel&) = delete;
+    Parallel& operator=(const Parallel&) = delete;
+
+    // Run the builtin; job output goes to fds, usage errors to err
+    int run(const std::vector<std::string>& args, const IoFds& fds, std::string& err);
+
+private:
+    // A worker's jobs; the owner takes from the front, thieves from the back
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+
+    // Output of a finished job waiting for its turn under -k
+    struct PendingOutput {
+        bool done = false;
+        std::string out;
+        std::string err;
+    };
+
+    // Worker thread body
+    void work(size_t worker);
+
+    // Take the next job for a worker, stealing if its own queue is empty
+    bool takeJob(size_t worker, size_t& job);
+
+    // Copy the template with the placeholders filled in for a job
+    NodeIndex instantiate(const Command& node, CommandArena& arena, size_t job) const;
+    std::string substitute(const std::string& word, size_t job) const;
+
+    // Hand a finished job's captured output over to fds
+    void emit(size_t job, int outFd, int errFd);
+
+    Executor& m_executor;
+
+    // Parsed command template and the argument of every job
+    CommandArena m_templateArena;
+    Command m_template;
+    std::vector<std::string> m_arguments;
+
+    // Options
+    size_t m_slots;
+    bool m_keepOrder;
+    bool m_ungrouped;
+    bool m_failFast;
+
+    IoFds m_fds;
+    int m_nullFd;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::atomic<bool> m_halted;
+    std::atomic<size_t> m_failed;
+
+    // Output ordering, guarded by m_outputMutex
+    std::mutex m_outputMutex;
+    std::vector<PendingOutput> m_pending;
+    size_t m_nextToEmit;
+};
+
+#endif // PARALLEL_H
@@ -1,101 +1,169 @@
 // Parser.cpp - Command parser implementation
 
 #include "Parser.h"
-
-Parser::Parser(const std::string& input)
-    : m_lexer(input), m_current(0) {
-    // Tokenize the entire input
-    m_tokens = m_lexer.tokenize();
+#include "Environment.h"
+#include "ShellStats.h"
+
+Parser::Parser(std::string_view input)
+    : m_arena(nullptr), m_lexer(input), m_current(TokenType::END_OF_INPUT), m_operands(nullptr) {
+    // Prime the lookahead
+    stats::Scope scope(stats::Subsystem::LEXER);
+    m_current = m_lexer.nextToken();
 }
 
-std::shared_ptr<Command> Parser::parse() {
+Command Parser::parse(CommandArena& arena) {
+    stats::Scope scope(stats::Subsystem::PARSER);
+    m_arena = &arena;
+    m_operands = &arena.operandStack();
+    m_operands->clear();
+
     // Start parsing from the top-level rule
-    auto command = parseCommand();
+    NodeIndex command = parseCommand();
 
-    // Check if we reached the end of input
-    if (m_current < m_tokens.size() &&
-        m_tokens[m_current].getType() != TokenType::END_OF_INPUT) {
+    // Check if we reached the end of input. A here-document leaves the
+    // newline ending its command line, and its body, behind.
+    while (match(TokenType::NEWLINE)) {
+    }
+    if (!isAtEnd()) {
         throw ParseError("Unexpected tokens at end of input");
     }
 
-    return command;
+    return arena.get(command);
+}
+
+bool Parser::parseNext(CommandArena& arena, Command& command) {
+    stats::Scope scope(stats::Subsystem::PARSER);
+    m_arena = &arena;
+    m_operands = &arena.operandStack();
+    m_operands->clear();
+
+    // Skip blank lines
+    while (match(TokenType::NEWLINE)) {
+    }
+
+    if (isAtEnd()) {
+        return false;
+    }
+
+    NodeIndex index = parseCommand();
+
+    // The command must end at the end of its line. The newline itself is
+    // left as lookahead so nothing past it is lexed yet.
+    if (!isAtEnd() && !check(TokenType::NEWLINE)) {
+        throw ParseError("Unexpected tokens at end of line");
+    }
+
+    command = arena.get(index);
+    return true;
 }
 
-std::shared_ptr<Command> Parser::parseCommand() {
+NodeIndex Parser::parseCommand() {
     // Parse a command (sequence of commands separated by semicolons)
-    auto command = parseLogicalOr();
+    size_t base = m_operands->size();
+    m_operands->push_back(parseLogicalOr());
 
     while (match(TokenType::SEMICOLON)) {
-        auto right = parseLogicalOr();
-        command = std::make_shared<SequenceNode>(command, right);
+        // A trailing ; before the end of the line is allowed
+        if (isAtEnd() || check(TokenType::NEWLINE)) {
+            break;
+        }
+        m_operands->push_back(parseLogicalOr());
     }
 
+    NodeIndex command = makeList(CommandType::SEQUENCE, base);
+
     // Check for background execution
     if (match(TokenType::BACKGROUND)) {
-        command->setBackground(true);
+        m_arena->setBackground(command, true);
     }
 
     return command;
 }
 
-std::shared_ptr<Command> Parser::parseLogicalOr() {
+NodeIndex Parser::parseLogicalOr() {
     // Parse logical OR expressions (commands separated by ||)
-    auto command = parseLogicalAnd();
+    size_t base = m_operands->size();
+    m_operands->push_back(parseLogicalAnd());
 
     while (match(TokenType::OR_OPERATOR)) {
-        auto right = parseLogicalAnd();
-        command = std::make_shared<LogicalOrNode>(command, right);
+        m_operands->push_back(parseLogicalAnd());
     }
 
-    return command;
+    return makeList(CommandType::LOGICAL_OR, base);
 }
 
-std::shared_ptr<Command> Parser::parseLogicalAnd() {
+NodeIndex Parser::parseLogicalAnd() {
     // Parse logical AND expressions (commands separated by &&)
-    auto command = parsePipeline();
+    size_t base = m_operands->size();
+    m_operands->push_back(parsePipeline());
 
     while (match(TokenType::AND_OPERATOR)) {
-        auto right = parsePipeline();
-        command = std::make_shared<LogicalAndNode>(command, right);
+        m_operands->push_back(parsePipeline());
     }
 
-    return command;
+    return makeList(CommandType::LOGICAL_AND, base);
 }
 
-std::shared_ptr<Command> Parser::parsePipeline() {
+NodeIndex Parser::parsePipeline() {
     // Parse a pipeline (commands separated by pipes)
-    auto command = parseSimpleCommand();
+    size_t base = m_operands->size();
+    m_operands->push_back(parseSimpleCommand());
 
     while (match(TokenType::PIPE)) {
-        auto right = parseSimpleCommand();
-        command = std::make_shared<PipelineNode>(command, right);
+        m_operands->push_back(parseSimpleCommand());
     }
 
+    return makeList(CommandType::PIPELINE, base);
+}
+
+NodeIndex Parser::makeList(CommandType type, size_t base) {
+    std::vector<NodeIndex>& operands = *m_operands;
+    NodeIndex command = operands[base];
+    size_t count = operands.size() - base;
+    if (count > 1) {
+        command = m_arena->addList(type, operands.data() + base, count);
+    }
+    operands.resize(base);
     return command;
 }
 
-std::shared_ptr<Command> Parser::parseSimpleCommand() {
+NodeIndex Parser::parseSimpleCommand() {
     // Parse a simple command (command name + args + redirections)
     if (!check(TokenType::WORD)) {
         throw ParseError("Expected a command");
     }
 
-    Token nameToken = advance();
-    SimpleCommand cmd(nameToken.getValue());
+    // Leading NAME=value words are assignments; a command made of nothing
+    // else sets shell variables and has no name
+    std::vector<Token> assignments;
+    while (check(TokenType::WORD) && Environment::isAssignment(peek().getValue())) {
+        assignments.push_back(advance());
+    }
+
+    std::string name;
+    std::uint8_t nameFlags = 0;
+    if (check(TokenType::WORD)) {
+        Token word = advance();
+        name = std::string(word.getValue());
+        nameFlags = word.getFlags();
+    }
+    SimpleCommand cmd(name, nameFlags);
+    for (const auto& assignment : assignments) {
+        cmd.addAssignment(std::string(assignment.getValue()), assignment.getFlags());
+    }
 
     // Parse arguments and redirections
-    while (check(TokenType::WORD) || check(TokenType::REDIRECT_IN) ||
-        check(TokenType::REDIRECT_OUT) || check(TokenType::REDIRECT_APPEND)) {
-
+    while (check(TokenType::WORD) || peek().isRedirect()) {
         if (check(TokenType::WORD)) {
-            cmd.addArgument(advance().getValue());
+            Token word = advance();
+            cmd.addArgument(std::string(word.getValue()), word.getFlags());
         }
         else {
             parseRedirections(cmd);
         }
     }
 
-    return std::make_shared<SimpleCommandNode>(cmd);
+    return m_arena->addSimple(std::move(cmd));
 }
 
 void Parser::parseRedirections(SimpleCommand& cmd) {
@@ -103,32 +171,44 @@ void Parser::parseRedirections(SimpleCommand& cmd) {
     if (match(TokenType::REDIRECT_IN)) {
         // Input redirection
         expect(TokenType::WORD, "Expected filename after <");
-        cmd.addRedirection(RedirectType::INPUT, advance().getValue());
+        cmd.addRedirection(RedirectType::INPUT, std::string(advance().getValue()));
     }
     else if (match(TokenType::REDIRECT_OUT)) {
         // Output redirection
         expect(TokenType::WORD, "Expected filename after >");
-        cmd.addRedirection(RedirectType::OUTPUT, advance().getValue());
+        cmd.addRedirection(RedirectType::OUTPUT, std::string(advance().getValue()));
     }
     else if (match(TokenType::REDIRECT_APPEND)) {
         // Append redirection
         expect(TokenType::WORD, "Expected filename after >>");
-        cmd.addRedirection(RedirectType::APPEND, advance().getValue());
+        cmd.addRedirection(RedirectType::APPEND, std::string(advance().getValue()));
+    }
+    else if (check(TokenType::HEREDOC)) {
+        // The lexer has read the body already. A token with no text at all,
+        // not even an empty view into the input, had no delimiter word.
+        Token body = advance();
+        if (body.getValue().data() == nullptr) {
+            throw ParseError("Expected a delimiter after <<");
+        }
+        cmd.addRedirection(RedirectType::HEREDOC, std::string(body.getValue()));
+    }
+    else if (match(TokenType::HERESTRING)) {
+        expect(TokenType::WORD, "Expected a word after <<<");
+        cmd.addRedirection(RedirectType::HERESTRING, std::string(advance().getValue()));
     }
 }
 
-Token Parser::peek() const {
-    if (m_current >= m_tokens.size()) {
-        return Token(TokenType::END_OF_INPUT);
-    }
-    return m_tokens[m_current];
+const Token& Parser::peek() const {
+    return m_current;
 }
 
 Token Parser::advance() {
+    Token token = std::move(m_current);
     if (!isAtEnd()) {
-        m_current++;
+        stats::Scope scope(stats::Subsystem::LEXER);
+        m_current = m_lexer.nextToken();
     }
-    return m_tokens[m_current - 1];
+    return token;
 }
 
 bool Parser::check(TokenType type) const {
@@ -154,5 +234,5 @@ void Parser::expect(TokenType type, const std::string& message) {
 }
 
 bool Parser::isAtEnd() const {
-    return m_current >= m_tokens.size() ||
-        m_tokens[m_current].getType() == TokenType::END_OF_INPUT;
\ No newline at end of file
+    return m_current.getType() == TokenType::END_OF_INPUT;
+}
@@ -5,9 +5,8 @@
 
 #include "Lexer.h"
 #include "Command.h"
-#include <memory>
-#include <vector>
 #include <stdexcept>
+#include <string_view>
 
 // Exception for parsing errors
 class ParseError : public std::runtime_error {
@@ -18,33 +17,52 @@ public:
 
 class Parser {
 public:
-    explicit Parser(const std::string& input);
+    // Tokens are pulled from the lexer on demand, one token of lookahead at
+    // a time; the input must stay alive until parsing is finished
+    explicit Parser(std::string_view input);
 
-    // Parse the input into a command structure
-    std::shared_ptr<Command> parse();
+    // Parse the input into a command tree whose nodes are stored in arena
+    Command parse(CommandArena& arena);
+
+    // Parse the next newline-terminated top-level command of a multi-line
+    // input; returns false once the input is exhausted
+    bool parseNext(CommandArena& arena, Command& command);
+
+    // Offset just past the lookahead token, and the line it is on
+    size_t position() const { return m_lexer.position(); }
+    size_t line() const { return m_lexer.line(); }
 
 private:
     // Recursive descent parsing methods
-    std::shared_ptr<Command> parseCommand();
-    std::shared_ptr<Command> parseLogicalOr();
-    std::shared_ptr<Command> parseLogicalAnd();
-    std::shared_ptr<Command> parsePipeline();
-    std::shared_ptr<Command> parseSimpleCommand();
+    NodeIndex parseCommand();
+    NodeIndex parseLogicalOr();
+    NodeIndex parseLogicalAnd();
+    NodeIndex parsePipeline();
+    NodeIndex parseSimpleCommand();
 
     // Helper methods
-    Token peek() const;
+    const Token& peek() const;
     Token advance();
     bool check(TokenType type) const;
     bool match(TokenType type);
     void expect(TokenType type, const std::string& message);
+    bool isAtEnd() const;
 
     // Handle redirections
     void parseRedirections(SimpleCommand& cmd);
 
+    // Turn the operands pushed since base into one node of the given type
+    // (or the operand itself if there is only one) and pop them
+    NodeIndex makeList(CommandType type, size_t base);
+
     // Member variables
+    CommandArena* m_arena;
     Lexer m_lexer;
-    std::vector<Token> m_tokens;
-    size_t m_current;
+    Token m_current; // Lookahead token
+
+    // Operands of the lists being parsed, one stack shared by every level
+    // (the arena's, see CommandArena::operandStack)
+    std::vector<NodeIndex>* m_operands;
 };
 
 #endif // PARSER_H
@@ -0,0 +1,210 @@
+// PipeIO.cpp - Zero-copy pipe helpers implementation
+
+#include "PipeIO.h"
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+    const size_t COPY_BUFFER_SIZE = 64 * 1024;
+    const size_t SPLICE_CHUNK = 1 << 30;
+
+    // read/write fallback used when splice is not available
+    bool copyAll(int in, const std::vector<int>& outs) {
+        std::vector<char> buffer(COPY_BUFFER_SIZE);
+        while (true) {
+            ssize_t n = read(in, buffer.data(), buffer.size());
+            if (n == 0) {
+                return true;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            for (int out : outs) {
+                if (!pipeio::writeAll(out, buffer.data(), static_cast<size_t>(n))) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Move exactly count bytes out of pipe in
+    bool moveExact(int in, int out, size_t count) {
+#ifdef __linux__
+        while (count > 0) {
+            ssize_t n = splice(in, nullptr, out, nullptr, count, SPLICE_F_MOVE);
+            if (n > 0) {
+                count -= static_cast<size_t>(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EINVAL) {
+                break;
+            }
+            return false;
+        }
+#endif
+        // The target rejected splice (an O_APPEND file, for instance)
+        char buffer[COPY_BUFFER_SIZE];
+        while (count > 0) {
+            ssize_t n = read(in, buffer, count < sizeof(buffer) ? count : sizeof(buffer));
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            if (!pipeio::writeAll(out, buffer, static_cast<size_t>(n))) {
+                return false;
+            }
+            count -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+namespace pipeio {
+
+    bool makePipe(int fds[2], size_t capacity) {
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            return false;
+        }
+        if (capacity > 0) {
+            // A refused resize still leaves a working pipe
+            setCapacity(fds[1], capacity);
+        }
+        return true;
+    }
+
+    bool setCapacity(int fd, size_t capacity) {
+#ifdef F_SETPIPE_SZ
+        if (capacity > static_cast<size_t>(INT_MAX)) {
+            return false;
+        }
+        return fcntl(fd, F_SETPIPE_SZ, static_cast<int>(capacity)) >= 0;
+#else
+        (void)fd;
+        (void)capacity;
+        return false;
+#endif
+    }
+
+    bool drain(int in, int out) {
+#ifdef __linux__
+        while (true) {
+            ssize_t n = splice(in, nullptr, out, nullptr, SPLICE_CHUNK, SPLICE_F_MOVE);
+            if (n == 0) {
+                return true;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EINVAL) {
+                    break;
+                }
+                return false;
+            }
+        }
+#endif
+        return copyAll(in, std::vector<int>{ out });
+    }
+
+    bool fanOut(int in, const std::vector<int>& outs) {
+        if (outs.empty()) {
+            return true;
+        }
+        if (outs.size() == 1) {
+            return drain(in, outs[0]);
+        }
+
+#ifdef __linux__
+        // Each chunk is tee'd into an empty scratch pipe once per extra
+        // target and the last target consumes it from the input with splice.
+        // The scratch pipe is at least as large as the input pipe, so a tee
+        // into it always duplicates the whole chunk.
+        int scratch[2];
+        if (pipe2(scratch, O_CLOEXEC) == 0) {
+            int inputSize = fcntl(in, F_GETPIPE_SZ);
+            if (inputSize > 0) {
+                setCapacity(scratch[1], static_cast<size_t>(inputSize));
+            }
+
+            bool ok = true;
+            bool spliced = false;
+            while (true) {
+                ssize_t chunk = tee(in, scratch[1], SPLICE_CHUNK, 0);
+                if (chunk < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (chunk <= 0) {
+                    ok = (chunk == 0);
+                    spliced = ok || errno != EINVAL;
+                    break;
+                }
+
+                size_t count = static_cast<size_t>(chunk);
+                ok = moveExact(scratch[0], outs[0], count);
+                for (size_t i = 1; ok && i + 1 < outs.size(); ++i) {
+                    ok = tee(in, scratch[1], count, 0) == chunk &&
+                        moveExact(scratch[0], outs[i], count);
+                }
+                ok = ok && moveExact(in, outs.back(), count);
+                if (!ok) {
+                    spliced = true;
+                    break;
+                }
+            }
+
+            close(scratch[0]);
+            close(scratch[1]);
+            if (spliced) {
+                return ok;
+            }
+            // Input is not a pipe; nothing has been consumed yet
+        }
+#endif
+        return copyAll(in, outs);
+    }
+
+    bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool readAll(int in, std::string& out, size_t chunk) {
+        size_t used = out.size();
+        out.resize(used + chunk);
+        while (true) {
+            if (used == out.size()) {
+                out.resize(out.size() * 2);
+            }
+            ssize_t n = read(in, &out[used], out.size() - used);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                out.resize(used);
+                return n == 0;
+            }
+            used += static_cast<size_t>(n);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+// PipeIO.h - Zero-copy pipe helpers
+
+#ifndef PIPE_IO_H
+#define PIPE_IO_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Helpers for moving data through the shell without copying it through user
+// space. On Linux, data is moved between descriptors with splice(2) and
+// duplicated with tee(2). Wherever the kernel refuses (non-pipe input,
+// O_APPEND targets, other platforms) they fall back to read/write.
+namespace pipeio {
+    // Create a close-on-exec pipe, applying capacity when it is non-zero
+    bool makePipe(int fds[2], size_t capacity);
+
+    // Resize a pipe with F_SETPIPE_SZ; fails when unsupported or when the
+    // size is over the unprivileged limit (/proc/sys/fs/pipe-max-size)
+    bool setCapacity(int fd, size_t capacity);
+
+    // Move everything from in to out until end of file
+    bool drain(int in, int out);
+
+    // Copy everything from in to every descriptor in outs until end of file
+    bool fanOut(int in, const std::vector<int>& outs);
+
+    // Write a whole buffer, retrying on short writes and interruptions
+    bool writeAll(int fd, const char* data, size_t size);
+
+    // Append everything read from in until end of file to out. Reads go
+    // straight into the string's spare room, which starts at chunk bytes
+    // and doubles as it fills.
+    bool readAll(int in, std::string& out, size_t chunk);
+}
+
+#endif // PIPE_IO_H
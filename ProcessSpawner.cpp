@@ -0,0 +1,140 @@
+// ProcessSpawner.cpp - Process creation via posix_spawn
+
+#include "ProcessSpawner.h"
+#include "HereDoc.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <vector>
+
+namespace {
+
+    // Open flags for each redirection type
+    int redirectFlags(RedirectType type) {
+        switch (type) {
+        case RedirectType::INPUT:
+            return O_RDONLY;
+        case RedirectType::OUTPUT:
+            return O_WRONLY | O_CREAT | O_TRUNC;
+        case RedirectType::APPEND:
+            return O_WRONLY | O_CREAT | O_APPEND;
+        case RedirectType::HEREDOC:
+        case RedirectType::HERESTRING:
+            break;
+        }
+        return O_RDONLY;
+    }
+
+    // Descriptor a redirection replaces
+    int redirectTarget(RedirectType type) {
+        return type == RedirectType::OUTPUT || type == RedirectType::APPEND ? STDOUT_FILENO : STDIN_FILENO;
+    }
+
+    // RAII wrapper so every exit path releases the spawn descriptors
+    class SpawnDescriptors {
+    public:
+        SpawnDescriptors() {
+            posix_spawn_file_actions_init(&actions);
+            posix_spawnattr_init(&attributes);
+        }
+        ~SpawnDescriptors() {
+            posix_spawn_file_actions_destroy(&actions);
+            posix_spawnattr_destroy(&attributes);
+            for (int fd : documents) {
+                close(fd);
+            }
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attributes;
+        std::vector<int> documents;     // Here-document files, dup2'd into the child
+    };
+}
+
+SpawnResult ProcessSpawner::spawn(const std::string& path, const SimpleCommand& command,
+    const IoFds& fds, char* const* envp, const std::vector<int>* openFds) {
+    SpawnResult result;
+    SpawnDescriptors spawn;
+
+    // Wire up stdio first. Pipe ends are created close-on-exec, so only the
+    // dup2'd copies survive into the new program.
+    const int wiring[] = { fds.in, fds.out, fds.err };
+    for (int target = 0; target < 3; ++target) {
+        if (wiring[target] != target) {
+            posix_spawn_file_actions_adddup2(&spawn.actions, wiring[target], target);
+        }
+    }
+
+    // Redirections are opened by the child so the shell never holds them,
+    // except here-documents, which the shell writes into an in-memory file,
+    // and files the shell already holds open
+    const std::vector<Redirection>& redirections = command.getRedirections();
+    for (size_t i = 0; i < redirections.size(); ++i) {
+        const Redirection& redir = redirections[i];
+        if (openFds != nullptr && (*openFds)[i] >= 0) {
+            posix_spawn_file_actions_adddup2(&spawn.actions, (*openFds)[i], redirectTarget(redir.type));
+            continue;
+        }
+        if (redir.type == RedirectType::HEREDOC || redir.type == RedirectType::HERESTRING) {
+            int fd = heredoc::open(redir.target, redir.type == RedirectType::HERESTRING);
+            if (fd < 0) {
+                result.error = errno;
+                return result;
+            }
+            spawn.documents.push_back(fd);
+            posix_spawn_file_actions_adddup2(&spawn.actions, fd, STDIN_FILENO);
+            continue;
+        }
+        posix_spawn_file_actions_addopen(&spawn.actions, redirectTarget(redir.type),
+            redir.target.c_str(), redirectFlags(redir.type), 0666);
+    }
+
+    // The child starts with an empty signal mask and default dispositions
+    // for the signals an interactive shell ignores or catches
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&spawn.attributes, &mask);
+
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&spawn.attributes, &defaults);
+
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_USEVFORK
+    // Older glibc only skips fork() when asked to; newer ones ignore this
+    // flag and always use clone(CLONE_VM | CLONE_VFORK)
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&spawn.attributes, flags);
+
+    std::vector<const char*> argv = command.getArgv();
+    pid_t pid = -1;
+    int rc = posix_spawn(&pid, path.c_str(), &spawn.actions,
+        &spawn.attributes, const_cast<char* const*>(argv.data()), envp);
+
+    if (rc != 0) {
+        result.error = rc;
+        return result;
+    }
+
+    result.pid = pid;
+    return result;
+}
+
+int ProcessSpawner::exitStatus(int waitStatus) {
+    if (WIFEXITED(waitStatus)) {
+        return WEXITSTATUS(waitStatus);
+    }
+    if (WIFSIGNALED(waitStatus)) {
+        return 128 + WTERMSIG(waitStatus);
+    }
+    return 1;
+}
@@ -0,0 +1,43 @@
+// ProcessSpawner.h - Low-latency process creation
+
+#ifndef PROCESS_SPAWNER_H
+#define PROCESS_SPAWNER_H
+
+#include "Command.h"
+#include <sys/types.h>
+#include <unistd.h>
+
+// Standard streams a command should be started with
+struct IoFds {
+    int in = STDIN_FILENO;
+    int out = STDOUT_FILENO;
+    int err = STDERR_FILENO;
+};
+
+// Result of a spawn attempt
+struct SpawnResult {
+    pid_t pid = -1;  // Child pid, or -1 on failure
+    int error = 0;   // errno value when the spawn failed
+};
+
+// Launches external commands without duplicating the shell's address space.
+//
+// fork() has to copy the parent's page tables, so its cost grows with the
+// shell's RSS. posix_spawn() lets the C library use vfork/clone(CLONE_VM) and
+// describes everything the child needs (stdio wiring, redirections, signal
+// state) as file actions that are applied between the clone and the exec.
+class ProcessSpawner {
+public:
+    // Start the program at path with the command's arguments, the given
+    // stdio and environment; redirections are applied after the stdio
+    // wiring so they take precedence over pipes. Where openFds holds a
+    // descriptor (not -1) for a redirection, that descriptor is used
+    // rather than opening the target.
+    static SpawnResult spawn(const std::string& path, const SimpleCommand& command,
+        const IoFds& fds, char* const* envp, const std::vector<int>* openFds = nullptr);
+
+    // Map a wait status to a shell exit status (128 + signal when killed)
+    static int exitStatus(int waitStatus);
+};
+
+#endif // PROCESS_SPAWNER_H
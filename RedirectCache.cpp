@@ -0,0 +1,94 @@
+// RedirectCache.cpp - Reuse of descriptors for repeated redirections implementation
+
+#include "RedirectCache.h"
+#include "ShellConfig.h"
+#include "ShellStats.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RedirectCache::RedirectCache() : m_open(0) {}
+
+RedirectCache::~RedirectCache() {
+    clear();
+}
+
+int RedirectCache::acquire(const std::string& path, RedirectType type) {
+    if (type != RedirectType::INPUT && type != RedirectType::APPEND) {
+        return -1;
+    }
+
+    m_key.assign(path);
+    m_key += type == RedirectType::INPUT ? '<' : '>';
+    auto found = m_entries.find(m_key);
+    if (found == m_entries.end()) {
+        if (m_entries.size() >= config::REDIRECT_CACHE_ENTRIES) {
+            clear();
+        }
+        m_entries.emplace(m_key, Entry());
+        return -1;
+    }
+
+    Entry& entry = found->second;
+    if (!entry.cacheable) {
+        return -1;
+    }
+
+    // A missing file is left for the caller to create, and kept next time
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        invalidate(entry);
+        return -1;
+    }
+
+    if (entry.fd >= 0 && st.st_dev == entry.device && st.st_ino == entry.inode) {
+        if (type == RedirectType::INPUT && lseek(entry.fd, 0, SEEK_SET) < 0) {
+            invalidate(entry);
+            return -1;
+        }
+        stats::count(stats::Counter::REDIRECT_REUSES);
+        return entry.fd;
+    }
+
+    // Seen before, or the path names another file now: open it for keeps
+    invalidate(entry);
+    if (!S_ISREG(st.st_mode)) {
+        entry.cacheable = false;
+        return -1;
+    }
+
+    int flags = type == RedirectType::INPUT ? O_RDONLY : O_WRONLY | O_APPEND;
+    int fd = open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Identity is taken from the descriptor, so a change between the stat
+    // and the open is caught on the next use
+    struct stat opened;
+    if (fstat(fd, &opened) != 0 || !S_ISREG(opened.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    entry.fd = fd;
+    entry.device = opened.st_dev;
+    entry.inode = opened.st_ino;
+    ++m_open;
+    return fd;
+}
+
+void RedirectCache::clear() {
+    for (auto& item : m_entries) {
+        invalidate(item.second);
+    }
+    m_entries.clear();
+}
+
+void RedirectCache::invalidate(Entry& entry) {
+    if (entry.fd >= 0) {
+        close(entry.fd);
+        entry.fd = -1;
+        --m_open;
+    }
+}
@@ -0,0 +1,66 @@
+// RedirectCache.h - Reuse of descriptors for repeated redirections
+
+#ifndef REDIRECT_CACHE_H
+#define REDIRECT_CACHE_H
+
+#include "Command.h"
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+// Keeps files that a command line or script redirects to again and again
+// open, so `echo ... >> app.log` repeated in a script costs a stat and a
+// write rather than an open, a write and a close each time.
+//
+// Only >> and < are cached. An append descriptor writes at the end of the
+// file whoever else writes to it, and an input descriptor is rewound before
+// each use, so reusing either behaves as a fresh open would. A path is
+// opened for keeps the second time it is seen, so one-off redirections
+// cost no more than before, and only regular files are kept.
+//
+// Before each reuse the path is stat'ed and must still name the file the
+// descriptor is open on. A rename, an unlink, another file moved over it,
+// a directory above it moving or a symlink on the way changing all show up
+// as a different file or none, and the descriptor is dropped. (inotify
+// would spare the path lookup, but tearing down an inotify instance waits
+// for an SRCU grace period, which costs a short script milliseconds.)
+//
+// Descriptors are shared with the children they are handed to, so the
+// executor uses the cache only for commands it waits for one at a time.
+class RedirectCache {
+public:
+    RedirectCache();
+    ~RedirectCache();
+
+    RedirectCache(const RedirectCache&) = delete;
+    RedirectCache& operator=(const RedirectCache&) = delete;
+
+    // Open descriptor for a redirection to path, or -1 when the caller
+    // should open it as usual. Input descriptors come back rewound.
+    int acquire(const std::string& path, RedirectType type);
+
+    // Close every kept descriptor and forget every path
+    void clear();
+
+    // Number of descriptors kept open
+    size_t openCount() const { return m_open; }
+
+private:
+    struct Entry {
+        int fd = -1;            // Kept descriptor, -1 while only seen
+        dev_t device = 0;       // File the descriptor is open on
+        ino_t inode = 0;
+        bool cacheable = true;  // A regular file
+    };
+
+    // Close an entry's descriptor; it is reopened on its next use
+    void invalidate(Entry& entry);
+
+    // Paths with the redirection type appended, so < and >> of one file
+    // keep separate descriptors
+    std::unordered_map<std::string, Entry> m_entries;
+    std::string m_key;      // Lookup key, reused to spare an allocation
+    size_t m_open;
+};
+
+#endif // REDIRECT_CACHE_H
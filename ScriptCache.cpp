@@ -0,0 +1,619 @@
+// ScriptCache.cpp - On-disk cache of parsed scripts implementation
+
+#include "ScriptCache.h"
+#include "PipeIO.h"
+#include "ShellConfig.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    // Bump whenever the record layout, or the words a source lexes to,
+    // changes
+    const std::uint32_t FORMAT_VERSION = 7;
+    const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+    const char MAGIC[8] = { 'C', 'P', 'S', 'H', 'A', 'S', 'T', '\0' };
+
+    const size_t FLUSH_THRESHOLD = 1024 * 1024;
+
+    // Node tag byte: the command type, a background bit, and for simple
+    // commands which of the optional parts follow
+    const std::uint8_t NODE_TYPE_MASK = 0x07;
+    const std::uint8_t NODE_BACKGROUND = 0x08;
+    const std::uint8_t NODE_REDIRECTIONS = 0x10;
+    const std::uint8_t NODE_ASSIGNMENTS = 0x20;
+    const std::uint8_t NODE_WORD_FLAGS = 0x40;
+
+    // Largest valid values of the enum bytes in a record
+    const std::uint8_t LAST_COMMAND_TYPE = static_cast<std::uint8_t>(CommandType::LOGICAL_OR);
+    const std::uint8_t LAST_REDIRECT_TYPE = static_cast<std::uint8_t>(RedirectType::HERESTRING);
+
+    // A simple command's WordFlag bits are packed into one bitmap, four
+    // words to a byte
+    const unsigned WORD_FLAG_BITS = 2;
+    const std::uint8_t WORD_FLAG_MASK = (1 << WORD_FLAG_BITS) - 1;
+    static_assert((WORD_GLOB | WORD_SUBSTITUTION) <= WORD_FLAG_MASK, "WordFlag bits outgrew the bitmap");
+
+    size_t flagBytes(size_t words) {
+        return (words * WORD_FLAG_BITS + 7) / 8;
+    }
+
+    // Scripts repeat the same names, options and paths on line after line.
+    // Writer and reader both keep a table of recent words, filled in entry
+    // order, and a word already in its slot is written as the slot number.
+    // Words too short to gain from that, or long enough to make the table
+    // costly, are always written out.
+    const size_t STRING_SLOTS = 1024;
+    const size_t SHARED_MIN_LENGTH = 3;
+    const size_t SHARED_MAX_LENGTH = 256;
+
+    bool shareable(std::string_view word) {
+        return word.size() >= SHARED_MIN_LENGTH && word.size() <= SHARED_MAX_LENGTH;
+    }
+
+    // FNV-1a, folded onto the table
+    size_t stringSlot(std::string_view word) {
+        std::uint32_t h = 2166136261u;
+        for (char c : word) {
+            h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+        return (h ^ (h >> 16)) & (STRING_SLOTS - 1);
+    }
+
+    struct Header {
+        char magic[8];
+        std::uint32_t byteOrder;
+        std::uint32_t formatVersion;
+        char shellVersion[16];
+        std::uint64_t contentHash;
+        std::uint64_t contentSize;
+        std::uint64_t recordCount;
+        std::uint64_t recordBytes;
+    };
+
+    // 64-bit content hash in the style of xxHash64: four independent lanes
+    // over 32-byte stripes, then a scalar tail and an avalanche step
+    const std::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    const std::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    const std::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+
+    inline std::uint64_t rotl(std::uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline std::uint64_t mixRound(std::uint64_t acc, std::uint64_t input) {
+        return rotl(acc + input * PRIME2, 31) * PRIME1;
+    }
+
+    inline std::uint64_t load64(const char* p) {
+        std::uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    // Pages of a mapped source are handed back every so often while hashing
+    const size_t HASH_RELEASE_STEP = 4 * 1024 * 1024;
+
+    std::uint64_t hashContent(const char* data, size_t size, std::uint64_t seed,
+        MappedFile* source = nullptr) {
+        std::uint64_t h;
+        size_t i = 0;
+
+        if (size >= 32) {
+            std::uint64_t v1 = seed + PRIME1 + PRIME2;
+            std::uint64_t v2 = seed + PRIME2;
+            std::uint64_t v3 = seed;
+            std::uint64_t v4 = seed - PRIME1;
+            for (; i + 32 <= size; i += 32) {
+                v1 = mixRound(v1, load64(data + i));
+                v2 = mixRound(v2, load64(data + i + 8));
+                v3 = mixRound(v3, load64(data + i + 16));
+                v4 = mixRound(v4, load64(data + i + 24));
+                if (source != nullptr && i % HASH_RELEASE_STEP == 0) {
+                    source->release(i);
+                }
+            }
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        }
+        else {
+            h = seed + PRIME3;
+        }
+
+        h += size;
+        for (; i + 8 <= size; i += 8) {
+            h ^= mixRound(0, load64(data + i));
+            h = rotl(h, 27) * PRIME1 + PRIME2;
+        }
+        for (; i < size; ++i) {
+            h ^= static_cast<unsigned char>(data[i]) * PRIME3;
+            h = rotl(h, 11) * PRIME1;
+        }
+
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // Little helpers for the record encoding
+    void putU8(std::string& out, std::uint8_t value) {
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Lengths, counts, child offsets and string references are LEB128
+    // varints; nearly all of them fit in one byte
+    void putVarint(std::string& out, std::uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // A word is a varint: odd for a slot of the string table, even for a
+    // length followed by the bytes
+    void putWord(std::string& out, std::vector<std::string>& strings, const std::string& word) {
+        if (shareable(word)) {
+            size_t slot = stringSlot(word);
+            if (strings[slot] == word) {
+                putVarint(out, static_cast<std::uint32_t>((slot << 1) | 1));
+                return;
+            }
+            strings[slot] = word;
+        }
+        putVarint(out, static_cast<std::uint32_t>(word.size() << 1));
+        out.append(word);
+    }
+
+    // Bounds-checked reader over one record
+    class RecordReader {
+    public:
+        RecordReader(const char* data, size_t size)
+            : m_data(data), m_size(size), m_pos(0), m_ok(true) {}
+
+        bool ok() const { return m_ok; }
+        bool atEnd() const { return m_pos == m_size; }
+        size_t position() const { return m_pos; }
+
+        // Mark the record bad for a value that decoded but is out of range
+        void fail() { m_ok = false; }
+
+        std::uint8_t u8() {
+            if (!need(1)) {
+                return 0;
+            }
+            return static_cast<std::uint8_t>(m_data[m_pos++]);
+        }
+
+        std::uint32_t varint() {
+            std::uint32_t value = 0;
+            for (int shift = 0; shift < 35; shift += 7) {
+                std::uint8_t byte = u8();
+                value |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            m_ok = false;
+            return 0;
+        }
+
+        // Raw bytes, or null past the end of the record
+        const char* bytes(size_t count) {
+            if (!need(count)) {
+                return nullptr;
+            }
+            const char* value = m_data + m_pos;
+            m_pos += count;
+            return value;
+        }
+
+        std::string word(std::vector<std::string>& strings) {
+            std::uint32_t value = varint();
+            if (value & 1) {
+                size_t slot = value >> 1;
+                if (slot >= strings.size() || strings[slot].empty()) {
+                    m_ok = false;
+                    return std::string();
+                }
+                return strings[slot];
+            }
+            const char* data = bytes(value >> 1);
+            if (data == nullptr) {
+                return std::string();
+            }
+            std::string word(data, value >> 1);
+            if (shareable(word)) {
+                strings[stringSlot(word)] = word;
+            }
+            return word;
+        }
+
+    private:
+        bool need(size_t count) {
+            if (!m_ok || m_size - m_pos < count) {
+                m_ok = false;
+                return false;
+            }
+            return true;
+        }
+
+        const char* m_data;
+        size_t m_size;
+        size_t m_pos;
+        bool m_ok;
+    };
+
+    void fillShellVersion(char (&out)[16]) {
+        std::memset(out, 0, sizeof(out));
+        std::strncpy(out, config::VERSION.c_str(), sizeof(out) - 1);
+    }
+
+    // Create a directory and its parents
+    bool makeDirectories(const std::string& path) {
+        for (size_t pos = 1; pos <= path.size(); ++pos) {
+            if (pos == path.size() || path[pos] == '/') {
+                std::string prefix = path.substr(0, pos);
+                if (mkdir(prefix.c_str(), 0700) < 0 && errno != EEXIST) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+ScriptCache::ScriptCache()
+    : m_key(0), m_contentSize(0), m_eligible(false), m_offset(0),
+    m_corrupt(false), m_storeFd(-1), m_recordCount(0), m_recordBytes(0), m_storeFailed(false) {}
+
+ScriptCache::~ScriptCache() {
+    abandonStore();
+}
+
+std::string ScriptCache::directory() {
+    if (std::getenv("CPPSHELL_NO_CACHE") != nullptr) {
+        return std::string();
+    }
+    if (const char* dir = std::getenv("CPPSHELL_CACHE_DIR")) {
+        return dir;
+    }
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        return std::string(xdg) + "/" + config::SCRIPT_CACHE_DIR;
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/" + config::SCRIPT_CACHE_DIR;
+    }
+    return std::string();
+}
+
+bool ScriptCache::load(MappedFile& source) {
+    std::string_view script = source.view();
+    m_directory = directory();
+    m_eligible = !m_directory.empty() && script.size() >= config::SCRIPT_CACHE_MIN_SIZE;
+    if (!m_eligible) {
+        return false;
+    }
+
+    // The shell version seeds the hash, so a new shell never sees old entries
+    std::uint64_t seed = hashContent(config::VERSION.data(), config::VERSION.size(), FORMAT_VERSION);
+    m_key = hashContent(script.data(), script.size(), seed, &source);
+    m_contentSize = script.size();
+    source.rewind();
+
+    if (!m_entry.open(entryPath())) {
+        return false;
+    }
+
+    std::string_view data = m_entry.view();
+    Header header;
+    char version[16];
+    fillShellVersion(version);
+
+    bool valid = data.size() >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, data.data(), sizeof(header));
+        valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+            header.byteOrder == BYTE_ORDER_MARK &&
+            header.formatVersion == FORMAT_VERSION &&
+            std::memcmp(header.shellVersion, version, sizeof(version)) == 0 &&
+            header.contentHash == m_key &&
+            header.contentSize == m_contentSize;
+    }
+
+    // A truncated entry is rejected up front rather than after half the
+    // script has run; records are bounds-checked again as they are read
+    if (!valid || data.size() - sizeof(header) != header.recordBytes) {
+        m_entry.close();
+        return false;
+    }
+
+    m_offset = sizeof(header);
+    m_readStrings.assign(STRING_SLOTS, std::string());
+    return true;
+}
+
+bool ScriptCache::next(CommandArena& arena, Command& command) {
+    std::string_view data = m_entry.view();
+    if (m_offset >= data.size()) {
+        return false;
+    }
+
+    RecordReader prefix(data.data() + m_offset, data.size() - m_offset);
+    std::uint32_t length = prefix.varint();
+    size_t lengthBytes = prefix.position();
+    if (!prefix.ok() || data.size() - m_offset - lengthBytes < length) {
+        return reject();
+    }
+    RecordReader reader(data.data() + m_offset + lengthBytes, length);
+    m_offset += lengthBytes + length;
+    m_entry.release(m_offset);
+
+    // Nodes are replayed in their original order, so every index that was
+    // valid when the record was written is valid again
+    std::uint32_t nodeCount = reader.varint();
+    std::uint32_t rootDistance = reader.varint();
+    std::vector<NodeIndex> children;
+    for (std::uint32_t i = 0; i < nodeCount && reader.ok(); ++i) {
+        std::uint8_t tag = reader.u8();
+        if ((tag & NODE_TYPE_MASK) > LAST_COMMAND_TYPE) {
+            reader.fail();
+            break;
+        }
+        auto type = static_cast<CommandType>(tag & NODE_TYPE_MASK);
+        bool background = (tag & NODE_BACKGROUND) != 0;
+
+        NodeIndex index;
+        if (type == CommandType::SIMPLE) {
+            // Counts first, then the flag bitmap, so each word is added
+            // with its flags as it is read
+            std::uint32_t wordCount = reader.varint();
+            std::uint32_t assignCount = (tag & NODE_ASSIGNMENTS) ? reader.varint() : 0;
+            std::uint32_t redirCount = (tag & NODE_REDIRECTIONS) ? reader.varint() : 0;
+            const char* flags = nullptr;
+            if (tag & NODE_WORD_FLAGS) {
+                flags = reader.bytes(flagBytes(static_cast<size_t>(wordCount) + assignCount));
+            }
+            if (!reader.ok() || wordCount == 0) {
+                reader.fail();
+                break;
+            }
+            auto flagsOf = [flags](size_t word) -> std::uint8_t {
+                if (flags == nullptr) {
+                    return 0;
+                }
+                size_t bit = word * WORD_FLAG_BITS;
+                return (static_cast<std::uint8_t>(flags[bit / 8]) >> (bit % 8)) & WORD_FLAG_MASK;
+            };
+
+            std::string name = reader.word(m_readStrings);
+            SimpleCommand simple(name, flagsOf(0));
+            for (std::uint32_t a = 1; a < wordCount && reader.ok(); ++a) {
+                simple.addArgument(reader.word(m_readStrings), flagsOf(a));
+            }
+            for (std::uint32_t v = 0; v < assignCount && reader.ok(); ++v) {
+                simple.addAssignment(reader.word(m_readStrings), flagsOf(wordCount + v));
+            }
+            for (std::uint32_t r = 0; r < redirCount && reader.ok(); ++r) {
+                std::uint8_t redirType = reader.u8();
+                if (redirType > LAST_REDIRECT_TYPE) {
+                    reader.fail();
+                    break;
+                }
+                simple.addRedirection(static_cast<RedirectType>(redirType), reader.word(m_readStrings));
+            }
+            index = arena.addSimple(std::move(simple));
+        }
+        else {
+            // Children always precede their parent and are stored as
+            // distances back from it
+            std::uint32_t count = reader.varint();
+            children.clear();
+            for (std::uint32_t c = 0; c < count && reader.ok(); ++c) {
+                std::uint32_t distance = reader.varint();
+                if (distance == 0 || distance > i) {
+                    break;
+                }
+                children.push_back(i - distance);
+            }
+            if (children.size() != count || count < 2) {
+                reader.fail();
+                break;
+            }
+            index = arena.addList(type, children.data(), children.size());
+        }
+        arena.setBackground(index, background);
+    }
+
+    // The root is stored as its distance back from the last node, which
+    // it nearly always is
+    if (!reader.ok() || !reader.atEnd() || arena.size() != nodeCount || rootDistance >= nodeCount) {
+        return reject();
+    }
+
+    command = arena.get(nodeCount - 1 - rootDistance);
+    return true;
+}
+
+bool ScriptCache::reject() {
+    // The entry is removed so no later run trips over it either
+    m_entry.close();
+    unlink(entryPath().c_str());
+    m_corrupt = true;
+    return false;
+}
+
+bool ScriptCache::beginStore() {
+    if (!m_eligible || !makeDirectories(m_directory)) {
+        return false;
+    }
+
+    // Written under a temporary name and renamed into place on commit, so
+    // readers only ever see complete entries
+    m_storePath = entryPath() + ".tmp." + std::to_string(getpid());
+    m_storeFd = open(m_storePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (m_storeFd < 0) {
+        return false;
+    }
+
+    m_buffer.assign(sizeof(Header), '\0');
+    m_storeStrings.assign(STRING_SLOTS, std::string());
+    m_recordCount = 0;
+    m_recordBytes = 0;
+    m_storeFailed = false;
+    return true;
+}
+
+void ScriptCache::store(const CommandArena& arena, const Command& command) {
+    if (m_storeFd < 0) {
+        return;
+    }
+
+    // The record is built on its own so its length can go in front
+    std::string& record = m_record;
+    record.clear();
+    auto nodeCount = static_cast<std::uint32_t>(arena.size());
+    putVarint(record, nodeCount);
+    putVarint(record, nodeCount - 1 - command.getIndex());
+
+    for (NodeIndex i = 0; i < arena.size(); ++i) {
+        Command node = arena.get(i);
+        std::uint8_t tag = static_cast<std::uint8_t>(node.getType()) |
+            (node.isBackground() ? NODE_BACKGROUND : 0);
+
+        if (node.getType() == CommandType::SIMPLE) {
+            const SimpleCommand& simple = node.getCommand();
+            const std::vector<std::string>& args = simple.getArguments();
+            const std::vector<std::string>& assignments = simple.getAssignments();
+            const std::vector<Redirection>& redirections = simple.getRedirections();
+            if (!assignments.empty()) {
+                tag |= NODE_ASSIGNMENTS;
+            }
+            if (!redirections.empty()) {
+                tag |= NODE_REDIRECTIONS;
+            }
+            if (simple.hasWordFlags()) {
+                tag |= NODE_WORD_FLAGS;
+            }
+            putU8(record, tag);
+
+            // The name counts as the first word
+            size_t wordCount = args.size() + 1;
+            putVarint(record, static_cast<std::uint32_t>(wordCount));
+            if (!assignments.empty()) {
+                putVarint(record, static_cast<std::uint32_t>(assignments.size()));
+            }
+            if (!redirections.empty()) {
+                putVarint(record, static_cast<std::uint32_t>(redirections.size()));
+            }
+            if (simple.hasWordFlags()) {
+                size_t start = record.size();
+                record.append(flagBytes(wordCount + assignments.size()), '\0');
+                auto setFlags = [&record, start](size_t word, std::uint8_t flags) {
+                    size_t bit = word * WORD_FLAG_BITS;
+                    record[start + bit / 8] = static_cast<char>(record[start + bit / 8] |
+                        ((flags & WORD_FLAG_MASK) << (bit % 8)));
+                };
+                setFlags(0, simple.getNameFlags());
+                for (size_t a = 0; a < args.size(); ++a) {
+                    setFlags(a + 1, simple.getArgumentFlags(a));
+                }
+                for (size_t v = 0; v < assignments.size(); ++v) {
+                    setFlags(wordCount + v, simple.getAssignmentFlags(v));
+                }
+            }
+
+            putWord(record, m_storeStrings, simple.getName());
+            for (const auto& arg : args) {
+                putWord(record, m_storeStrings, arg);
+            }
+            for (const auto& assignment : assignments) {
+                putWord(record, m_storeStrings, assignment);
+            }
+            for (const auto& redir : redirections) {
+                putU8(record, static_cast<std::uint8_t>(redir.type));
+                putWord(record, m_storeStrings, redir.target);
+            }
+        }
+        else {
+            putU8(record, tag);
+            size_t count = node.getChildCount();
+            putVarint(record, static_cast<std::uint32_t>(count));
+            for (size_t c = 0; c < count; ++c) {
+                putVarint(record, i - node.getChild(c).getIndex());
+            }
+        }
+    }
+
+    size_t before = m_buffer.size();
+    putVarint(m_buffer, static_cast<std::uint32_t>(record.size()));
+    m_buffer.append(record);
+    ++m_recordCount;
+    m_recordBytes += m_buffer.size() - before;
+
+    if (m_buffer.size() >= FLUSH_THRESHOLD) {
+        flush();
+    }
+}
+
+bool ScriptCache::commitStore() {
+    if (m_storeFd < 0) {
+        return false;
+    }
+
+    if (!flush()) {
+        abandonStore();
+        return false;
+    }
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.formatVersion = FORMAT_VERSION;
+    fillShellVersion(header.shellVersion);
+    header.contentHash = m_key;
+    header.contentSize = m_contentSize;
+    header.recordCount = m_recordCount;
+    header.recordBytes = m_recordBytes;
+
+    bool ok = pwrite(m_storeFd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    ok = close(m_storeFd) == 0 && ok;
+    m_storeFd = -1;
+
+    if (!ok || std::rename(m_storePath.c_str(), entryPath().c_str()) != 0) {
+        unlink(m_storePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ScriptCache::abandonStore() {
+    if (m_storeFd >= 0) {
+        close(m_storeFd);
+        unlink(m_storePath.c_str());
+        m_storeFd = -1;
+    }
+    m_buffer.clear();
+    m_storeStrings.clear();
+}
+
+bool ScriptCache::flush() {
+    if (!m_storeFailed && !pipeio::writeAll(m_storeFd, m_buffer.data(), m_buffer.size())) {
+        m_storeFailed = true;
+    }
+    m_buffer.clear();
+    return !m_storeFailed;
+}
+
+std::string ScriptCache::entryPath() const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.ast", static_cast<unsigned long long>(m_key));
+    return m_directory + "/" + name;
+}
@@ -0,0 +1,90 @@
+// ScriptCache.h - On-disk cache of parsed scripts
+
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include "Command.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Stores the parsed form of scripts so later runs can skip lexing and
+// parsing entirely.
+//
+// Entries are keyed by a hash of the script's content and the shell version,
+// so an edited script or an upgraded shell simply misses. An entry is a
+// versioned header followed by one length-prefixed record per top-level
+// command, each holding that command's arena nodes and words. A word that
+// already appeared earlier in the entry is usually written as a slot in a
+// small fixed table of recent words, so entries stay smaller than the
+// scripts they cache. Records are read straight out of a mapping one at a
+// time, in order, which keeps the streaming, bounded-memory behaviour of
+// script mode.
+class ScriptCache {
+public:
+    ScriptCache();
+    ~ScriptCache();
+
+    ScriptCache(const ScriptCache&) = delete;
+    ScriptCache& operator=(const ScriptCache&) = delete;
+
+    // Directory holding cache entries: $CPPSHELL_CACHE_DIR, else
+    // $XDG_CACHE_HOME/cppshell, else ~/.cache/cppshell. Empty if caching is
+    // disabled with CPPSHELL_NO_CACHE.
+    static std::string directory();
+
+    // Compute the key for a script and open its entry if one exists.
+    // Returns false on a miss (or when the script is too small to bother).
+    // Pages of the script are released as they are hashed.
+    bool load(MappedFile& script);
+
+    // Read the next cached command into arena; false at the end, or at a
+    // damaged record, after which isCorrupt() is true and the entry is gone
+    bool next(CommandArena& arena, Command& command);
+    bool isCorrupt() const { return m_corrupt; }
+
+    // Record a new entry for the script given to load(): begin, add every
+    // top-level command in order, then commit (or abandon on failure)
+    bool beginStore();
+    void store(const CommandArena& arena, const Command& command);
+    bool commitStore();
+    void abandonStore();
+
+    // Whether a store is in progress
+    bool isStoring() const { return m_storeFd >= 0; }
+
+private:
+    // Flush buffered record data to the temporary file
+    bool flush();
+
+    // Path of the entry for the current key
+    std::string entryPath() const;
+
+    // Drop the entry being read after a damaged record; returns false
+    bool reject();
+
+    std::string m_directory;
+    std::uint64_t m_key;
+    std::uint64_t m_contentSize;
+    bool m_eligible;
+
+    // Reading
+    MappedFile m_entry;
+    size_t m_offset;
+    bool m_corrupt;
+    std::vector<std::string> m_readStrings; // Recent words, as the writer left them
+
+    // Writing
+    int m_storeFd;
+    std::string m_storePath;
+    std::string m_buffer;
+    std::string m_record; // Record being built, before its length is known
+    std::vector<std::string> m_storeStrings; // Recent words written so far
+    std::uint64_t m_recordCount;
+    std::uint64_t m_recordBytes;
+    bool m_storeFailed;
+};
+
+#endif // SCRIPT_CACHE_H
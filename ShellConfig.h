@@ -15,8 +15,46 @@ namespace config {
     const std::string DEFAULT_PROMPT = "CppShell> ";
 
     // History settings
-    const unsigned int MAX_HISTORY_SIZE = 1000;
+    const unsigned int MAX_HISTORY_SIZE = 1000; // Entries listed by a bare `history`
     const std::string HISTORY_FILE = ".cppshell_history";
+    const std::string HISTORY_INDEX_SUFFIX = ".idx";
+    const size_t HISTORY_REINDEX_THRESHOLD = 4096; // Unindexed entries before a rebuild
+
+    // Script cache settings
+    const size_t SCRIPT_CACHE_MIN_SIZE = 64 * 1024;
+    const std::string SCRIPT_CACHE_DIR = "cppshell";
+
+    // Background job output capture
+    const size_t JOB_OUTPUT_BUDGET = 64 * 1024 * 1024; // Buffer bytes over all jobs
+    const size_t JOB_OUTPUT_TAIL_LINES = 10;
+
+    // Budget for one `cppshell -c true`, checked by --startup-benchmark
+    const double STARTUP_BUDGET_WALL_US = 5000;
+    const long STARTUP_BUDGET_MINOR_FAULTS = 400;
+    const long STARTUP_BUDGET_SYSCALLS = 120;
+    const int STARTUP_BENCHMARK_RUNS = 200;
+
+    // Benchmark suite (--benchmark)
+    const double BENCHMARK_MIN_TIME_MS = 200;    // Per case, after calibration
+    const double BENCHMARK_REGRESSION = 0.10;    // Slowdown --compare fails on
+
+    // Pathname expansion: bytes of directory entries fetched per getdents64
+    const size_t GLOB_READ_BUFFER = 256 * 1024;
+
+    // Command hash: mtime checks a script or -c string makes before its PATH
+    // directories are watched with inotify instead
+    const size_t HASH_MTIME_CHECKS = 32;
+
+    // Completion: directory listings kept for filename completion
+    const size_t COMPLETION_CACHED_DIRECTORIES = 64;
+
+    // Command substitution: first read size, and the capacity asked for the
+    // pipe an external command writes its output into
+    const size_t SUBSTITUTION_READ_SIZE = 64 * 1024;
+    const size_t SUBSTITUTION_PIPE_SIZE = 1024 * 1024;
+
+    // Redirection cache: paths tracked per command line or script
+    const size_t REDIRECT_CACHE_ENTRIES = 64;
 
     // Environment
     const std::vector<std::string> DEFAULT_PATH = {
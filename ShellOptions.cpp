@@ -0,0 +1,130 @@
+// ShellOptions.cpp - Runtime-tunable shell options implementation
+
+#include "ShellOptions.h"
+#include "ShellConfig.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+
+    // Parse a size with an optional k/m suffix (binary units)
+    bool parseSize(const std::string& text, size_t& value) {
+        // strtoull would take a sign and wrap "-1" round to the maximum
+        if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+            return false;
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        unsigned long long number = std::strtoull(text.c_str(), &end, 10);
+        if (end == text.c_str() || errno == ERANGE) {
+            return false;
+        }
+
+        std::string suffix(end);
+        unsigned long long unit = 1;
+        if (suffix == "k" || suffix == "K") {
+            unit = 1024;
+        }
+        else if (suffix == "m" || suffix == "M") {
+            unit = 1024 * 1024;
+        }
+        else if (!suffix.empty()) {
+            return false;
+        }
+        if (number > std::numeric_limits<size_t>::max() / unit) {
+            return false;
+        }
+        number *= unit;
+
+        value = static_cast<size_t>(number);
+        return true;
+    }
+
+    const char* const POLICY_NAMES[] = { "block", "drop-oldest", "drop-newest" };
+
+    const char* const OPTION_NAMES[] = { "pipesize", "joboutput", "jobbuffer", "jobpolicy", "globcache",
+        "redirectcache" };
+}
+
+std::string ShellOptions::value(const std::string& name) const {
+    if (name == "pipesize") {
+        return std::to_string(pipeSize);
+    }
+    if (name == "joboutput") {
+        return jobOutput ? "on" : "off";
+    }
+    if (name == "jobbuffer") {
+        return std::to_string(jobBuffer);
+    }
+    if (name == "globcache") {
+        return globCache ? "on" : "off";
+    }
+    if (name == "redirectcache") {
+        return redirectCache ? "on" : "off";
+    }
+    return POLICY_NAMES[static_cast<int>(jobPolicy)];
+}
+
+int ShellOptions::builtin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+    if (args.empty()) {
+        for (const char* name : OPTION_NAMES) {
+            out += std::string(name) + "\t" + value(name) + "\n";
+        }
+        return 0;
+    }
+
+    const std::string& name = args[0];
+    bool known = false;
+    for (const char* option : OPTION_NAMES) {
+        known = known || name == option;
+    }
+    if (!known) {
+        err += "shopt: " + name + ": invalid option name\n";
+        return 1;
+    }
+
+    if (args.size() == 1) {
+        out += name + "\t" + value(name) + "\n";
+        return 0;
+    }
+
+    const std::string& text = args[1];
+    if (name == "joboutput" || name == "globcache" || name == "redirectcache") {
+        if (text != "on" && text != "off") {
+            err += "shopt: " + text + ": expected on or off\n";
+            return 1;
+        }
+        bool& option = name == "joboutput" ? jobOutput : name == "globcache" ? globCache : redirectCache;
+        option = text == "on";
+        return 0;
+    }
+
+    if (name == "jobpolicy") {
+        for (int i = 0; i < 3; ++i) {
+            if (text == POLICY_NAMES[i]) {
+                jobPolicy = static_cast<OverflowPolicy>(i);
+                return 0;
+            }
+        }
+        err += "shopt: " + text + ": expected block, drop-oldest or drop-newest\n";
+        return 1;
+    }
+
+    size_t size = 0;
+    // A job's buffer cannot be more than all jobs together may use
+    if (!parseSize(text, size) ||
+        (name == "jobbuffer" && (size == 0 || size > config::JOB_OUTPUT_BUDGET))) {
+        err += "shopt: " + text + ": invalid size\n";
+        return 1;
+    }
+    if (name == "pipesize") {
+        pipeSize = size;
+    }
+    else {
+        jobBuffer = size;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+// ShellOptions.h - Runtime-tunable shell options
+
+#ifndef SHELL_OPTIONS_H
+#define SHELL_OPTIONS_H
+
+#include <string>
+#include <vector>
+
+// What a captured job's output buffer does once it is full
+enum class OverflowPolicy {
+    BLOCK,       // Stop reading; the job blocks on its pipe until drained
+    DROP_OLDEST, // Overwrite the oldest buffered output
+    DROP_NEWEST  // Discard new output
+};
+
+// Options changed at runtime with the `shopt` builtin
+struct ShellOptions {
+    // Capacity in bytes of the pipes the shell creates (0 = kernel default)
+    size_t pipeSize = 0;
+
+    // Capture the output of background jobs instead of letting them write
+    // to the terminal, with this much buffer per job
+    bool jobOutput = false;
+    size_t jobBuffer = 64 * 1024;
+    OverflowPolicy jobPolicy = OverflowPolicy::DROP_OLDEST;
+
+    // Reuse directory listings for pathname expansion until the end of
+    // the command line
+    bool globCache = false;
+
+    // Keep files redirected to with >> or < open for reuse while a command
+    // line or script runs
+    bool redirectCache = true;
+
+    // Implementation of the `shopt` builtin:
+    //   shopt               list all options
+    //   shopt name          show one option
+    //   shopt name value    change an option
+    //
+    // Options: pipesize, joboutput (on/off), jobbuffer, jobpolicy
+    // (block, drop-oldest or drop-newest), globcache (on/off),
+    // redirectcache (on/off)
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err);
+
+private:
+    // Current value of an option as shown by `shopt`
+    std::string value(const std::string& name) const;
+};
+
+#endif // SHELL_OPTIONS_H
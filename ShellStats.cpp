@@ -0,0 +1,494 @@
+// ShellStats.cpp - Accounting of where the shell spends time and memory
+
+#include "ShellStats.h"
+#include "PipeIO.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <unistd.h>
+
+namespace {
+
+    using stats::Counter;
+    using stats::Subsystem;
+    using stats::Timer;
+
+    const size_t SUBSYSTEMS = static_cast<size_t>(Subsystem::COUNT);
+    const size_t TIMERS = static_cast<size_t>(Timer::COUNT);
+    const size_t COUNTERS = static_cast<size_t>(Counter::COUNT);
+
+    // Bucket 0 holds durations under 1us, bucket b those under 2^b us
+    const size_t BUCKETS = 32;
+
+    const char* const SUBSYSTEM_NAMES[SUBSYSTEMS] = {
+        "other", "lexer", "parser", "ast", "history", "executor", "script_cache"
+    };
+    const char* const TIMER_NAMES[TIMERS] = { "parse", "execute" };
+    const char* const COUNTER_NAMES[COUNTERS] = {
+        "spawns", "spawn_failures", "builtins", "relays", "subshells", "env_builds", "substitutions",
+        "redir_reuses"
+    };
+
+    struct AllocationCounters {
+        std::atomic<std::uint64_t> count{ 0 };
+        std::atomic<std::uint64_t> bytes{ 0 };
+    };
+
+    // Allocations made on one thread. Only that thread writes them, with a
+    // plain load and store rather than a locked read-modify-write, so that
+    // counting costs an allocation no more than a few moves; reports add
+    // up every thread's block.
+    struct ThreadAllocations {
+        std::atomic<std::uint64_t> count[SUBSYSTEMS];
+        std::atomic<std::uint64_t> bytes[SUBSYSTEMS];
+        ThreadAllocations* next;
+        bool registered;
+    };
+
+    struct TimerCounters {
+        std::atomic<std::uint64_t> count{ 0 };
+        std::atomic<std::uint64_t> totalNs{ 0 };
+        std::atomic<std::uint64_t> maxNs{ 0 };
+        std::atomic<std::uint64_t> buckets[BUCKETS] = {};
+    };
+
+    // Plain globals with constant initialization, so operator new can use
+    // them before any constructor has run. g_allocations holds what
+    // threads that have exited allocated; g_threads lists the live ones.
+    AllocationCounters g_allocations[SUBSYSTEMS];
+    TimerCounters g_timers[TIMERS];
+    std::atomic<std::uint64_t> g_counters[COUNTERS];
+    ThreadAllocations* g_threads = nullptr;
+    std::mutex g_threadsMutex;
+
+    thread_local Subsystem t_subsystem = Subsystem::OTHER;
+    thread_local ThreadAllocations t_allocations;
+    thread_local bool t_exited = false;
+
+    // Adds a thread's block to g_threads on its first allocation and folds
+    // it into g_allocations when the thread exits
+    class ThreadRegistration {
+    public:
+        ThreadRegistration() {
+            std::lock_guard<std::mutex> lock(g_threadsMutex);
+            t_allocations.next = g_threads;
+            t_allocations.registered = true;
+            g_threads = &t_allocations;
+        }
+
+        ~ThreadRegistration() {
+            std::lock_guard<std::mutex> lock(g_threadsMutex);
+            for (size_t i = 0; i < SUBSYSTEMS; ++i) {
+                g_allocations[i].count.fetch_add(t_allocations.count[i].load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+                g_allocations[i].bytes.fetch_add(t_allocations.bytes[i].load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+            }
+            ThreadAllocations** link = &g_threads;
+            while (*link != &t_allocations) {
+                link = &(*link)->next;
+            }
+            *link = t_allocations.next;
+            t_allocations.registered = false;
+            t_exited = true;
+        }
+
+        ThreadRegistration(const ThreadRegistration&) = delete;
+        ThreadRegistration& operator=(const ThreadRegistration&) = delete;
+    };
+
+    inline void bump(std::atomic<std::uint64_t>& counter, std::uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    // First allocation on a thread, or one made by the destructors that
+    // run after its block was folded in
+    void recordUnregistered(size_t subsystem, size_t size) {
+        if (t_exited) {
+            g_allocations[subsystem].count.fetch_add(1, std::memory_order_relaxed);
+            g_allocations[subsystem].bytes.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+        thread_local ThreadRegistration registration;
+        bump(t_allocations.count[subsystem], 1);
+        bump(t_allocations.bytes[subsystem], size);
+    }
+
+    inline void recordAllocation(size_t size) {
+        size_t subsystem = static_cast<size_t>(t_subsystem);
+        if (!t_allocations.registered) {
+            recordUnregistered(subsystem, size);
+            return;
+        }
+        bump(t_allocations.count[subsystem], 1);
+        bump(t_allocations.bytes[subsystem], size);
+    }
+
+    // Allocations per subsystem over exited and live threads
+    void allocationTotals(std::uint64_t (&count)[SUBSYSTEMS], std::uint64_t (&bytes)[SUBSYSTEMS]) {
+        std::lock_guard<std::mutex> lock(g_threadsMutex);
+        for (size_t i = 0; i < SUBSYSTEMS; ++i) {
+            count[i] = g_allocations[i].count.load(std::memory_order_relaxed);
+            bytes[i] = g_allocations[i].bytes.load(std::memory_order_relaxed);
+            for (const ThreadAllocations* thread = g_threads; thread != nullptr; thread = thread->next) {
+                count[i] += thread->count[i].load(std::memory_order_relaxed);
+                bytes[i] += thread->bytes[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void* allocate(size_t size) {
+        recordAllocation(size);
+        void* p = std::malloc(size == 0 ? 1 : size);
+        while (p == nullptr) {
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr) {
+                throw std::bad_alloc();
+            }
+            handler();
+            p = std::malloc(size == 0 ? 1 : size);
+        }
+        return p;
+    }
+
+    // aligned_alloc wants a size that is a multiple of the alignment
+    void* allocateAligned(size_t size, std::align_val_t alignment) {
+        recordAllocation(size);
+        size_t align = static_cast<size_t>(alignment);
+        size_t rounded = (size + align - 1) / align * align;
+        void* p = std::aligned_alloc(align, rounded == 0 ? align : rounded);
+        while (p == nullptr) {
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr) {
+                throw std::bad_alloc();
+            }
+            handler();
+            p = std::aligned_alloc(align, rounded == 0 ? align : rounded);
+        }
+        return p;
+    }
+
+    size_t bucketFor(std::uint64_t ns) {
+        std::uint64_t us = ns / 1000;
+        size_t bucket = 0;
+        while (us != 0 && bucket + 1 < BUCKETS) {
+            us >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    // Right-align a value in a column
+    std::string pad(const std::string& text, size_t width) {
+        return text.size() >= width ? text : std::string(width - text.size(), ' ') + text;
+    }
+
+    std::string padRight(const std::string& text, size_t width) {
+        return text.size() >= width ? text : text + std::string(width - text.size(), ' ');
+    }
+
+    std::string load(const std::atomic<std::uint64_t>& value) {
+        return std::to_string(value.load(std::memory_order_relaxed));
+    }
+
+    std::string textReport() {
+        std::uint64_t count[SUBSYSTEMS];
+        std::uint64_t bytes[SUBSYSTEMS];
+        allocationTotals(count, bytes);
+
+        std::string out;
+        out += padRight("subsystem", 14) + pad("allocations", 14) + pad("bytes", 16) + "\n";
+        for (size_t i = 0; i < SUBSYSTEMS; ++i) {
+            out += padRight(SUBSYSTEM_NAMES[i], 14) + pad(std::to_string(count[i]), 14)
+                + pad(std::to_string(bytes[i]), 16) + "\n";
+        }
+
+        out += "\n" + padRight("timer", 14) + pad("count", 14) + pad("total_us", 16)
+            + pad("max_us", 12) + "\n";
+        for (size_t i = 0; i < TIMERS; ++i) {
+            const TimerCounters& timer = g_timers[i];
+            out += padRight(TIMER_NAMES[i], 14) + pad(load(timer.count), 14)
+                + pad(std::to_string(timer.totalNs.load(std::memory_order_relaxed) / 1000), 16)
+                + pad(std::to_string(timer.maxNs.load(std::memory_order_relaxed) / 1000), 12) + "\n";
+        }
+
+        for (size_t i = 0; i < TIMERS; ++i) {
+            const TimerCounters& timer = g_timers[i];
+            if (timer.count.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            out += "\n" + std::string(TIMER_NAMES[i]) + " latency:\n";
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                std::uint64_t n = timer.buckets[b].load(std::memory_order_relaxed);
+                if (n != 0) {
+                    std::string bound = "< " + std::to_string(std::uint64_t(1) << b) + "us";
+                    out += "  " + padRight(bound, 14) + pad(std::to_string(n), 12) + "\n";
+                }
+            }
+        }
+
+        out += "\n";
+        for (size_t i = 0; i < COUNTERS; ++i) {
+            out += padRight(COUNTER_NAMES[i], 14) + pad(load(g_counters[i]), 14) + "\n";
+        }
+        return out;
+    }
+
+    std::string jsonReport() {
+        std::uint64_t count[SUBSYSTEMS];
+        std::uint64_t bytes[SUBSYSTEMS];
+        allocationTotals(count, bytes);
+
+        std::string out = "{\"allocations\":{";
+        for (size_t i = 0; i < SUBSYSTEMS; ++i) {
+            out += (i ? ",\"" : "\"") + std::string(SUBSYSTEM_NAMES[i]) + "\":{\"count\":"
+                + std::to_string(count[i]) + ",\"bytes\":" + std::to_string(bytes[i]) + "}";
+        }
+
+        out += "},\"timers\":{";
+        for (size_t i = 0; i < TIMERS; ++i) {
+            const TimerCounters& timer = g_timers[i];
+            out += (i ? ",\"" : "\"") + std::string(TIMER_NAMES[i]) + "\":{\"count\":"
+                + load(timer.count) + ",\"total_ns\":" + load(timer.totalNs)
+                + ",\"max_ns\":" + load(timer.maxNs) + ",\"histogram_us\":[";
+
+            // Bucket b counts durations under 2^b microseconds; trailing
+            // empty buckets are left out
+            size_t used = BUCKETS;
+            while (used > 0 && timer.buckets[used - 1].load(std::memory_order_relaxed) == 0) {
+                --used;
+            }
+            for (size_t b = 0; b < used; ++b) {
+                out += (b ? "," : "") + load(timer.buckets[b]);
+            }
+            out += "]}";
+        }
+
+        out += "},\"counters\":{";
+        for (size_t i = 0; i < COUNTERS; ++i) {
+            out += (i ? ",\"" : "\"") + std::string(COUNTER_NAMES[i]) + "\":" + load(g_counters[i]);
+        }
+        out += "}}\n";
+        return out;
+    }
+
+    void writeDump() {
+        const char* path = std::getenv("CPPSHELL_STATS");
+        if (path == nullptr || *path == '\0') {
+            return;
+        }
+
+        std::string report = jsonReport();
+        bool toStderr = std::strcmp(path, "-") == 0;
+        int fd = toStderr ? STDERR_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            std::fprintf(stderr, "CppShell: %s: %s\n", path, std::strerror(errno));
+            return;
+        }
+
+        pipeio::writeAll(fd, report.data(), report.size());
+        if (!toStderr) {
+            close(fd);
+        }
+    }
+}
+
+// Global allocation functions, replaced so every allocation is counted
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    recordAllocation(size);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    recordAllocation(size);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocateAligned(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try {
+        return allocateAligned(size, alignment);
+    }
+    catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try {
+        return allocateAligned(size, alignment);
+    }
+    catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+namespace stats {
+
+    Scope::Scope(Subsystem subsystem) : m_previous(t_subsystem) {
+        t_subsystem = subsystem;
+    }
+
+    Scope::~Scope() {
+        t_subsystem = m_previous;
+    }
+
+    Timing::~Timing() {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        auto ns = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        TimerCounters& timer = g_timers[static_cast<size_t>(m_timer)];
+        timer.count.fetch_add(1, std::memory_order_relaxed);
+        timer.totalNs.fetch_add(ns, std::memory_order_relaxed);
+        timer.buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+
+        std::uint64_t max = timer.maxNs.load(std::memory_order_relaxed);
+        while (ns > max && !timer.maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void count(Counter counter) {
+        g_counters[static_cast<size_t>(counter)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::uint64_t allocations() {
+        std::uint64_t count[SUBSYSTEMS];
+        std::uint64_t bytes[SUBSYSTEMS];
+        allocationTotals(count, bytes);
+        std::uint64_t total = 0;
+        for (std::uint64_t n : count) {
+            total += n;
+        }
+        return total;
+    }
+
+    std::string report(bool json) {
+        return json ? jsonReport() : textReport();
+    }
+
+    void reset() {
+        // A thread allocating meanwhile may put back a count it had loaded
+        // before the reset; the report is approximate for that instant
+        {
+            std::lock_guard<std::mutex> lock(g_threadsMutex);
+            for (auto& allocations : g_allocations) {
+                allocations.count.store(0, std::memory_order_relaxed);
+                allocations.bytes.store(0, std::memory_order_relaxed);
+            }
+            for (ThreadAllocations* thread = g_threads; thread != nullptr; thread = thread->next) {
+                for (size_t i = 0; i < SUBSYSTEMS; ++i) {
+                    thread->count[i].store(0, std::memory_order_relaxed);
+                    thread->bytes[i].store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+        for (auto& timer : g_timers) {
+            timer.count.store(0, std::memory_order_relaxed);
+            timer.totalNs.store(0, std::memory_order_relaxed);
+            timer.maxNs.store(0, std::memory_order_relaxed);
+            for (auto& bucket : timer.buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+        for (auto& counter : g_counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void dumpOnExit() {
+        const char* path = std::getenv("CPPSHELL_STATS");
+        if (path != nullptr && *path != '\0') {
+            std::atexit(writeDump);
+        }
+    }
+
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err) {
+        bool json = false;
+        for (const auto& arg : args) {
+            if (arg == "-j") {
+                json = true;
+            }
+            else if (arg == "-r") {
+                reset();
+                return 0;
+            }
+            else {
+                err += "shellstats: " + arg + ": invalid option\n";
+                err += "shellstats: usage: shellstats [-j] [-r]\n";
+                return 2;
+            }
+        }
+
+        out += report(json);
+        return 0;
+    }
+}
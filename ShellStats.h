@@ -0,0 +1,103 @@
+// ShellStats.h - Accounting of where the shell spends time and memory
+
+#ifndef SHELL_STATS_H
+#define SHELL_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Counters for the shell's own costs, reported by the `shellstats` builtin.
+//
+// Every heap allocation is charged to the subsystem active on the allocating
+// thread, which code marks with a Scope. Parsing and execution are timed into
+// log2 histograms, and process launches are counted. Allocations are counted
+// per thread without locked instructions and summed when reported; the rest
+// is kept in relaxed atomics, so accounting stays on in release builds.
+namespace stats {
+
+    // Parts of the shell that allocations are charged to
+    enum class Subsystem : std::uint8_t {
+        OTHER,
+        LEXER,
+        PARSER,
+        AST,
+        HISTORY,
+        EXECUTOR,
+        SCRIPT_CACHE,
+        COUNT
+    };
+
+    // Operations timed into histograms
+    enum class Timer : std::uint8_t {
+        PARSE,
+        EXECUTE,
+        COUNT
+    };
+
+    // Event counters
+    enum class Counter : std::uint8_t {
+        SPAWNS,
+        SPAWN_FAILURES,
+        BUILTINS,
+        RELAYS,
+        SUBSHELLS,
+        ENV_BUILDS,
+        SUBSTITUTIONS,
+        REDIRECT_REUSES,
+        COUNT
+    };
+
+    // Charge allocations on this thread to a subsystem until destroyed.
+    // Scopes nest; the innermost one wins.
+    class Scope {
+    public:
+        explicit Scope(Subsystem subsystem);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Subsystem m_previous;
+    };
+
+    // Record the lifetime of this object in a timer's histogram
+    class Timing {
+    public:
+        explicit Timing(Timer timer) : m_timer(timer), m_start(std::chrono::steady_clock::now()) {}
+        ~Timing();
+
+        Timing(const Timing&) = delete;
+        Timing& operator=(const Timing&) = delete;
+
+    private:
+        Timer m_timer;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Bump an event counter
+    void count(Counter counter);
+
+    // Heap allocations made so far, over all subsystems
+    std::uint64_t allocations();
+
+    // Current report, as aligned text or as a JSON object
+    std::string report(bool json);
+
+    // Zero every counter and histogram
+    void reset();
+
+    // If $CPPSHELL_STATS names a file, write the JSON report there when the
+    // shell exits ("-" means standard error)
+    void dumpOnExit();
+
+    // Implementation of the `shellstats` builtin:
+    //   shellstats          print the report
+    //   shellstats -j       print the report as JSON
+    //   shellstats -r       reset all counters
+    int builtin(const std::vector<std::string>& args, std::string& out, std::string& err);
+}
+
+#endif // SHELL_STATS_H
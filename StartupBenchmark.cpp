@@ -0,0 +1,190 @@
+// StartupBenchmark.cpp - Cold-start cost of one-shot shells implementation
+
+#include "StartupBenchmark.h"
+#include "ShellConfig.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+extern char** environ;
+
+namespace {
+
+    // Output of the measured shell is not part of the measurement
+    bool spawnQuiet(const std::string& shell, const std::string& command, pid_t& pid) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+        char* argv[] = { const_cast<char*>(shell.c_str()), const_cast<char*>("-c"),
+            const_cast<char*>(command.c_str()), nullptr };
+        int rc = posix_spawn(&pid, shell.c_str(), &actions, nullptr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        return rc == 0;
+    }
+
+    // Count the system calls of one run by stopping at each one
+    long countSyscalls(const std::string& shell, const std::string& command) {
+#ifdef __linux__
+        pid_t pid = fork();
+        if (pid < 0) {
+            return -1;
+        }
+        if (pid == 0) {
+            ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) {
+                dup2(null, STDOUT_FILENO);
+            }
+            execl(shell.c_str(), shell.c_str(), "-c", command.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        // The first stop is the SIGTRAP that follows the exec
+        int status = 0;
+        if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) {
+            return -1;
+        }
+        ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+            reinterpret_cast<void*>(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+
+        // Every call stops on entry and on exit; only entries are counted
+        long calls = 0;
+        bool entering = true;
+        int signal = 0;
+        while (true) {
+            if (ptrace(PTRACE_SYSCALL, pid, nullptr, reinterpret_cast<void*>(static_cast<long>(signal))) != 0) {
+                break;
+            }
+            if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) {
+                break;
+            }
+            signal = 0;
+            if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+                calls += entering ? 1 : 0;
+                entering = !entering;
+            }
+            else {
+                signal = WSTOPSIG(status);
+            }
+        }
+        return calls;
+#else
+        (void)shell;
+        (void)command;
+        return -1;
+#endif
+    }
+
+    double percentile(std::vector<double> values, double fraction) {
+        std::sort(values.begin(), values.end());
+        size_t index = static_cast<size_t>(fraction * static_cast<double>(values.size() - 1));
+        return values[index];
+    }
+}
+
+namespace startup {
+
+    bool measure(const std::string& shell, const std::string& command, bool countCalls,
+        Sample& sample) {
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = -1;
+        if (!spawnQuiet(shell, command, pid)) {
+            return false;
+        }
+
+        int status = 0;
+        struct rusage usage = {};
+        while (wait4(pid, &status, 0, &usage) < 0) {
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        sample.wallUs = std::chrono::duration<double, std::micro>(end - start).count();
+        sample.minorFaults = usage.ru_minflt;
+        sample.majorFaults = usage.ru_majflt;
+        sample.syscalls = countCalls ? countSyscalls(shell, command) : -1;
+        return true;
+    }
+
+    int benchmark(const std::string& shell, int argc, char* argv[]) {
+        int runs = config::STARTUP_BENCHMARK_RUNS;
+        std::string command = "true";
+        if (argc > 0) {
+            runs = std::max(1, std::atoi(argv[0]));
+        }
+        if (argc > 1) {
+            command = argv[1];
+        }
+
+        std::vector<double> wall;
+        std::vector<double> minor;
+        long major = 0;
+        for (int i = 0; i < runs; ++i) {
+            Sample sample;
+            if (!measure(shell, command, false, sample)) {
+                std::cerr << config::SHELL_NAME << ": --startup-benchmark: cannot run " << shell << std::endl;
+                return 2;
+            }
+            wall.push_back(sample.wallUs);
+            minor.push_back(static_cast<double>(sample.minorFaults));
+            major = std::max(major, sample.majorFaults);
+        }
+        long syscalls = countSyscalls(shell, command);
+
+        double wallMedian = percentile(wall, 0.5);
+        long faultsMedian = static_cast<long>(percentile(minor, 0.5));
+
+        char line[256];
+        std::snprintf(line, sizeof(line), "startup: %s -c '%s', %d runs\n", shell.c_str(), command.c_str(), runs);
+        std::cout << line;
+        std::snprintf(line, sizeof(line), "  wall time     median %8.0f us  p90 %8.0f us  budget %8.0f us\n",
+            wallMedian, percentile(wall, 0.9), config::STARTUP_BUDGET_WALL_US);
+        std::cout << line;
+        std::snprintf(line, sizeof(line), "  minor faults  median %8ld     max %8.0f     budget %8ld\n",
+            faultsMedian, percentile(minor, 1.0), config::STARTUP_BUDGET_MINOR_FAULTS);
+        std::cout << line;
+        std::snprintf(line, sizeof(line), "  major faults  max    %8ld\n", major);
+        std::cout << line;
+        if (syscalls >= 0) {
+            std::snprintf(line, sizeof(line), "  system calls  %15ld              budget %8ld\n",
+                syscalls, config::STARTUP_BUDGET_SYSCALLS);
+        }
+        else {
+            std::snprintf(line, sizeof(line), "  system calls  not counted (ptrace unavailable)\n");
+        }
+        std::cout << line;
+
+        // The median, not the worst run, is held to the budget so a noisy
+        // machine does not fail it
+        bool over = false;
+        if (wallMedian > config::STARTUP_BUDGET_WALL_US) {
+            std::cerr << "startup: wall time over budget" << std::endl;
+            over = true;
+        }
+        if (faultsMedian > config::STARTUP_BUDGET_MINOR_FAULTS) {
+            std::cerr << "startup: page faults over budget" << std::endl;
+            over = true;
+        }
+        if (syscalls > config::STARTUP_BUDGET_SYSCALLS) {
+            std::cerr << "startup: system calls over budget" << std::endl;
+            over = true;
+        }
+        return over ? 1 : 0;
+    }
+}
@@ -0,0 +1,34 @@
+// StartupBenchmark.h - Cold-start cost of one-shot shells
+
+#ifndef STARTUP_BENCHMARK_H
+#define STARTUP_BENCHMARK_H
+
+#include <string>
+
+// Measures what `cppshell -c command` costs from exec to exit, the way an
+// orchestration layer that starts the shell for every command pays for it.
+//
+//   cppshell --startup-benchmark [runs] [command]
+//
+// Wall time and page faults come from timing and wait4(2)ing plain runs;
+// system calls are counted in one extra run under ptrace(2). The figures
+// are checked against the config::STARTUP_BUDGET_* limits and the exit
+// status is 1 when any is exceeded.
+namespace startup {
+
+    struct Sample {
+        double wallUs = 0;
+        long minorFaults = 0;
+        long majorFaults = 0;
+        long syscalls = -1; // -1 when not counted
+    };
+
+    // Run `shell -c command` once; returns false if it could not be run
+    bool measure(const std::string& shell, const std::string& command, bool countSyscalls,
+        Sample& sample);
+
+    // Implementation of --startup-benchmark; args are the ones after it
+    int benchmark(const std::string& shell, int argc, char* argv[]);
+}
+
+#endif // STARTUP_BENCHMARK_H
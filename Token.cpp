@@ -11,6 +11,8 @@ std::string Token::toString() const {
     case TokenType::REDIRECT_IN: typeStr = "REDIRECT_IN"; break;
     case TokenType::REDIRECT_OUT: typeStr = "REDIRECT_OUT"; break;
     case TokenType::REDIRECT_APPEND: typeStr = "REDIRECT_APPEND"; break;
+    case TokenType::HEREDOC: typeStr = "HEREDOC"; break;
+    case TokenType::HERESTRING: typeStr = "HERESTRING"; break;
     case TokenType::BACKGROUND: typeStr = "BACKGROUND"; break;
     case TokenType::SEMICOLON: typeStr = "SEMICOLON"; break;
     case TokenType::AND_OPERATOR: typeStr = "AND_OPERATOR"; break;
@@ -20,5 +22,5 @@ std::string Token::toString() const {
     default: typeStr = "UNKNOWN"; break;
     }
 
-    return "Token{type=" + typeStr + ", value='" + m_value + "'}";
+    return "Token{type=" + typeStr + ", value='" + std::string(getValue()) + "'}";
 }
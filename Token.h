@@ -3,7 +3,9 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 // Token types for lexical analysis
 enum class TokenType {
@@ -12,6 +14,8 @@ enum class TokenType {
     REDIRECT_IN,    // Input redirection '<'
     REDIRECT_OUT,   // Output redirection '>'
     REDIRECT_APPEND,// Append output redirection '>>'
+    HEREDOC,        // Here-document '<<' or '<<-'; the value is its body
+    HERESTRING,     // Here-string '<<<'
     BACKGROUND,     // Background execution '&'
     SEMICOLON,      // Command separator ';'
     AND_OPERATOR,   // Logical AND '&&'
@@ -20,22 +24,49 @@ enum class TokenType {
     END_OF_INPUT    // End of input stream
 };
 
-// Token class representing a lexical unit
+// Properties of a word the parser passes on to the executor
+enum WordFlag : std::uint8_t {
+    WORD_GLOB = 1 << 0,         // Has an unquoted *, ? or [ and so is a pathname pattern
+    WORD_SUBSTITUTION = 1 << 1  // Has a $(...), kept as written with its quotes and escapes
+};
+
+// Token class representing a lexical unit.
+//
+// A token normally refers straight into the lexer's input buffer, which must
+// outlive it. Only words whose text differs from the source (quotes and escapes
+// that had to be removed) carry their own copy.
 class Token {
 public:
-    Token(TokenType type, const std::string& value = "")
-        : m_type(type), m_value(value) {}
+    Token(TokenType type, std::string_view value = std::string_view())
+        : m_type(type), m_value(value), m_owned(false), m_flags(0) {}
+
+    // Token whose value was rewritten and so cannot point into the source
+    static Token makeOwned(TokenType type, std::string value) {
+        Token token(type);
+        token.m_storage = std::move(value);
+        token.m_owned = true;
+        return token;
+    }
 
     // Getters
     TokenType getType() const { return m_type; }
-    const std::string& getValue() const { return m_value; }
+    std::string_view getValue() const {
+        return m_owned ? std::string_view(m_storage) : m_value;
+    }
+    bool isOwned() const { return m_owned; }
+
+    // WordFlag bits of a WORD token
+    std::uint8_t getFlags() const { return m_flags; }
+    void addFlags(std::uint8_t flags) { m_flags |= flags; }
 
     // Helper methods for token type checking
     bool isWord() const { return m_type == TokenType::WORD; }
     bool isRedirect() const {
         return m_type == TokenType::REDIRECT_IN ||
             m_type == TokenType::REDIRECT_OUT ||
-            m_type == TokenType::REDIRECT_APPEND;
+            m_type == TokenType::REDIRECT_APPEND ||
+            m_type == TokenType::HEREDOC ||
+            m_type == TokenType::HERESTRING;
     }
     bool isOperator() const {
         return m_type == TokenType::PIPE ||
@@ -49,7 +80,10 @@ public:
 
 private:
     TokenType m_type;
-    std::string m_value;
+    std::string_view m_value;
+    std::string m_storage;
+    bool m_owned;
+    std::uint8_t m_flags;
 };
 
 #endif // TOKEN_H
\ No newline at end of file
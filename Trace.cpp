@@ -0,0 +1,300 @@
+// Trace.cpp - Execution tracing in Chrome trace format implementation
+
+#include "Trace.h"
+#include "PipeIO.h"
+#include "ShellConfig.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+namespace trace {
+    namespace detail {
+        std::atomic<bool> g_enabled{ false };
+    }
+}
+
+namespace {
+
+    // Spans a thread keeps before writing them out
+    const size_t FLUSH_EVENTS = 4096;
+
+    // Longest command text kept in a span name
+    const size_t NAME_LENGTH = 64;
+
+    struct Event {
+        const char* type;
+        std::string text;
+        pid_t pid;
+        int status;
+        std::uint64_t start;
+        std::uint64_t end;
+        struct rusage usage;
+        bool hasUsage;
+    };
+
+    std::chrono::steady_clock::time_point g_origin;
+    std::mutex g_fileMutex;
+    int g_fd = -1;
+    pid_t g_shellPid = 0;
+    std::atomic<int> g_nextThread{ 1 };
+
+    void appendEscaped(std::string& out, const std::string& text, size_t limit) {
+        for (size_t i = 0; i < text.size() && i < limit; ++i) {
+            char c = text[i];
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                out += code;
+            }
+            else {
+                out += c;
+            }
+        }
+        if (text.size() > limit) {
+            out += "...";
+        }
+    }
+
+    long micros(const struct timeval& time) {
+        return static_cast<long>(time.tv_sec) * 1000000 + static_cast<long>(time.tv_usec);
+    }
+
+    // Resources used between two snapshots
+    struct rusage difference(const struct rusage& after, const struct rusage& before) {
+        struct rusage usage = after;
+        long user = micros(after.ru_utime) - micros(before.ru_utime);
+        long system = micros(after.ru_stime) - micros(before.ru_stime);
+        usage.ru_utime.tv_sec = user / 1000000;
+        usage.ru_utime.tv_usec = user % 1000000;
+        usage.ru_stime.tv_sec = system / 1000000;
+        usage.ru_stime.tv_usec = system % 1000000;
+        usage.ru_minflt = after.ru_minflt - before.ru_minflt;
+        usage.ru_majflt = after.ru_majflt - before.ru_majflt;
+        return usage;
+    }
+
+    void format(std::string& out, const Event& event, int tid) {
+        char number[160];
+        out += "{\"name\":\"";
+        appendEscaped(out, event.text, NAME_LENGTH);
+        out += "\",\"cat\":\"";
+        out += event.type;
+        std::snprintf(number, sizeof(number), "\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d",
+            static_cast<unsigned long long>(event.start),
+            static_cast<unsigned long long>(event.end - event.start), static_cast<int>(g_shellPid), tid);
+        out += number;
+        out += ",\"args\":{\"type\":\"";
+        out += event.type;
+        out += "\",\"command\":\"";
+        appendEscaped(out, event.text, event.text.size());
+        std::snprintf(number, sizeof(number), "\",\"status\":%d", event.status);
+        out += number;
+        if (event.pid > 0) {
+            std::snprintf(number, sizeof(number), ",\"pid\":%d", static_cast<int>(event.pid));
+            out += number;
+        }
+        if (event.hasUsage) {
+            std::snprintf(number, sizeof(number),
+                ",\"utime_us\":%ld,\"stime_us\":%ld,\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld",
+                micros(event.usage.ru_utime), micros(event.usage.ru_stime), event.usage.ru_maxrss,
+                event.usage.ru_minflt, event.usage.ru_majflt);
+            out += number;
+        }
+        out += "}},\n";
+    }
+
+    // Spans recorded by one thread, written out when full and when the
+    // thread ends
+    struct ThreadBuffer {
+        int tid = g_nextThread.fetch_add(1);
+        std::vector<Event> events;
+
+        ~ThreadBuffer() {
+            flush();
+        }
+
+        void flush() {
+            if (events.empty()) {
+                return;
+            }
+            std::string text;
+            for (const auto& event : events) {
+                format(text, event, tid);
+            }
+            events.clear();
+
+            std::lock_guard<std::mutex> lock(g_fileMutex);
+            // A forked copy of the shell leaves the parent's file alone
+            if (g_fd >= 0 && getpid() == g_shellPid) {
+                pipeio::writeAll(g_fd, text.data(), text.size());
+            }
+        }
+    };
+
+    thread_local ThreadBuffer t_buffer;
+    thread_local trace::Span* t_current = nullptr;
+
+    void push(Event event) {
+        t_buffer.events.push_back(std::move(event));
+        if (t_buffer.events.size() >= FLUSH_EVENTS) {
+            t_buffer.flush();
+        }
+    }
+
+    // Close the JSON array; events still buffered on other threads are lost
+    void finishTrace() {
+        t_buffer.flush();
+        trace::detail::g_enabled = false;
+
+        std::lock_guard<std::mutex> lock(g_fileMutex);
+        if (g_fd >= 0 && getpid() == g_shellPid) {
+            char footer[128];
+            std::snprintf(footer, sizeof(footer),
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}\n]\n",
+                static_cast<int>(g_shellPid), config::SHELL_NAME.c_str());
+            pipeio::writeAll(g_fd, footer, std::strlen(footer));
+            close(g_fd);
+            g_fd = -1;
+        }
+    }
+
+    const char* typeName(CommandType type) {
+        switch (type) {
+        case CommandType::SIMPLE:
+            return "simple";
+        case CommandType::PIPELINE:
+            return "pipeline";
+        case CommandType::SEQUENCE:
+            return "sequence";
+        case CommandType::LOGICAL_AND:
+            return "and";
+        case CommandType::LOGICAL_OR:
+            return "or";
+        }
+        return "command";
+    }
+}
+
+namespace trace {
+
+    void startFromEnvironment() {
+        const char* path = std::getenv("CPPSHELL_TRACE");
+        if (path == nullptr || *path == '\0' || g_fd >= 0) {
+            return;
+        }
+
+        g_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (g_fd < 0) {
+            std::fprintf(stderr, "%s: %s: %s\n", config::SHELL_NAME.c_str(), path, std::strerror(errno));
+            return;
+        }
+
+        g_origin = std::chrono::steady_clock::now();
+        g_shellPid = getpid();
+        pipeio::writeAll(g_fd, "[\n", 2);
+        std::atexit(finishTrace);
+        detail::g_enabled = true;
+    }
+
+    std::uint64_t now() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - g_origin).count());
+    }
+
+    Span::Span(const Command& command)
+        : m_command(command), m_parent(nullptr), m_start(0), m_threadUsage(), m_childUsage(),
+        m_pid(0), m_processUsage(), m_finished(true) {
+        if (!enabled()) {
+            return;
+        }
+        m_finished = false;
+        m_parent = t_current;
+        t_current = this;
+        m_start = now();
+        getrusage(RUSAGE_THREAD, &m_threadUsage);
+        getrusage(RUSAGE_CHILDREN, &m_childUsage);
+    }
+
+    Span::~Span() {
+        if (!m_finished) {
+            finish(-1);
+        }
+    }
+
+    void Span::finish(int status) {
+        if (m_finished) {
+            return;
+        }
+        m_finished = true;
+        t_current = m_parent;
+
+        Event event;
+        event.type = typeName(m_command.getType());
+        event.text = m_command.toString();
+        event.pid = m_pid;
+        event.status = status;
+        event.start = m_start;
+        event.end = now();
+        event.hasUsage = true;
+
+        if (m_pid > 0) {
+            event.usage = m_processUsage;
+        }
+        else {
+            struct rusage thread;
+            struct rusage children;
+            getrusage(RUSAGE_THREAD, &thread);
+            getrusage(RUSAGE_CHILDREN, &children);
+            event.usage = difference(thread, m_threadUsage);
+            struct rusage waited = difference(children, m_childUsage);
+            long user = micros(event.usage.ru_utime) + micros(waited.ru_utime);
+            long system = micros(event.usage.ru_stime) + micros(waited.ru_stime);
+            event.usage.ru_utime.tv_sec = user / 1000000;
+            event.usage.ru_utime.tv_usec = user % 1000000;
+            event.usage.ru_stime.tv_sec = system / 1000000;
+            event.usage.ru_stime.tv_usec = system % 1000000;
+            event.usage.ru_minflt += waited.ru_minflt;
+            event.usage.ru_majflt += waited.ru_majflt;
+            event.usage.ru_maxrss = std::max(thread.ru_maxrss, children.ru_maxrss);
+        }
+        push(std::move(event));
+    }
+
+    void attachProcess(pid_t pid, const struct rusage& usage) {
+        if (t_current != nullptr && t_current->m_pid == 0) {
+            t_current->m_pid = pid;
+            t_current->m_processUsage = usage;
+        }
+    }
+
+    void record(const char* type, const std::string& text, pid_t pid, std::uint64_t start,
+        std::uint64_t end, int status, const struct rusage* usage) {
+        if (!enabled()) {
+            return;
+        }
+
+        Event event;
+        event.type = type;
+        event.text = text;
+        event.pid = pid;
+        event.status = status;
+        event.start = start;
+        event.end = end;
+        event.hasUsage = usage != nullptr;
+        if (usage != nullptr) {
+            event.usage = *usage;
+        }
+        push(std::move(event));
+    }
+}
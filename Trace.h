@@ -0,0 +1,75 @@
+// Trace.h - Execution tracing in Chrome trace format
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Command.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// Records a span for every command node the executor runs and writes them
+// as a Chrome trace (JSON array of complete events), which chrome://tracing
+// and Perfetto load directly.
+//
+// Tracing is off unless $CPPSHELL_TRACE names the output file. Spans are
+// kept in a buffer owned by the recording thread, so recording takes no
+// locks; a full buffer is formatted and appended to the file in one write.
+// Each span carries the node type, its text, the process it ran as (if
+// any), start and end time, exit status and resource usage: the process's
+// own for commands that ran as one, else what the thread and its waited-for
+// children used meanwhile.
+namespace trace {
+
+    namespace detail {
+        extern std::atomic<bool> g_enabled;
+    }
+
+    // Whether spans are being recorded
+    inline bool enabled() { return detail::g_enabled.load(std::memory_order_relaxed); }
+
+    // Start tracing into the file $CPPSHELL_TRACE names, if it is set; the
+    // trace is completed when the shell exits
+    void startFromEnvironment();
+
+    // Microseconds since tracing started
+    std::uint64_t now();
+
+    // Span of one command node, open from construction until finish(). Does
+    // nothing when tracing is off.
+    class Span {
+    public:
+        explicit Span(const Command& command);
+        ~Span();
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        void finish(int status);
+
+    private:
+        friend void attachProcess(pid_t pid, const struct rusage& usage);
+
+        const Command m_command;
+        Span* m_parent;
+        std::uint64_t m_start;
+        struct rusage m_threadUsage;
+        struct rusage m_childUsage;
+        pid_t m_pid;
+        struct rusage m_processUsage;
+        bool m_finished;
+    };
+
+    // Credit a process that was waited for to the innermost open span on
+    // this thread
+    void attachProcess(pid_t pid, const struct rusage& usage);
+
+    // Record a span whose bounds were measured elsewhere (pipeline stages,
+    // background jobs). usage may be null.
+    void record(const char* type, const std::string& text, pid_t pid, std::uint64_t start,
+        std::uint64_t end, int status, const struct rusage* usage);
+}
+
+#endif // TRACE_H
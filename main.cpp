@@ -1,13 +1,53 @@
 // main.cpp - Entry point for CppShell
 
+#include "Benchmark.h"
 #include "CppShell.h"
+#include "ShellStats.h"
+#include "StartupBenchmark.h"
+#include "Trace.h"
+#include <cstring>
 #include <iostream>
+#include <unistd.h>
 
 int main(int argc, char* argv[]) {
     try {
+        // Report costs at exit when $CPPSHELL_STATS asks for it
+        stats::dumpOnExit();
+
+        // Record a Chrome trace when $CPPSHELL_TRACE asks for it
+        trace::startFromEnvironment();
+
+        // Benchmarks: our own one-shot startup against its budget, or the
+        // whole regression suite
+        if (argc > 1 && (std::strcmp(argv[1], "--startup-benchmark") == 0 ||
+            std::strcmp(argv[1], "--benchmark") == 0)) {
+            char self[4096];
+            ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+            std::string shell = length > 0 ? std::string(self, static_cast<size_t>(length)) : argv[0];
+            if (std::strcmp(argv[1], "--startup-benchmark") == 0) {
+                return startup::benchmark(shell, argc - 2, argv + 2);
+            }
+            return bench::run(shell, argc - 2, argv + 2);
+        }
+
         // Create shell instance
         CppShell shell;
 
+        // cppshell -c command: run the string and leave; arguments after it
+        // are accepted for compatibility but not used yet
+        if (argc > 1 && std::strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) {
+                std::cerr << config::SHELL_NAME << ": -c: option requires an argument" << std::endl;
+                return 2;
+            }
+            return shell.runCommand(argv[2]);
+        }
+
+        // With a script argument, run it non-interactively
+        if (argc > 1) {
+            return shell.runScript(argv[1]);
+        }
+
         // Initialize the shell
         if (!shell.initialize()) {
             std::cerr << "Failed to initialize shell. Exiting." << std::endl;
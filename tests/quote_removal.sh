@@ -0,0 +1,42 @@
+#!/bin/sh
+# quote_removal.sh - Quotes are removed the same way in every word
+#
+# Usage: tests/quote_removal.sh [path/to/cppshell]
+# A word is lexed on its own or, when it holds $(...), handed to the
+# executor as written; both must join quoted and unquoted parts alike.
+
+SHELL_BIN=${1:-./bin/cppshell}
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+failures=0
+
+# expect NAME EXPECTED: run $WORK/NAME.sh and compare its output
+expect() {
+    output=$(cd "$WORK" && "$SHELL_BIN" "$WORK/$1.sh" 2>&1)
+    if [ "$output" = "$2" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: expected '$2', got '$output'"
+        failures=$((failures + 1))
+    fi
+}
+
+printf "echo a'b'\necho \$(echo)a'b'\n" > "$WORK/joined.sh"
+expect joined "ab
+ab"
+
+printf "echo \"x\"y'z' \$(echo)\"x\"y'z'\n" > "$WORK/mixed.sh"
+expect mixed "xyz xyz"
+
+printf "echo 'a\\\\b' \"c\\\\\"d\" \$(echo)'a\\\\b' \$(echo)\"c\\\\\"d\"\n" > "$WORK/escapes.sh"
+expect escapes 'a\b c"d a\b c"d'
+
+printf "echo 'it'\\\\''s' \$(echo)'it'\\\\''s'\n" > "$WORK/apostrophe.sh"
+expect apostrophe "it's it's"
+
+: > "$WORK/a*b"
+: > "$WORK/axb"
+printf "echo a'*'b \$(echo)a'*'b\n" > "$WORK/quoted_glob.sh"
+expect quoted_glob "a*b a*b"
+
+[ "$failures" -eq 0 ]
@@ -0,0 +1,42 @@
+#!/bin/sh
+# script_line_numbers.sh - Script errors report the physical line they are on
+#
+# Usage: tests/script_line_numbers.sh [path/to/cppshell]
+# Quoted strings, $(...) and escaped newlines can span lines; every line
+# they cover must still be counted in "script: line N" messages.
+
+SHELL_BIN=${1:-./bin/cppshell}
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+failures=0
+
+# expect_line NAME LINE: run $WORK/NAME.sh and check the reported line
+expect_line() {
+    message=$("$SHELL_BIN" "$WORK/$1.sh" 2>&1 >/dev/null)
+    case $message in
+        *"$1.sh: line $2:"*)
+            echo "ok   $1"
+            ;;
+        *)
+            echo "FAIL $1: expected line $2, got: $message"
+            failures=$((failures + 1))
+            ;;
+    esac
+}
+
+printf 'echo "a\nb\nc"\necho ok\necho x |\n' > "$WORK/double_quoted.sh"
+expect_line double_quoted 5
+
+printf "echo 'a\nb'\necho x |\n" > "$WORK/single_quoted.sh"
+expect_line single_quoted 3
+
+printf "echo \$(echo 'a\nb') \"\$(echo 'c\nd')\"\necho x |\n" > "$WORK/substitution.sh"
+expect_line substitution 4
+
+printf 'echo a\\\nb "c\\"\nd"\necho x |\n' > "$WORK/escaped_newline.sh"
+expect_line escaped_newline 4
+
+printf 'cat <<END\none\ntwo\nEND\necho x |\n' > "$WORK/here_document.sh"
+expect_line here_document 5
+
+[ "$failures" -eq 0 ]